@@ -0,0 +1,181 @@
+/*
+ * Usage: fscheck <directory> [disk:]<image>...
+ *
+ * Checks that the kernel's file system code (student-distrib/filesys_mod.c,
+ * built for Linux against shim/) reads back what mkfs put in each image:
+ * every regular file the image lists, subdirectories included in v2, must
+ * have the size and bytes of the same path under <directory>, read whole
+ * and in pieces that straddle block boundaries, and the image must list as
+ * many files as the directory holds (only its top level for a v1 image). An
+ * image given as disk:<image> is mounted as fsperf mounts one.
+ *
+ * Prints one line per image and exits with 1 at the first difference.
+ */
+#define _XOPEN_SOURCE 500		/* nftw */
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "shim.h"
+
+#define MAX_PATH		256
+#define PIECE			4093		/* odd read length: pieces start all over a block */
+
+static const char* src_dir;
+static const char* image_name;
+static uint8_t* image_buf;
+static uint8_t* host_buf;
+static uint32_t buf_size;
+
+static void fail(const char* msg, const char* path)
+{
+	printf("%s: FAILED %s: %s\n", image_name, msg, path);
+	exit(1);
+}
+
+/* host_file() - the file under the source directory into host_buf; its size,
+ * or -1 if it is missing */
+static long host_file(const char* path)
+{
+	char full[2 * MAX_PATH];
+	FILE* f;
+	long size;
+
+	snprintf(full, sizeof(full), "%s/%s", src_dir, path);
+	if ((f = fopen(full, "rb")) == NULL)
+		return -1;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	rewind(f);
+	if (image_buf == NULL || (uint32_t)size > buf_size) {
+		buf_size = size;
+		if ((host_buf = realloc(host_buf, buf_size)) == NULL ||
+			(image_buf = realloc(image_buf, buf_size + PIECE)) == NULL)
+			fail("out of memory", path);
+	}
+	if (fread(host_buf, 1, size, f) != (size_t)size)
+		size = -1;
+	fclose(f);
+	return size;
+}
+
+/* check_file() - one file of the image against the source */
+static void check_file(const char* path, uint32_t inode, uint32_t size)
+{
+	dentry_t d;
+	uint32_t off;
+	long host_size = host_file(path);
+	int32_t n;
+
+	if (host_size < 0)
+		fail("not in the source", path);
+	if (size != host_size)
+		fail("size differs", path);
+	if (read_dentry_by_name((uint8_t*)path, &d) != 0 || d.inode != inode)
+		fail("lookup by name", path);
+
+	memset(image_buf, 0, size);
+	if (read_data(inode, 0, image_buf, size + PIECE) != (int32_t)size ||
+		memcmp(image_buf, host_buf, size) != 0)
+		fail("contents differ", path);
+
+	memset(image_buf, 0, size);
+	for (off = 0; (n = read_data(inode, off, image_buf + off, PIECE)) > 0; off += n)
+		;
+	if (n < 0 || off != size || memcmp(image_buf, host_buf, size) != 0)
+		fail("contents differ in pieces", path);
+}
+
+/* check_dir() - the files of an image directory and, in v2, of its
+ * subdirectories; returns how many there were. Entries are read through
+ * descriptor 2 of the shim's process, all of them before recursing, as
+ * read_dirents moves its position. */
+static int check_dir(uint32_t dir, const char* prefix)
+{
+	fd_entry_t* fd = &get_pcb(process_count)->fde[2];
+	dirent_t* ents = NULL;
+	int num = 0, cap = 0, files = 0, n, i;
+	char path[MAX_PATH];
+
+	memset(fd, 0, sizeof(*fd));
+	fd->inode = dir;
+	do {
+		if (num == cap) {
+			cap = cap ? 2 * cap : 64;
+			if ((ents = realloc(ents, cap * sizeof(*ents))) == NULL)
+				fail("out of memory", prefix);
+		}
+		n = read_dirents(2, ents + num, cap - num);
+		num += n;
+	} while (n > 0);
+
+	for (i = 0; i < num; i++) {
+		if (strcmp(ents[i].name, ".") == 0 || strcmp(ents[i].name, "..") == 0)
+			continue;
+		if (snprintf(path, sizeof(path), "%s%s", prefix, ents[i].name) >= (int)sizeof(path))
+			fail("path too long", ents[i].name);
+
+		if (ents[i].type == FILE_TYPE_DIRECTORY && fs_info.version == FS_V2_VERSION) {
+			strcat(path, "/");
+			files += check_dir(ents[i].inode, path);
+		} else if (ents[i].type == FILE_TYPE_REGULAR) {
+			check_file(path, ents[i].inode, ents[i].size);
+			files++;
+		}
+	}
+	free(ents);
+	return files;
+}
+
+/* host_count() - counts a regular file under the source directory, one
+ * directly in it unless the image format has subdirectories; nftw callback.
+ * (The kernel's own struct dirent keeps readdir out of this file.) */
+static int host_files, host_recurse;
+
+static int host_count(const char* path, const struct stat* st, int type, struct FTW* ftw)
+{
+	if (type == FTW_F && S_ISREG(st->st_mode) && (host_recurse || ftw->level == 1))
+		host_files++;
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t* module;
+	uint32_t size;
+	int i, files, expected;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: fscheck <directory> [disk:]<image>...\n");
+		return 1;
+	}
+	src_dir = argv[1];
+
+	for (i = 2; i < argc; i++) {
+		image_name = argv[i];
+		if (strncmp(argv[i], "disk:", 5) == 0) {
+			if (open_disk(argv[i] + 5, &size) != 0 || filesys_init_disk() != 0)
+				fail("cannot mount disk", argv[i] + 5);
+		} else {
+			if ((module = load_image(argv[i], &size)) == NULL)
+				fail("cannot read image", argv[i]);
+			filesys_init(module);
+		}
+
+		files = check_dir(fs_info.root_inode, "");
+		host_files = 0;
+		host_recurse = fs_info.version == FS_V2_VERSION;
+		if (nftw(src_dir, host_count, 16, 0) != 0)
+			fail("cannot walk", src_dir);
+		expected = host_files;
+		if (files != expected) {
+			printf("%s: FAILED %d files, %s has %d\n", image_name, files, src_dir, expected);
+			return 1;
+		}
+		printf("%s: v%u, %d files match %s\n", image_name, fs_info.version, files, src_dir);
+	}
+
+	return 0;
+}
@@ -0,0 +1,337 @@
+/*
+ * Usage: fsperf [-t <ms>] [-b <baseline>] [disk:]<image>...
+ *
+ * Times the kernel's file system code (student-distrib/filesys_mod.c, built
+ * for Linux against shim/) on images made by mkfs: name lookups, index
+ * lookups, and read_data() over every file with sequential and random
+ * access of small and large lengths. Each benchmark repeats whole passes for
+ * at least -t milliseconds (default 200). An image given as disk:<image> is
+ * mounted the way filesys_init_disk mounts an ATA disk, its blocks read
+ * from the file into the block cache as they are used.
+ *
+ * The output is a table, one line per image and benchmark. Saved to a file
+ * it can be given back as -b, and each line then also shows how much its
+ * time per operation changed against that run.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shim.h"
+
+#define MAX_FILES		1024
+#define MAX_PATH		256
+#define RAND_OPS		4096		/* reads per pass of a random benchmark */
+#define MAX_BASELINE	256
+#define NAME_WIDTH		20
+
+struct file {
+	char path[MAX_PATH];
+	char miss[MAX_PATH];			/* path with its last character changed */
+	uint32_t inode;
+	uint32_t size;
+};
+
+struct result {
+	char image[NAME_WIDTH + 1];
+	char bench[NAME_WIDTH + 1];
+	double ns;
+};
+
+static struct file files[MAX_FILES];
+static int num_files;
+static uint32_t max_size;
+static uint8_t* buf;
+static double min_ns = 200e6;
+static struct result baseline[MAX_BASELINE];
+static int num_baseline;
+static uint32_t rand_state;
+
+static void die(const char* msg, const char* what)
+{
+	fprintf(stderr, "fsperf: %s%s%s\n", msg, what ? ": " : "", what ? what : "");
+	exit(1);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* the same pseudo-random offsets on every run, so runs compare */
+static uint32_t next_rand(void)
+{
+	rand_state = rand_state * 1103515245 + 12345;
+	return rand_state >> 8;
+}
+
+/* collect() - adds the regular files of a directory and, in a v2 image, of
+ * its subdirectories. Entries are read through descriptor 2 of the shim's
+ * process, all of them before recursing, as read_dirents moves its position. */
+static void collect(uint32_t dir, const char* prefix)
+{
+	fd_entry_t* fd = &get_pcb(process_count)->fde[2];
+	dirent_t* ents = NULL;
+	int num = 0, cap = 0, n, i;
+	char path[MAX_PATH];
+
+	memset(fd, 0, sizeof(*fd));
+	fd->inode = dir;
+	do {
+		if (num == cap) {
+			cap = cap ? 2 * cap : 64;
+			if ((ents = realloc(ents, cap * sizeof(*ents))) == NULL)
+				die("out of memory", NULL);
+		}
+		n = read_dirents(2, ents + num, cap - num);
+		num += n;
+	} while (n > 0);
+
+	for (i = 0; i < num; i++) {
+		if (strcmp(ents[i].name, ".") == 0 || strcmp(ents[i].name, "..") == 0)
+			continue;
+		if (snprintf(path, sizeof(path), "%s%s", prefix, ents[i].name) >= (int)sizeof(path))
+			continue;
+
+		if (ents[i].type == FILE_TYPE_DIRECTORY && fs_info.version == FS_V2_VERSION) {
+			strcat(path, "/");
+			collect(ents[i].inode, path);
+		} else if (ents[i].type == FILE_TYPE_REGULAR && num_files < MAX_FILES) {
+			struct file* f = &files[num_files++];
+
+			strcpy(f->path, path);
+			strcpy(f->miss, path);
+			f->miss[strlen(f->miss) - 1] ^= 0x40;
+			f->inode = ents[i].inode;
+			f->size = ents[i].size;
+			if (f->size > max_size)
+				max_size = f->size;
+		}
+	}
+	free(ents);
+}
+
+/************************** benchmarks **************************/
+
+/* each runs one pass and returns the operations done; bytes counts data read */
+typedef uint64_t (*bench_fn)(uint32_t arg, uint64_t* bytes);
+
+static uint64_t name_hit(uint32_t arg, uint64_t* bytes)
+{
+	dentry_t d;
+	int i;
+
+	for (i = 0; i < num_files; i++) {
+		if (read_dentry_by_name((uint8_t*)files[i].path, &d) != 0)
+			die("lookup failed", files[i].path);
+	}
+	return num_files;
+}
+
+static uint64_t name_miss(uint32_t arg, uint64_t* bytes)
+{
+	dentry_t d;
+	int i;
+
+	for (i = 0; i < num_files; i++)
+		read_dentry_by_name((uint8_t*)files[i].miss, &d);
+	return num_files;
+}
+
+static uint64_t by_index(uint32_t arg, uint64_t* bytes)
+{
+	dentry_t d;
+	uint32_t i;
+
+	for (i = 0; read_dentry_by_index(i, &d) == 0; i++)
+		;
+	return i;
+}
+
+/* every file from start to end in reads of arg bytes */
+static uint64_t sequential(uint32_t arg, uint64_t* bytes)
+{
+	uint64_t ops = 0;
+	uint32_t off;
+	int32_t n;
+	int i;
+
+	for (i = 0; i < num_files; i++) {
+		for (off = 0; (n = read_data(files[i].inode, off, buf, arg)) > 0; off += n)
+			ops++;
+		if (n < 0 || off != files[i].size)
+			die("short read", files[i].path);
+		*bytes += off;
+	}
+	return ops;
+}
+
+/* reads of arg bytes at random offsets of randomly picked files */
+static uint64_t random_reads(uint32_t arg, uint64_t* bytes)
+{
+	struct file* f;
+	int32_t n;
+	int i;
+
+	for (i = 0; i < RAND_OPS; i++) {
+		f = &files[next_rand() % num_files];
+		n = read_data(f->inode, f->size ? next_rand() % f->size : 0, buf, arg);
+		if (n < 0)
+			die("read failed", f->path);
+		*bytes += n;
+	}
+	return RAND_OPS;
+}
+
+static const struct {
+	const char* name;
+	bench_fn fn;
+	uint32_t arg;
+} benches[] = {
+	{ "name_hit",	name_hit,		0 },
+	{ "name_miss",	name_miss,		0 },
+	{ "index",		by_index,		0 },
+	{ "seq_64",		sequential,		64 },
+	{ "seq_1k",		sequential,		1024 },
+	{ "seq_4k",		sequential,		4096 },
+	{ "seq_64k",	sequential,		65536 },
+	{ "seq_whole",	sequential,		0xFFFFFFFF },
+	{ "rand_64",	random_reads,	64 },
+	{ "rand_4k",	random_reads,	4096 },
+	{ "rand_64k",	random_reads,	65536 },
+};
+
+/************************** results **************************/
+
+static const char* base_name(const char* path)
+{
+	const char* slash = strrchr(path, '/');
+
+	return slash ? slash + 1 : path;
+}
+
+/* read_baseline() - lines of an earlier run; comments start with '#' */
+static void read_baseline(const char* path)
+{
+	FILE* f = fopen(path, "r");
+	char line[256];
+	struct result* r;
+	unsigned long long ops;
+
+	if (f == NULL)
+		die("cannot open baseline", path);
+	while (fgets(line, sizeof(line), f) != NULL && num_baseline < MAX_BASELINE) {
+		r = &baseline[num_baseline];
+		if (line[0] != '#' && sscanf(line, "%20s %20s %llu %lf", r->image, r->bench, &ops, &r->ns) == 4)
+			num_baseline++;
+	}
+	fclose(f);
+}
+
+static const struct result* find_baseline(const char* image, const char* bench)
+{
+	int i;
+
+	for (i = 0; i < num_baseline; i++) {
+		if (strcmp(baseline[i].image, image) == 0 && strcmp(baseline[i].bench, bench) == 0)
+			return &baseline[i];
+	}
+	return NULL;
+}
+
+static void run(const char* image, int b)
+{
+	const struct result* base;
+	uint64_t ops = 0, bytes = 0;
+	double start = now_ns(), elapsed, ns;
+
+	rand_state = 1;
+	do {
+		ops += benches[b].fn(benches[b].arg, &bytes);
+		elapsed = now_ns() - start;
+	} while (elapsed < min_ns && ops != 0);
+
+	ns = ops ? elapsed / ops : 0;
+	printf("%-*s %-12s %10llu %12.1f", NAME_WIDTH, image, benches[b].name, (unsigned long long)ops, ns);
+	if (bytes)
+		printf(" %10.1f", bytes / (elapsed / 1e9) / (1 << 20));
+	else
+		printf(" %10s", "-");
+	if ((base = find_baseline(image, benches[b].name)) != NULL && base->ns > 0)
+		printf(" %+8.1f%%", (ns - base->ns) / base->ns * 100);
+	printf("\n");
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: fsperf [-t <ms>] [-b <baseline>] <image>...\n"
+					"  -t <ms>        least time per benchmark, 200 by default\n"
+					"  -b <baseline>  earlier output to compare times per operation with\n");
+	exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	const char* image;
+	uint32_t* module;
+	uint32_t size, hits, misses, transfers, pages;
+	char name[NAME_WIDTH + 1];
+	int i, b, first = 0;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			min_ns = atof(argv[++i]) * 1e6;
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+			read_baseline(argv[++i]);
+		else
+			usage();
+	}
+	if (i == argc)
+		usage();
+	first = i;
+
+	printf("# %-*s %-12s %10s %12s %10s%s\n", NAME_WIDTH - 2, "image", "benchmark", "ops",
+		   "ns/op", "MB/s", num_baseline ? "   change" : "");
+	for (i = first; i < argc; i++) {
+		if (strncmp(argv[i], "disk:", 5) == 0) {
+			snprintf(name, sizeof(name), "disk:%s", base_name(argv[i] + 5));
+			if (open_disk(argv[i] + 5, &size) != 0 || filesys_init_disk() != 0)
+				die("cannot mount disk", argv[i] + 5);
+		} else {
+			snprintf(name, sizeof(name), "%s", base_name(argv[i]));
+			if ((module = load_image(argv[i], &size)) == NULL)
+				die("cannot read image", argv[i]);
+			filesys_init(module);
+		}
+		image = name;
+		hits = fscache_hits();
+		misses = fscache_misses();
+		transfers = disk_transfers;
+		pages = disk_pages;
+		num_files = 0;
+		max_size = 0;
+		collect(fs_info.root_inode, "");
+		if (num_files == 0)
+			die("no files in image", argv[i]);
+		free(buf);
+		if ((buf = malloc(max_size + 65536)) == NULL)
+			die("out of memory", NULL);
+
+		printf("# %s: v%u, %u bytes, %d files, largest %u bytes\n", image, fs_info.version,
+			   size, num_files, max_size);
+		for (b = 0; b < (int)(sizeof(benches) / sizeof(benches[0])); b++)
+			run(image, b);
+		if (fscache_misses() != misses)
+			printf("# %s: block cache %u hits, %u misses\n", image,
+				   fscache_hits() - hits, fscache_misses() - misses);
+		if (disk_transfers != transfers)
+			printf("# %s: %u disk reads of %u kB on average\n", image, disk_transfers - transfers,
+				   (disk_pages - pages) * 4 / (disk_transfers - transfers));
+	}
+
+	return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Usage: fssync <directory> <image>
+ *
+ * Checks that fs_sync (student-distrib/filesys_mod.c, built for Linux
+ * against shim/) makes changes survive a reboot. <image> is mounted as a
+ * disk, as fsperf mounts one, and must have been made from <directory> with
+ * free space left after it. Files are written, created, cut and unlinked in
+ * the image and under <directory> alike, and after each round of changes the
+ * image is synced and mounted again from the file and the changed files read
+ * back; a round ends with enough holes between files that the next file
+ * needs an extent tree. "fscheck <directory> disk:<image>" then reads the
+ * whole image back in a fresh process.
+ *
+ * Prints what it did and exits with 1 at the first failure.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "shim.h"
+
+#define MAX_PATH		256
+#define SMALL_FILES		20			/* one block each; every other one is unlinked */
+#define SCATTERED		100			/* blocks of the file laid into their holes */
+
+static const char* src_dir;
+static const char* image_name;
+static uint8_t data[SCATTERED * KB4];
+static uint8_t image_buf[SCATTERED * KB4 + 1];
+static uint8_t host_buf[SCATTERED * KB4 + 1];
+
+static void fail(const char* msg, const char* path)
+{
+	printf("%s: FAILED %s: %s\n", image_name, msg, path);
+	exit(1);
+}
+
+static void host_path(char* full, const char* path)
+{
+	if (snprintf(full, 2 * MAX_PATH, "%s/%s", src_dir, path) >= 2 * MAX_PATH)
+		fail("path too long", path);
+}
+
+/* fill() - bytes that tell files and rounds apart */
+static void fill(uint32_t length, uint32_t seed)
+{
+	uint32_t i;
+
+	for (i = 0; i < length; i++)
+		data[i] = (uint8_t)(i * 7 + seed * 31 + i / KB4);
+}
+
+/* change_write() - writes data to a file of both, creating it if need be */
+static void change_write(const char* path, uint32_t offset, uint32_t length, uint32_t seed)
+{
+	char full[2 * MAX_PATH];
+	file_cursor_t cursor = { 0, 0 };
+	dentry_t d;
+	int fd;
+
+	fill(length, seed);
+	if (read_dentry_by_name((const uint8_t*)path, &d) != 0 &&
+		(fs_create((const uint8_t*)path) != 0 || read_dentry_by_name((const uint8_t*)path, &d) != 0))
+		fail("create", path);
+	if (write_cursor(d.inode, offset, &cursor, data, length) != (int32_t)length)
+		fail("write", path);
+
+	host_path(full, path);
+	if ((fd = open(full, O_WRONLY | O_CREAT, 0644)) < 0 ||
+		pwrite(fd, data, length, offset) != (ssize_t)length || close(fd) != 0)
+		fail("host write", full);
+}
+
+static void change_truncate(const char* path, uint32_t length)
+{
+	char full[2 * MAX_PATH];
+	dentry_t d;
+
+	if (read_dentry_by_name((const uint8_t*)path, &d) != 0 || fs_truncate(d.inode, length) != 0)
+		fail("truncate", path);
+	host_path(full, path);
+	if (truncate(full, length) != 0)
+		fail("host truncate", full);
+}
+
+static void change_unlink(const char* path)
+{
+	char full[2 * MAX_PATH];
+
+	if (fs_unlink((const uint8_t*)path) != 0)
+		fail("unlink", path);
+	host_path(full, path);
+	if (unlink(full) != 0)
+		fail("host unlink", full);
+}
+
+/* check() - a changed file against the source, or its absence */
+static void check(const char* path)
+{
+	char full[2 * MAX_PATH];
+	dentry_t d;
+	FILE* f;
+	long size;
+	int found = read_dentry_by_name((const uint8_t*)path, &d) == 0;
+
+	host_path(full, path);
+	if ((f = fopen(full, "rb")) == NULL) {
+		if (found)
+			fail("unlinked file is back", path);
+		return;
+	}
+	size = fread(host_buf, 1, sizeof(host_buf), f);
+	fclose(f);
+	if (!found)
+		fail("file is gone", path);
+	if (size == sizeof(host_buf))
+		fail("file too large to check", path);
+	if (read_data(d.inode, 0, image_buf, sizeof(image_buf)) != size ||
+		memcmp(image_buf, host_buf, size) != 0)
+		fail("contents differ", path);
+}
+
+/* sync_round() - writes the round back and mounts the image again as a reboot
+ * would, so nothing from before is left in memory */
+static void sync_round(const char* round, const char** paths, int n)
+{
+	uint32_t size;
+	int i;
+
+	if (fs_sync() != 0)
+		fail("fs_sync", round);
+	if (open_disk(image_name, &size) != 0 || filesys_init_disk() != 0)
+		fail("cannot mount disk again", round);
+	for (i = 0; i < n; i++)
+		check(paths[i]);
+	printf("%s: %s synced, %u blocks\n", image_name, round, fs_info.num_data_blocks);
+}
+
+/* raw_depth() - depth of a file's extent tree, from the image file itself */
+static uint32_t raw_depth(const char* path)
+{
+	fs_super_t super;
+	inode_v2_t inode;
+	dentry_t d;
+	int fd = open(image_name, O_RDONLY);
+
+	if (fd < 0 || read_dentry_by_name((const uint8_t*)path, &d) != 0 ||
+		pread(fd, &super, sizeof(super), 0) != sizeof(super) ||
+		pread(fd, &inode, sizeof(inode), (off_t)super.inode_start * KB4 + d.inode * FS_V2_INODE_SIZE) != sizeof(inode))
+		fail("cannot read inode", path);
+	close(fd);
+	return inode.root.depth;
+}
+
+int main(int argc, char** argv)
+{
+	static const char* first[] = {
+		"frame0.txt", "sub/new.txt", "sub/deeper/frame1.txt", "hello",
+		"sub/deeper/verylargetxtwithverylongname.txt"
+	};
+	char small[SMALL_FILES][MAX_PATH];
+	const char* smalls[SMALL_FILES + 1];
+	const char* scattered = "sub/deeper/scattered";
+	uint32_t* module;
+	uint32_t size, blocks;
+	dentry_t d;
+	int i;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: fssync <directory> <image>\n");
+		return 1;
+	}
+	src_dir = argv[1];
+	image_name = argv[2];
+
+	/* an image loaded as a module has nowhere to go */
+	if ((module = load_image(image_name, &size)) == NULL)
+		fail("cannot read image", image_name);
+	filesys_init(module);
+	if (fs_sync() != -1)
+		fail("fs_sync of a module", image_name);
+
+	if (open_disk(image_name, &size) != 0 || filesys_init_disk() != 0)
+		fail("cannot mount disk", image_name);
+	if (fs_info.version != FS_V2_VERSION)
+		fail("not a v2 image", image_name);
+
+	/* a file written past its end, a new one, an unlinked one, a cut one, and
+	 * one unlinked while open, which holds the sync up until it is closed */
+	change_write("frame0.txt", 5000, 300, 1);
+	change_write("sub/new.txt", 0, 3 * KB4 + 100, 2);
+	change_unlink("sub/deeper/frame1.txt");
+	change_truncate("sub/deeper/verylargetxtwithverylongname.txt", 3000);
+	if (read_dentry_by_name((const uint8_t*)"hello", &d) != 0)
+		fail("lookup", "hello");
+	fs_inode_open(d.inode);
+	change_unlink("hello");
+	if (fs_sync() != -1)
+		fail("fs_sync with an unlinked file open", "hello");
+	fs_inode_close(d.inode);
+	sync_round("changes", first, sizeof(first) / sizeof(first[0]));
+
+	/* small files next to each other, every other one unlinked */
+	for (i = 0; i < SMALL_FILES; i++) {
+		snprintf(small[i], MAX_PATH, "sub/small%02d", i);
+		smalls[i] = small[i];
+		change_write(small[i], 0, KB4, 10 + i);
+	}
+	sync_round("small files", smalls, SMALL_FILES);
+	for (i = 0; i < SMALL_FILES; i += 2)
+		change_unlink(small[i]);
+	sync_round("holes", smalls, SMALL_FILES);
+
+	/* a file first fit lays into the holes, with more extents than fit in the inode */
+	change_write(scattered, 0, SCATTERED * KB4, 3);
+	smalls[SMALL_FILES] = scattered;
+	sync_round("scattered file", smalls, SMALL_FILES + 1);
+	if (raw_depth(scattered) != 1)
+		fail("no extent tree", scattered);
+
+	/* written again, it takes the blocks it had */
+	blocks = fs_info.num_data_blocks;
+	change_unlink(scattered);
+	change_write(scattered, 0, SCATTERED * KB4, 4);
+	sync_round("rewritten file", &scattered, 1);
+	if (fs_info.num_data_blocks != blocks)
+		fail("image grew rewriting a file", scattered);
+
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * The kernel services filesys_mod.c calls, for running it as a Linux
+ * program. The kernel keeps frame addresses in uint32_t, so every frame and
+ * the image itself are mapped below 2 GB (MAP_32BIT). The ATA disk is an
+ * image file read with pread and written with pwrite.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shim.h"
+
+uint32_t process_count = 1;
+
+static fd_entry_t fd_table[OPS_SIZE];
+static process_control_block_t pcb = { fd_table };
+
+process_control_block_t* get_pcb(uint32_t pid)
+{
+	return &pcb;
+}
+
+uint32_t frames_in_use;
+
+uint32_t alloc_frame(void)
+{
+	void* p = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+
+	if (p == MAP_FAILED)
+		return 0;
+	frames_in_use++;
+	return (uint32_t)(uintptr_t)p;
+}
+
+void free_frame(uint32_t frame)
+{
+	munmap((void*)(uintptr_t)frame, 4096);
+	frames_in_use--;
+}
+
+int32_t image_cache_busy(uint32_t inode)
+{
+	return 0;
+}
+
+void image_cache_drop(uint32_t inode)
+{
+}
+
+void snapshot_drop(uint32_t inode)
+{
+}
+
+/* load_image() - the image read into memory the kernel cannot write, as
+ * GRUB's module is mapped; a page of slack past the end is left readable
+ * so a short final block reads as zeroes */
+uint32_t* load_image(const char* path, uint32_t* size)
+{
+	FILE* f = fopen(path, "rb");
+	struct stat st;
+	void* p;
+
+	if (f == NULL || fstat(fileno(f), &st) != 0)
+		return NULL;
+	p = mmap(NULL, st.st_size + 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	if (p == MAP_FAILED || fread(p, 1, st.st_size, f) != (size_t)st.st_size) {
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	mprotect(p, st.st_size + 4096, PROT_READ);
+	*size = st.st_size;
+	return p;
+}
+
+static int disk_fd = -1;
+static uint32_t disk_size;
+uint32_t disk_transfers;
+uint32_t disk_pages;
+
+/* open_disk() - makes the file the ATA disk, closing the one before */
+int open_disk(const char* path, uint32_t* size)
+{
+	struct stat st;
+
+	if (disk_fd >= 0)
+		close(disk_fd);
+	disk_fd = open(path, O_RDWR);		/* fs_sync writes it back */
+	if (disk_fd < 0 || fstat(disk_fd, &st) != 0)
+		return -1;
+	disk_size = *size = st.st_size;
+	return 0;
+}
+
+/* the image file is the only disk */
+int32_t ata_select(uint32_t n)
+{
+	return (disk_fd >= 0 && n == 0) ? SUCCESS : FAIL;
+}
+
+uint32_t ata_blocks(void)
+{
+	return (disk_fd >= 0) ? disk_size / 4096 : 0;
+}
+
+/* one pread per page, as the kernel has one PRD entry per page */
+int32_t ata_read(uint32_t lba, uint8_t* const* pages, uint32_t count)
+{
+	uint64_t pos = (uint64_t)lba * 512;
+	uint32_t i;
+
+	if (disk_fd < 0 || count == 0 || count > ATA_MAX_PAGES || pos + count * 4096 > disk_size)
+		return FAIL;
+	for (i = 0; i < count; i++) {
+		if (pread(disk_fd, pages[i], 4096, pos + i * 4096) != 4096)
+			return FAIL;
+	}
+	disk_transfers++;
+	disk_pages += count;
+	return SUCCESS;
+}
+
+/* and one pwrite per page the same way */
+int32_t ata_write(uint32_t lba, uint8_t* const* pages, uint32_t count)
+{
+	uint64_t pos = (uint64_t)lba * 512;
+	uint32_t i;
+
+	if (disk_fd < 0 || count == 0 || count > ATA_MAX_PAGES || pos + count * 4096 > disk_size)
+		return FAIL;
+	for (i = 0; i < count; i++) {
+		if (pwrite(disk_fd, pages[i], 4096, pos + i * 4096) != 4096)
+			return FAIL;
+	}
+	return SUCCESS;
+}
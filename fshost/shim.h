@@ -0,0 +1,21 @@
+/*
+ * Declarations shared by the host programs and shim.c. The kernel sources
+ * are compiled as they are; the headers in shim/ stand in for the kernel
+ * headers they include beyond the file system's own.
+ */
+#ifndef SHIM_H
+#define SHIM_H
+
+#include "syscalls.h"
+#include "filesys_mod.h"
+#include "fscache.h"
+#include "ata.h"
+
+extern uint32_t frames_in_use;
+extern uint32_t disk_transfers;			/* ata_read calls */
+extern uint32_t disk_pages;				/* 4 kB pages they read */
+
+uint32_t* load_image(const char* path, uint32_t* size);
+int open_disk(const char* path, uint32_t* size);
+
+#endif /* SHIM_H */
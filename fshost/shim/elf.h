@@ -0,0 +1,10 @@
+/* host stand-in for the kernel's elf.h: no program image cache */
+#ifndef _ELF_H
+#define _ELF_H
+
+#include "types.h"
+
+int32_t image_cache_busy(uint32_t inode);
+void image_cache_drop(uint32_t inode);
+
+#endif /* _ELF_H */
@@ -0,0 +1,12 @@
+/* host stand-in for the kernel's lib.h. The kernel's string functions take
+ * int8_t pointers; these casts let the C library's versions stand in. */
+#ifndef _LIB_H
+#define _LIB_H
+
+#include <string.h>
+
+#define strlen(s)			strlen((const char*)(s))
+#define strcpy(d, s)		strcpy((char*)(d), (const char*)(s))
+#define strncmp(a, b, n)	strncmp((const char*)(a), (const char*)(b), n)
+
+#endif /* _LIB_H */
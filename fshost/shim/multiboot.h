@@ -0,0 +1,4 @@
+/* host stand-in for the kernel's multiboot.h; the file system needs none of it */
+#ifndef _MULTIBOOT_H
+#define _MULTIBOOT_H
+#endif /* _MULTIBOOT_H */
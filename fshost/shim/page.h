@@ -0,0 +1,10 @@
+/* host stand-in for the kernel's page.h: frames come from shim.c */
+#ifndef _PAGE_H
+#define _PAGE_H
+
+#include "types.h"
+
+uint32_t alloc_frame(void);
+void free_frame(uint32_t frame);
+
+#endif /* _PAGE_H */
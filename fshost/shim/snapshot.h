@@ -0,0 +1,9 @@
+/* host stand-in for the kernel's snapshot.h: no execute() snapshots */
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include "types.h"
+
+void snapshot_drop(uint32_t inode);
+
+#endif /* _SNAPSHOT_H */
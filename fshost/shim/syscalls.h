@@ -0,0 +1,30 @@
+/* host stand-in for the kernel's syscalls.h: one process with a descriptor
+ * table, which is all the file system code looks at */
+#ifndef _SYSCALLS_H
+#define _SYSCALLS_H
+
+#include "types.h"
+#include "filesys_mod.h"
+
+#define SUCCESS			0
+#define FAIL			-1
+#define OPS_SIZE		8
+
+typedef struct fd_entry_t {
+	void* fop_ptr;
+	uint32_t inode;
+	uint8_t file_name[FNAME_LENGTH];
+	uint32_t file_pos;
+	file_cursor_t cursor;
+	uint32_t in_use;
+} fd_entry_t;
+
+typedef struct process_control_block_t {
+	fd_entry_t* fde;
+} process_control_block_t;
+
+extern uint32_t process_count;
+
+process_control_block_t* get_pcb(uint32_t pid);
+
+#endif /* _SYSCALLS_H */
@@ -0,0 +1,8 @@
+/* host stand-in for the kernel's types.h: the C library's fixed-width types */
+#ifndef _TYPES_H
+#define _TYPES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#endif /* _TYPES_H */
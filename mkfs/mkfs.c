@@ -0,0 +1,677 @@
+/*	*********************************************************
+	# FILE NAME: mkfs.c
+	# PURPOSE: host tool that builds a file system image for the kernel from
+	#		   a directory tree; replaces the prebuilt createfs
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+/*
+ * Usage: mkfs [-1] [-z] [-e <blocks>] <directory> [-o <output file>]
+ *
+ * The default is format v2: a superblock, a table of 128-byte inodes whose
+ * data is described by extents, and directories stored as files of sorted
+ * 64-byte entries, so subdirectories of <directory> become directories of
+ * the image. Each file's blocks are laid out back to back, which needs one
+ * extent; -e caps the blocks per extent, so larger files need more than the
+ * inode holds and get an extent tree (useful to test the tree code).
+ *
+ * -1 writes the flat v1 format of createfs instead: at most 63 entries, no
+ * subdirectories and at most 1023 blocks per file.
+ *
+ * -z compresses either format: each 4 kB block is LZ4 compressed on its own
+ * behind a table of block offsets, and the kernel decompresses blocks into
+ * a cache as they are read. A block that does not shrink is stored as is.
+ *
+ * Both formats get a "." entry for the root and an "rtc" entry for the
+ * real-time clock device. The on-disk layout must match filesys_mod.h and
+ * fscache.h.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define BLOCK_SIZE		4096
+#define FNAME_LENGTH	32
+#define DENTRY_SIZE		64
+
+#define FILE_TYPE_RTC		0
+#define FILE_TYPE_DIRECTORY	1
+#define FILE_TYPE_REGULAR	2
+
+/* v1 */
+#define V1_MAX_DENTRIES			63
+#define V1_MAX_DBLOCKS_PER_FILE	1023
+#define V1_DENTRY_OFFSET		64		/* entries follow 12 bytes of counts and 52 reserved */
+
+/* v2 */
+#define FS_V2_MAGIC			0x32534651	/* "QFS2" */
+#define FS_V2_VERSION		2
+#define FS_V2_INODE_SIZE	128
+#define FS_V2_ROOT_INODE	1
+#define INODES_PER_BLOCK	(BLOCK_SIZE / FS_V2_INODE_SIZE)
+#define EXT_MAGIC			0xE47E
+#define EXT_INLINE			8
+#define EXT_HEADER_SIZE		8
+#define EXT_SIZE			12
+#define EXT_PER_BLOCK		((BLOCK_SIZE - EXT_HEADER_SIZE) / EXT_SIZE)
+#define INODE_ROOT_OFFSET	16			/* extent header inside an inode */
+#define DEFAULT_EXTENT_MAX	32768		/* blocks per extent, 128 MB */
+#define MIN_INODES			64
+
+/* compressed images */
+#define FSZ_MAGIC			0x5A534651	/* "QFSZ" */
+#define FSZ_VERSION			1
+#define FSZ_HEADER_SIZE		16
+#define LZ4_MIN_MATCH		4
+#define LZ4_LAST_LITERALS	5
+#define LZ4_MF_LIMIT		12
+#define LZ4_HASH_BITS		12
+#define LZ4_MAX_OFFSET		0xFFFF
+#define LZ4_TOKEN_MAX		15
+
+struct node {
+	char name[FNAME_LENGTH + 1];
+	int type;
+	char* path;
+	uint32_t size;				/* bytes; for a directory, its entries */
+	uint32_t inode;
+	struct node* parent;
+	struct node** kids;
+	int num_kids;
+};
+
+static uint8_t* image;			/* grows a block at a time */
+static uint32_t num_blocks;
+static uint32_t image_blocks;	/* blocks allocated for image */
+static uint32_t extent_max = DEFAULT_EXTENT_MAX;
+
+static void die(const char* msg, const char* what)
+{
+	fprintf(stderr, "mkfs: %s%s%s\n", msg, what ? ": " : "", what ? what : "");
+	exit(1);
+}
+
+static void put32(uint8_t* p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void put16(uint8_t* p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+/* block_alloc() - appends a zeroed block to the image and returns its number */
+static uint32_t block_alloc(void)
+{
+	if (num_blocks == image_blocks) {
+		image_blocks = image_blocks ? 2 * image_blocks : 64;
+		image = realloc(image, (size_t)image_blocks * BLOCK_SIZE);
+		if (image == NULL)
+			die("out of memory", NULL);
+	}
+	memset(image + (size_t)num_blocks * BLOCK_SIZE, 0, BLOCK_SIZE);
+	return num_blocks++;
+}
+
+static uint8_t* block_addr(uint32_t block)
+{
+	return image + (size_t)block * BLOCK_SIZE;
+}
+
+/* names sort as NUL padded bytes compared unsigned, as the kernel searches them */
+static int name_compare(const char* a, const char* b)
+{
+	return memcmp(a, b, FNAME_LENGTH);
+}
+
+static int kid_compare(const void* a, const void* b)
+{
+	return name_compare((*(struct node* const*)a)->name, (*(struct node* const*)b)->name);
+}
+
+/* scan(path, name, parent) - reads a file or a directory tree into nodes;
+ * NULL for anything else */
+static struct node* scan(const char* path, const char* name, struct node* parent)
+{
+	struct node* n = calloc(1, sizeof(*n));
+	struct stat st;
+	DIR* dir;
+	struct dirent* de;
+	char* kid_path;
+	int i;
+
+	if (n == NULL)
+		die("out of memory", NULL);
+	if (stat(path, &st) == -1)
+		die(strerror(errno), path);
+
+	if (strlen(name) > FNAME_LENGTH)
+		fprintf(stderr, "mkfs: warning: %s truncated to %d characters\n", path, FNAME_LENGTH);
+	memset(n->name, 0, sizeof(n->name));
+	strncpy(n->name, name, FNAME_LENGTH);
+	n->path = strdup(path);
+	n->parent = parent;
+
+	if (S_ISREG(st.st_mode)) {
+		if (st.st_size > 0xFFFFFFFFLL - BLOCK_SIZE)
+			die("file too large", path);
+		n->type = FILE_TYPE_REGULAR;
+		n->size = st.st_size;
+		return n;
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		/* an rtc device node needs no copying: every image has an rtc entry */
+		if (strcmp(name, "rtc") != 0)
+			fprintf(stderr, "mkfs: warning: %s skipped, not a file or directory\n", path);
+		free(n->path);
+		free(n);
+		return NULL;
+	}
+
+	n->type = FILE_TYPE_DIRECTORY;
+	if ((dir = opendir(path)) == NULL)
+		die(strerror(errno), path);
+	while ((de = readdir(dir)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		kid_path = malloc(strlen(path) + strlen(de->d_name) + 2);
+		if (kid_path == NULL)
+			die("out of memory", NULL);
+		sprintf(kid_path, "%s/%s", path, de->d_name);
+		n->kids = realloc(n->kids, (n->num_kids + 1) * sizeof(*n->kids));
+		if (n->kids == NULL)
+			die("out of memory", NULL);
+		n->kids[n->num_kids] = scan(kid_path, de->d_name, n);
+		if (n->kids[n->num_kids] != NULL)
+			n->num_kids++;
+		free(kid_path);
+	}
+	closedir(dir);
+
+	qsort(n->kids, n->num_kids, sizeof(*n->kids), kid_compare);
+	for (i = 0; i + 1 < n->num_kids; i++)
+		if (name_compare(n->kids[i]->name, n->kids[i + 1]->name) == 0)
+			die("two names are the same after truncation", n->kids[i]->path);
+	return n;
+}
+
+/* read_file(n, buf) - reads a regular file's bytes into buf */
+static void read_file(struct node* n, uint8_t* buf)
+{
+	FILE* f = fopen(n->path, "rb");
+
+	if (f == NULL)
+		die(strerror(errno), n->path);
+	if (n->size && fread(buf, 1, n->size, f) != n->size)
+		die("short read", n->path);
+	fclose(f);
+}
+
+static void put_dentry(uint8_t* entry, const char* name, uint32_t type, uint32_t inode)
+{
+	memset(entry, 0, DENTRY_SIZE);
+	memcpy(entry, name, strnlen(name, FNAME_LENGTH));
+	put32(entry + FNAME_LENGTH, type);
+	put32(entry + FNAME_LENGTH + 4, inode);
+}
+
+/************************** v1 **************************/
+
+static void build_v1(struct node* root)
+{
+	uint32_t num_inodes = 0, blocks, i, b;
+	uint8_t* inode_block;
+	int k;
+
+	if (root->num_kids + 2 > V1_MAX_DENTRIES)
+		die("too many files for a v1 image", root->path);
+	for (k = 0; k < root->num_kids; k++) {
+		if (root->kids[k]->type != FILE_TYPE_REGULAR)
+			die("v1 images cannot hold directories", root->kids[k]->path);
+		if ((root->kids[k]->size + BLOCK_SIZE - 1) / BLOCK_SIZE > V1_MAX_DBLOCKS_PER_FILE)
+			die("file too large for a v1 image", root->kids[k]->path);
+		root->kids[k]->inode = num_inodes++;
+	}
+	if (num_inodes == 0)
+		num_inodes = 1;
+
+	/* boot block, then the inodes, then the data */
+	block_alloc();
+	for (i = 0; i < num_inodes; i++)
+		block_alloc();
+
+	put_dentry(block_addr(0) + V1_DENTRY_OFFSET, ".", FILE_TYPE_DIRECTORY, 0);
+	put_dentry(block_addr(0) + V1_DENTRY_OFFSET + DENTRY_SIZE, "rtc", FILE_TYPE_RTC, 0);
+
+	/* block_alloc may move the image, so addresses in it are not kept */
+	for (k = 0; k < root->num_kids; k++) {
+		struct node* n = root->kids[k];
+
+		put_dentry(block_addr(0) + V1_DENTRY_OFFSET + (k + 2) * DENTRY_SIZE, n->name, FILE_TYPE_REGULAR, n->inode);
+		blocks = (n->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		inode_block = block_addr(1 + n->inode);
+		put32(inode_block, n->size);
+		for (i = 0; i < blocks; i++) {
+			b = block_alloc();
+			inode_block = block_addr(1 + n->inode);
+			put32(inode_block + 4 + 4 * i, b - 1 - num_inodes);
+		}
+		if (blocks) {
+			uint8_t* buf = calloc(blocks, BLOCK_SIZE);
+			if (buf == NULL)
+				die("out of memory", NULL);
+			read_file(n, buf);
+			memcpy(block_addr(num_blocks - blocks), buf, n->size);
+			free(buf);
+		}
+	}
+
+	put32(block_addr(0), root->num_kids + 2);
+	put32(block_addr(0) + 4, num_inodes);
+	put32(block_addr(0) + 8, num_blocks - 1 - num_inodes);
+}
+
+/************************** v2 **************************/
+
+static uint32_t inode_table;		/* first block of the inode table */
+static uint32_t inode_count;		/* inodes handed out, 0 included */
+
+static uint8_t* inode_addr(uint32_t inode)
+{
+	return block_addr(inode_table + inode / INODES_PER_BLOCK) + (inode % INODES_PER_BLOCK) * FS_V2_INODE_SIZE;
+}
+
+/* number(n) - hands out inode numbers a directory level at a time */
+static void number(struct node* root)
+{
+	struct node** queue = malloc(sizeof(*queue));
+	int head = 0, tail = 0, k;
+
+	if (queue == NULL)
+		die("out of memory", NULL);
+	queue[tail++] = root;
+	inode_count = FS_V2_ROOT_INODE;
+	while (head < tail) {
+		struct node* n = queue[head++];
+
+		n->inode = inode_count++;
+		queue = realloc(queue, (tail + n->num_kids + 1) * sizeof(*queue));
+		if (queue == NULL)
+			die("out of memory", NULL);
+		for (k = 0; k < n->num_kids; k++)
+			queue[tail++] = n->kids[k];
+	}
+	free(queue);
+}
+
+static void put_extent(uint8_t* p, uint32_t logical, uint32_t start, uint32_t count)
+{
+	put32(p, logical);
+	put32(p + 4, start);
+	put32(p + 8, count);
+}
+
+static void put_header(uint8_t* p, uint16_t entries, uint16_t max, uint16_t depth)
+{
+	put16(p, EXT_MAGIC);
+	put16(p + 2, entries);
+	put16(p + 4, max);
+	put16(p + 6, depth);
+}
+
+/* write_extents(inode, first, blocks) - describes blocks laid out from first
+ * on as extents of at most extent_max blocks. Whatever does not fit in the
+ * inode goes into tree blocks, one level at a time from the leaves up. */
+static void write_extents(uint32_t inode, uint32_t first, uint32_t blocks)
+{
+	uint32_t n = blocks ? (blocks + extent_max - 1) / extent_max : 0;
+	uint32_t* logical = malloc((n + 1) * sizeof(uint32_t));
+	uint32_t* start = malloc((n + 1) * sizeof(uint32_t));
+	uint32_t* count = malloc((n + 1) * sizeof(uint32_t));
+	uint32_t i, j, nodes, node, depth = 0;
+	uint8_t* p;
+
+	if (logical == NULL || start == NULL || count == NULL)
+		die("out of memory", NULL);
+	for (i = 0; i < n; i++) {
+		logical[i] = i * extent_max;
+		start[i] = first + i * extent_max;
+		count[i] = (blocks - logical[i] < extent_max) ? blocks - logical[i] : extent_max;
+	}
+
+	while (n > EXT_INLINE) {
+		nodes = (n + EXT_PER_BLOCK - 1) / EXT_PER_BLOCK;
+		for (j = 0; j < nodes; j++) {
+			uint32_t lo = j * EXT_PER_BLOCK;
+			uint32_t hi = (lo + EXT_PER_BLOCK < n) ? lo + EXT_PER_BLOCK : n;
+
+			node = block_alloc();
+			p = block_addr(node);
+			put_header(p, hi - lo, EXT_PER_BLOCK, depth);
+			for (i = lo; i < hi; i++)
+				put_extent(p + EXT_HEADER_SIZE + (i - lo) * EXT_SIZE, logical[i], start[i], count[i]);
+			logical[j] = logical[lo];
+			start[j] = node;
+			count[j] = 0;
+		}
+		n = nodes;
+		depth++;
+	}
+
+	p = inode_addr(inode) + INODE_ROOT_OFFSET;
+	put_header(p, n, EXT_INLINE, depth);
+	for (i = 0; i < n; i++)
+		put_extent(p + EXT_HEADER_SIZE + i * EXT_SIZE, logical[i], start[i], count[i]);
+
+	free(logical);
+	free(start);
+	free(count);
+}
+
+/* dir_entries(n, buf) - fills buf with a directory's sorted entries and
+ * returns how many there are; buf may be NULL to count them */
+static uint32_t dir_entries(struct node* n, uint8_t* buf)
+{
+	struct node dot, dotdot, rtc;
+	struct node** all = malloc((n->num_kids + 3) * sizeof(*all));
+	uint32_t count = 0, i;
+	int k;
+
+	if (all == NULL)
+		die("out of memory", NULL);
+
+	memset(&dot, 0, sizeof(dot));
+	strcpy(dot.name, ".");
+	dot.type = FILE_TYPE_DIRECTORY;
+	dot.inode = n->inode;
+	all[count++] = &dot;
+	if (n->parent != NULL) {
+		memset(&dotdot, 0, sizeof(dotdot));
+		strcpy(dotdot.name, "..");
+		dotdot.type = FILE_TYPE_DIRECTORY;
+		dotdot.inode = n->parent->inode;
+		all[count++] = &dotdot;
+	} else {
+		memset(&rtc, 0, sizeof(rtc));
+		strcpy(rtc.name, "rtc");
+		rtc.type = FILE_TYPE_RTC;
+		rtc.inode = 0;
+		all[count++] = &rtc;
+	}
+	for (k = 0; k < n->num_kids; k++)
+		all[count++] = n->kids[k];
+
+	qsort(all, count, sizeof(*all), kid_compare);
+	for (i = 0; i + 1 < count; i++)
+		if (name_compare(all[i]->name, all[i + 1]->name) == 0)
+			die("name is reserved", all[i]->path ? all[i]->path : all[i + 1]->path);
+
+	for (i = 0; buf != NULL && i < count; i++)
+		put_dentry(buf + i * DENTRY_SIZE, all[i]->name, all[i]->type, all[i]->inode);
+
+	free(all);
+	return count;
+}
+
+/* write_node(n) - lays out a file's or directory's data and its inode */
+static void write_node(struct node* n)
+{
+	uint32_t blocks, first, i;
+	uint8_t* buf;
+	uint8_t* p;
+	int k;
+
+	if (n->type == FILE_TYPE_DIRECTORY)
+		n->size = dir_entries(n, NULL) * DENTRY_SIZE;
+	blocks = (n->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	buf = calloc(blocks ? blocks : 1, BLOCK_SIZE);
+	if (buf == NULL)
+		die("out of memory", NULL);
+	if (n->type == FILE_TYPE_DIRECTORY)
+		dir_entries(n, buf);
+	else
+		read_file(n, buf);
+
+	first = num_blocks;
+	for (i = 0; i < blocks; i++)
+		memcpy(block_addr(block_alloc()), buf + (size_t)i * BLOCK_SIZE, BLOCK_SIZE);
+	free(buf);
+
+	p = inode_addr(n->inode);
+	put32(p, n->type);
+	put32(p + 4, n->size);
+	put32(p + 8, blocks);
+	write_extents(n->inode, first, blocks);
+
+	for (k = 0; k < n->num_kids; k++)
+		write_node(n->kids[k]);
+}
+
+static void build_v2(struct node* root)
+{
+	uint32_t num_inodes, table_blocks, i;
+	uint8_t* super;
+
+	number(root);
+	num_inodes = inode_count * 2 < MIN_INODES ? MIN_INODES : inode_count * 2;	/* room to create files */
+	num_inodes = (num_inodes + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK * INODES_PER_BLOCK;
+	table_blocks = num_inodes / INODES_PER_BLOCK;
+
+	block_alloc();
+	inode_table = num_blocks;
+	for (i = 0; i < table_blocks; i++)
+		block_alloc();
+
+	write_node(root);
+
+	super = block_addr(0);
+	put32(super, FS_V2_MAGIC);
+	put32(super + 4, FS_V2_VERSION);
+	put32(super + 8, BLOCK_SIZE);
+	put32(super + 12, num_blocks);
+	put32(super + 16, num_inodes);
+	put32(super + 20, inode_table);
+	put32(super + 24, FS_V2_ROOT_INODE);
+}
+
+/********************* compressed images *********************/
+
+/* the kernel's LZ4 block compressor (student-distrib/lz4.c), so images
+ * compress the same way pages do; any valid LZ4 block would decompress */
+static uint32_t lz4_hash(uint32_t seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static uint32_t read32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t put_length(uint8_t* op, uint32_t len)
+{
+	uint32_t n = 0;
+
+	while (len >= 255) {
+		op[n++] = 255;
+		len -= 255;
+	}
+	op[n++] = len;
+	return n;
+}
+
+/* emit() - one sequence of literals and a match (match_len 0 for the last) */
+static int emit(uint8_t* dst, uint32_t* op, uint32_t dst_cap, const uint8_t* lit,
+				uint32_t lit_len, uint32_t offset, uint32_t match_len)
+{
+	uint32_t worst = 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1;
+	uint8_t* token;
+	uint32_t o = *op;
+
+	if (o + worst > dst_cap)
+		return -1;
+
+	token = &dst[o++];
+	if (lit_len >= LZ4_TOKEN_MAX) {
+		*token = LZ4_TOKEN_MAX << 4;
+		o += put_length(&dst[o], lit_len - LZ4_TOKEN_MAX);
+	} else {
+		*token = lit_len << 4;
+	}
+	memcpy(&dst[o], lit, lit_len);
+	o += lit_len;
+
+	if (match_len != 0) {
+		dst[o++] = offset & 0xFF;
+		dst[o++] = offset >> 8;
+		match_len -= LZ4_MIN_MATCH;
+		if (match_len >= LZ4_TOKEN_MAX) {
+			*token |= LZ4_TOKEN_MAX;
+			o += put_length(&dst[o], match_len - LZ4_TOKEN_MAX);
+		} else {
+			*token |= match_len;
+		}
+	}
+
+	*op = o;
+	return 0;
+}
+
+/* lz4_compress() - compressed size, or -1 if it would not fit in dst_cap */
+static int lz4_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap)
+{
+	static uint16_t hash_table[1 << LZ4_HASH_BITS];
+	uint32_t ip = 0, anchor = 0, op = 0;
+	uint32_t seq, h, ref, len;
+
+	memset(hash_table, 0, sizeof(hash_table));
+
+	if (src_len > LZ4_MF_LIMIT) {
+		while (ip < src_len - LZ4_MF_LIMIT) {
+			seq = read32(&src[ip]);
+			h = lz4_hash(seq);
+			ref = hash_table[h];
+			hash_table[h] = ip;
+
+			if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read32(&src[ref]) != seq) {
+				ip++;
+				continue;
+			}
+
+			len = LZ4_MIN_MATCH;
+			while (ip + len < src_len - LZ4_LAST_LITERALS && src[ref + len] == src[ip + len])
+				len++;
+
+			if (emit(dst, &op, dst_cap, &src[anchor], ip - anchor, ip - ref, len) == -1)
+				return -1;
+			ip += len;
+			anchor = ip;
+		}
+	}
+
+	if (emit(dst, &op, dst_cap, &src[anchor], src_len - anchor, 0, 0) == -1)
+		return -1;
+
+	return op;
+}
+
+/* write_compressed() - header, num_blocks + 1 offsets from the start of the
+ * file, then each block compressed to less than BLOCK_SIZE or stored whole */
+static void write_compressed(FILE* out, const char* dst)
+{
+	uint32_t table_size = FSZ_HEADER_SIZE + 4 * (num_blocks + 1);
+	uint8_t* table = calloc(1, table_size);
+	uint8_t* data = malloc((size_t)num_blocks * BLOCK_SIZE);
+	uint32_t pos = 0, i;
+	int len;
+
+	if (table == NULL || (data == NULL && num_blocks != 0))
+		die("out of memory", NULL);
+
+	put32(table, FSZ_MAGIC);
+	put32(table + 4, FSZ_VERSION);
+	put32(table + 8, BLOCK_SIZE);
+	put32(table + 12, num_blocks);
+	for (i = 0; i < num_blocks; i++) {
+		put32(table + FSZ_HEADER_SIZE + 4 * i, table_size + pos);
+		len = lz4_compress(block_addr(i), BLOCK_SIZE, data + pos, BLOCK_SIZE - 1);
+		if (len == -1) {
+			memcpy(data + pos, block_addr(i), BLOCK_SIZE);
+			len = BLOCK_SIZE;
+		}
+		pos += len;
+	}
+	put32(table + FSZ_HEADER_SIZE + 4 * num_blocks, table_size + pos);
+
+	if (fwrite(table, 1, table_size, out) != table_size || fwrite(data, 1, pos, out) != pos)
+		die("write failed", dst);
+	fprintf(stderr, "mkfs: %u blocks, %u bytes compressed to %u\n",
+			num_blocks, num_blocks * BLOCK_SIZE, table_size + pos);
+	free(table);
+	free(data);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: mkfs [-1] [-z] [-e <blocks>] <directory> [-o <output file>]\n"
+					"  -1           flat v1 image, as createfs made\n"
+					"  -z           compress the image block by block\n"
+					"  -e <blocks>  at most this many blocks per extent (v2)\n"
+					"  -o <file>    output file, filesys_img by default\n");
+	exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	const char* src = NULL;
+	const char* dst = "filesys_img";
+	int v1 = 0, compress = 0, i;
+	struct node* root;
+	FILE* out;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-1") == 0)
+			v1 = 1;
+		else if (strcmp(argv[i], "-z") == 0)
+			compress = 1;
+		else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+			extent_max = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			dst = argv[++i];
+		else if (argv[i][0] != '-' && src == NULL)
+			src = argv[i];
+		else
+			usage();
+	}
+	if (src == NULL || extent_max == 0)
+		usage();
+
+	root = scan(src, ".", NULL);
+	if (root == NULL || root->type != FILE_TYPE_DIRECTORY)
+		die("not a directory", src);
+
+	if (v1)
+		build_v1(root);
+	else
+		build_v2(root);
+
+	if ((out = fopen(dst, "wb")) == NULL)
+		die(strerror(errno), dst);
+	if (compress)
+		write_compressed(out, dst);
+	else if (fwrite(image, BLOCK_SIZE, num_blocks, out) != num_blocks)
+		die("write failed", dst);
+	if (fclose(out) != 0)
+		die("write failed", dst);
+
+	return 0;
+}
@@ -0,0 +1,375 @@
+/*	*********************************************************
+	# FILE NAME: ata.c
+	# PURPOSE: IDE/ATA disk driver for the PIIX controller: the drives are
+	#		   found with IDENTIFY and read and written with bus master DMA,
+	#		   each transfer finishing on irq 14 or 15
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#include "ata.h"
+#include "pci.h"
+#include "i8259.h"
+#include "page.h"
+#include "lib.h"
+#include "syscalls.h"
+
+static ata_channel_t channels[ATA_CHANNELS];
+static ata_drive_t drives[ATA_DRIVES];	/* the disks found, in probe order */
+static uint32_t num_drives;
+static ata_drive_t* disk;				/* the one transfers go to; NULL if none */
+static volatile uint32_t busy;			/* a transfer is under way */
+static uint32_t bench_seed = 1;
+
+/* int32_t ata_not_busy(ata_channel_t* ch)
+ * INPUT: ch - channel
+ * OUTPUT: its status once BSY clears, FAIL if it never does
+ */
+static int32_t ata_not_busy(ata_channel_t* ch)
+{
+	uint32_t spins, status;
+
+	for(spins = 0; spins < ATA_TIMEOUT; spins++) {
+		status = inb(ch->io + ATA_STATUS);
+		if(!(status & ATA_SR_BSY))
+			return status;
+	}
+	return FAIL;
+}
+
+/* int32_t ata_identify(ata_channel_t* ch, uint8_t slave)
+ * INPUT: ch - channel
+ *		  slave - 1 for its slave drive
+ * OUTPUT: SUCCESS if it is an ATA disk that can do DMA, which is then added
+ *		   to drives; FAIL for no drive, ATAPI and anything else
+ * DESCRIPTION: IDENTIFY DEVICE is read with PIO, before the irqs are on
+ */
+static int32_t ata_identify(ata_channel_t* ch, uint8_t slave)
+{
+	ata_drive_t* drive = &drives[num_drives];
+	uint16_t id[ATA_ID_WORDS];
+	int32_t status;
+	uint32_t i;
+
+	outb(ATA_DRIVE_LBA | (slave ? ATA_DRIVE_SLAVE : 0), ch->io + ATA_DRIVE);
+	for(i = 0; i < 4; i++)						/* 400ns for the select to settle */
+		inb(ch->ctrl);
+	outb(0, ch->io + ATA_COUNT);
+	outb(0, ch->io + ATA_LBA0);
+	outb(0, ch->io + ATA_LBA1);
+	outb(0, ch->io + ATA_LBA2);
+	outb(ATA_CMD_IDENTIFY, ch->io + ATA_COMMAND);
+
+	status = inb(ch->io + ATA_STATUS);
+	if(status == 0 || status == 0xFF)			/* no drive, or no channel */
+		return FAIL;
+	if((status = ata_not_busy(ch)) == FAIL)
+		return FAIL;
+	if(inb(ch->io + ATA_LBA1) != 0 || inb(ch->io + ATA_LBA2) != 0)
+		return FAIL;							/* an ATAPI signature */
+	for(i = 0; !(status & (ATA_SR_DRQ | ATA_SR_ERR)) && i < ATA_TIMEOUT; i++)
+		status = inb(ch->io + ATA_STATUS);
+	if(!(status & ATA_SR_DRQ) || (status & ATA_SR_ERR))
+		return FAIL;
+
+	for(i = 0; i < ATA_ID_WORDS; i++)
+		id[i] = inw(ch->io + ATA_DATA);
+	if(!(id[ATA_ID_CAPS] & ATA_CAP_DMA))
+		return FAIL;
+
+	drive->channel = ch;
+	drive->slave = slave;
+	drive->lba48 = (id[ATA_ID_CMDSET] & ATA_CMDSET_LBA48) != 0;
+	if(!drive->lba48)
+		drive->sectors = id[ATA_ID_LBA28] | (id[ATA_ID_LBA28 + 1] << 16);
+	else if(id[ATA_ID_LBA48 + 2] != 0 || id[ATA_ID_LBA48 + 3] != 0)
+		drive->sectors = 0xFFFFFFFF;
+	else
+		drive->sectors = id[ATA_ID_LBA48] | (id[ATA_ID_LBA48 + 1] << 16);
+	num_drives++;
+
+	return SUCCESS;
+}
+
+/* int32_t ata_init(void)
+ * INPUT: none
+ * OUTPUT: SUCCESS if a disk was found, FAIL otherwise
+ * DESCRIPTION: finds the IDE controller on the PCI bus, lets it master the
+ *				bus, and tries the four drives in the usual order; the first
+ *				disk found is selected. Only controllers on the legacy ports
+ *				and irqs are driven, which the PIIX always is.
+ */
+int32_t ata_init(void)
+{
+	pci_func_t func;
+	uint32_t bar, c;
+	ata_prd_t* prd;
+
+	if(pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &func) == FAIL ||
+	   (func.prog_if & (IDE_NATIVE_PRIMARY | IDE_NATIVE_SECONDARY)) ||
+	   !(func.prog_if & IDE_BUS_MASTER))
+		return FAIL;
+	bar = pci_read(&func, PCI_BAR0 + IDE_BM_BAR * sizeof(uint32_t));
+	if(!(bar & PCI_BAR_IO) || (bar & PCI_BAR_IO_MASK) == 0)
+		return FAIL;
+	if((prd = (ata_prd_t*)alloc_frame()) == NULL)
+		return FAIL;
+	pci_write(&func, PCI_COMMAND, (pci_read(&func, PCI_COMMAND) & 0xFFFF) | PCI_CMD_IO | PCI_CMD_MASTER);
+
+	channels[0].io = ATA_PRIMARY_IO;
+	channels[0].ctrl = ATA_PRIMARY_CTRL;
+	channels[1].io = ATA_SECONDARY_IO;
+	channels[1].ctrl = ATA_SECONDARY_CTRL;
+	for(c = 0; c < ATA_CHANNELS; c++) {
+		channels[c].bm = (bar & PCI_BAR_IO_MASK) + c * BM_CHANNEL;
+		channels[c].prd = prd + c * ATA_MAX_PAGES;
+		outb(0, channels[c].ctrl);				/* drives raise their irq */
+		ata_identify(&channels[c], 0);
+		ata_identify(&channels[c], 1);
+	}
+
+	enable_irq(ATA_PRIMARY_IRQ);
+	enable_irq(ATA_SECONDARY_IRQ);
+
+	return ata_select(0);
+}
+
+/* uint32_t ata_disks(void)
+ * INPUT: none
+ * OUTPUT: how many disks ata_init found
+ */
+uint32_t ata_disks(void)
+{
+	return num_drives;
+}
+
+/* int32_t ata_select(uint32_t n)
+ * INPUT: n - disk in the order ata_init found them
+ * OUTPUT: SUCCESS, or FAIL if there is no such disk
+ * DESCRIPTION: later transfers go to that disk
+ */
+int32_t ata_select(uint32_t n)
+{
+	if(n >= num_drives)
+		return FAIL;
+
+	disk = &drives[n];
+	return SUCCESS;
+}
+
+/* void ata_complete(ata_channel_t* ch)
+ * INPUT: ch - channel whose drive may have interrupted
+ * OUTPUT: none
+ * DESCRIPTION: reading the status acknowledges the drive. Only an interrupt
+ *				the bus master saw ends a transfer: it stops the engine and
+ *				tells the waiting ata_transfer how it went.
+ */
+static void ata_complete(ata_channel_t* ch)
+{
+	uint8_t bm_status = inb(ch->bm + BM_STATUS);
+
+	ch->status = inb(ch->io + ATA_STATUS);
+	if(!(bm_status & BM_ST_IRQ))
+		return;
+
+	outb(0, ch->bm + BM_COMMAND);
+	outb(BM_ST_IRQ | BM_ST_ERROR, ch->bm + BM_STATUS);
+	ch->bm_status = bm_status;
+	ch->done = 1;
+}
+
+/* void ata_handler(uint32_t irq)
+ * INPUT: irq - ATA_PRIMARY_IRQ or ATA_SECONDARY_IRQ
+ * OUTPUT: none
+ */
+void ata_handler(uint32_t irq)
+{
+	ata_channel_t* ch = &channels[irq == ATA_SECONDARY_IRQ];
+
+	if(ch->bm != 0)
+		ata_complete(ch);
+}
+
+/* int32_t ata_wait(ata_channel_t* ch)
+ * INPUT: ch - channel with a transfer started
+ * OUTPUT: SUCCESS, or FAIL for an error or a drive that never finishes
+ * DESCRIPTION: with interrupts on, the irq ends the wait. Before sti at
+ *				boot the bus master status is polled for it instead.
+ */
+static int32_t ata_wait(ata_channel_t* ch)
+{
+	uint32_t flags, spins;
+
+	cli_and_save(flags);
+	restore_flags(flags);
+
+	for(spins = 0; !ch->done && spins < ATA_TIMEOUT; spins++) {
+		if(!(flags & ATA_EFLAGS_IF) && (inb(ch->bm + BM_STATUS) & BM_ST_IRQ))
+			ata_complete(ch);
+	}
+	if(!ch->done) {
+		outb(0, ch->bm + BM_COMMAND);
+		return FAIL;
+	}
+
+	if((ch->bm_status & BM_ST_ERROR) || (ch->status & (ATA_SR_ERR | ATA_SR_DF)))
+		return FAIL;
+	return SUCCESS;
+}
+
+/* int32_t ata_transfer(uint32_t lba, uint8_t* const* pages, uint32_t count, uint32_t write)
+ * INPUT: lba - first sector
+ *		  pages - count kernel pages, one PRD entry each
+ *		  count - 1 to ATA_MAX_PAGES
+ *		  write - 1 to write the pages, 0 to read into them
+ * OUTPUT: SUCCESS, or FAIL past the end of the disk or for a drive error
+ */
+static int32_t ata_transfer(uint32_t lba, uint8_t* const* pages, uint32_t count, uint32_t write)
+{
+	ata_channel_t* ch;
+	uint32_t sectors = count * ATA_SECTORS_PER_PAGE;
+	uint32_t flags, i;
+	int32_t ret;
+
+	if(disk == NULL || count == 0 || count > ATA_MAX_PAGES ||
+	   lba + sectors < lba || lba + sectors > disk->sectors)
+		return FAIL;
+	ch = disk->channel;
+
+	/* the channel has one PRD table: wait out the transfer of a process
+	 * this one preempted */
+	for(;;) {
+		cli_and_save(flags);
+		if(!busy)
+			break;
+		restore_flags(flags);
+	}
+	busy = 1;
+	restore_flags(flags);
+
+	for(i = 0; i < count; i++) {
+		ch->prd[i].addr = __pa(pages[i]);
+		ch->prd[i].bytes = BYTES_4KB;
+		ch->prd[i].flags = (i == count - 1) ? ATA_PRD_EOT : 0;
+	}
+
+	if(ata_not_busy(ch) == FAIL) {
+		busy = 0;
+		return FAIL;
+	}
+	outb(0, ch->bm + BM_COMMAND);
+	outl(__pa(ch->prd), ch->bm + BM_PRDT);
+	outb(BM_ST_IRQ | BM_ST_ERROR, ch->bm + BM_STATUS);
+	ch->done = 0;
+
+	if(disk->lba48) {
+		/* high bytes first, then low */
+		outb(ATA_DRIVE_LBA | (disk->slave ? ATA_DRIVE_SLAVE : 0), ch->io + ATA_DRIVE);
+		outb(sectors >> 8, ch->io + ATA_COUNT);
+		outb(lba >> 24, ch->io + ATA_LBA0);
+		outb(0, ch->io + ATA_LBA1);
+		outb(0, ch->io + ATA_LBA2);
+		outb(sectors & 0xFF, ch->io + ATA_COUNT);
+		outb(lba & 0xFF, ch->io + ATA_LBA0);
+		outb((lba >> 8) & 0xFF, ch->io + ATA_LBA1);
+		outb((lba >> 16) & 0xFF, ch->io + ATA_LBA2);
+		outb(write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT, ch->io + ATA_COMMAND);
+	} else {
+		outb(ATA_DRIVE_LBA | (disk->slave ? ATA_DRIVE_SLAVE : 0) | ((lba >> 24) & 0xF), ch->io + ATA_DRIVE);
+		outb(sectors & 0xFF, ch->io + ATA_COUNT);
+		outb(lba & 0xFF, ch->io + ATA_LBA0);
+		outb((lba >> 8) & 0xFF, ch->io + ATA_LBA1);
+		outb((lba >> 16) & 0xFF, ch->io + ATA_LBA2);
+		outb(write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA, ch->io + ATA_COMMAND);
+	}
+	outb(BM_CMD_START | (write ? 0 : BM_CMD_READ), ch->bm + BM_COMMAND);
+
+	ret = ata_wait(ch);
+	busy = 0;
+	return ret;
+}
+
+/* int32_t ata_read(uint32_t lba, uint8_t* const* pages, uint32_t count)
+ * INPUT: lba - first sector
+ *		  pages - count kernel pages to fill
+ *		  count - 1 to ATA_MAX_PAGES
+ * OUTPUT: SUCCESS or FAIL
+ */
+int32_t ata_read(uint32_t lba, uint8_t* const* pages, uint32_t count)
+{
+	return ata_transfer(lba, pages, count, 0);
+}
+
+/* int32_t ata_write(uint32_t lba, uint8_t* const* pages, uint32_t count)
+ * INPUT: lba - first sector
+ *		  pages - count kernel pages to write out
+ *		  count - 1 to ATA_MAX_PAGES
+ * OUTPUT: SUCCESS or FAIL
+ */
+int32_t ata_write(uint32_t lba, uint8_t* const* pages, uint32_t count)
+{
+	return ata_transfer(lba, pages, count, 1);
+}
+
+/* uint32_t ata_blocks(void)
+ * INPUT: none
+ * OUTPUT: whole 4 kB blocks on the selected disk, 0 if there is none
+ */
+uint32_t ata_blocks(void)
+{
+	return (disk != NULL) ? disk->sectors / ATA_SECTORS_PER_PAGE : 0;
+}
+
+/* int32_t ata_bench(uint32_t count, uint32_t random)
+ * INPUT: count - 4 kB reads when random, otherwise kB to read
+ *		  random - 1 for reads of single blocks anywhere on the disk, 0 for
+ *				   ATA_MAX_PAGES blocks at a time from the start
+ * OUTPUT: average cycles per kB over the commands, FAIL without a disk or
+ *		   memory or on a read error
+ * DESCRIPTION: each command is timed on its own so the low 32 bits of the
+ *				cycle counter are enough
+ */
+int32_t ata_bench(uint32_t count, uint32_t random)
+{
+	uint8_t* pages[ATA_MAX_PAGES];
+	uint32_t blocks = ata_blocks();
+	uint32_t per_kb = 0, commands = 0, block = 0, n, i;
+	uint32_t start, end;
+	int32_t ret = SUCCESS;
+
+	if(blocks == 0 || count == 0)
+		return FAIL;
+	for(n = 0; n < ATA_MAX_PAGES; n++) {
+		if((pages[n] = (uint8_t*)alloc_frame()) == NULL)
+			break;
+	}
+
+	if(!random)
+		count = (count + BYTES_4KB / 1024 - 1) / (BYTES_4KB / 1024);	/* in blocks */
+	while(count > 0 && n > 0 && ret == SUCCESS) {
+		if(random) {
+			bench_seed = bench_seed * 1103515245 + 12345;
+			block = (bench_seed >> 8) % blocks;
+			i = 1;
+		} else {
+			if(block >= blocks)
+				block = 0;
+			i = (count < n) ? count : n;
+			if(i > blocks - block)
+				i = blocks - block;
+		}
+
+		rdtsc_low(start);
+		ret = ata_read(block * ATA_SECTORS_PER_PAGE, pages, i);
+		rdtsc_low(end);
+
+		per_kb += (end - start) / (i * (BYTES_4KB / 1024));
+		commands++;
+		count -= random ? 1 : i;
+		block += i;
+	}
+
+	while(n > 0)
+		free_frame((uint32_t)pages[--n]);
+	if(ret == FAIL || commands == 0)
+		return FAIL;
+	return per_kb / commands;
+}
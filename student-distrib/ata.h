@@ -0,0 +1,128 @@
+/*	*********************************************************
+	# FILE NAME: ata.h
+	# PURPOSE: header for ata.c, the IDE/ATA disk driver using PCI bus master
+	#		   DMA
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#ifndef _ATA_H
+#define _ATA_H
+
+#include "types.h"
+
+/* the IDE controller's PCI class, and its programming interface bits */
+#define PCI_CLASS_STORAGE		0x01
+#define PCI_SUBCLASS_IDE		0x01
+#define IDE_NATIVE_PRIMARY		0x01		/* primary channel uses PCI ports and irq */
+#define IDE_NATIVE_SECONDARY	0x04		/* secondary channel the same */
+#define IDE_BUS_MASTER			0x80		/* has the bus master DMA registers */
+#define IDE_BM_BAR				4			/* base address register of those */
+
+/* legacy channels */
+#define ATA_CHANNELS			2
+#define ATA_DRIVES				4			/* master and slave on each */
+#define ATA_PRIMARY_IO			0x1F0
+#define ATA_PRIMARY_CTRL		0x3F6
+#define ATA_PRIMARY_IRQ			14
+#define ATA_SECONDARY_IO		0x170
+#define ATA_SECONDARY_CTRL		0x376
+#define ATA_SECONDARY_IRQ		15
+
+/* task file registers, from a channel's io port */
+#define ATA_DATA				0
+#define ATA_ERROR				1
+#define ATA_COUNT				2
+#define ATA_LBA0				3
+#define ATA_LBA1				4
+#define ATA_LBA2				5
+#define ATA_DRIVE				6
+#define ATA_STATUS				7
+#define ATA_COMMAND				7
+
+#define ATA_SR_BSY				0x80
+#define ATA_SR_DF				0x20
+#define ATA_SR_DRQ				0x08
+#define ATA_SR_ERR				0x01
+#define ATA_DRIVE_LBA			0xE0		/* LBA addressing; 0x10 more selects the slave */
+#define ATA_DRIVE_SLAVE			0x10
+
+#define ATA_CMD_IDENTIFY		0xEC
+#define ATA_CMD_READ_DMA		0xC8
+#define ATA_CMD_READ_DMA_EXT	0x25
+#define ATA_CMD_WRITE_DMA		0xCA
+#define ATA_CMD_WRITE_DMA_EXT	0x35
+
+/* IDENTIFY DEVICE data, in 16-bit words */
+#define ATA_ID_WORDS			256
+#define ATA_ID_CAPS				49			/* bit 8: DMA */
+#define ATA_ID_LBA28			60			/* sectors, two words */
+#define ATA_ID_CMDSET			83			/* bit 10: 48-bit LBA */
+#define ATA_ID_LBA48			100			/* sectors, four words */
+#define ATA_CAP_DMA				0x0100
+#define ATA_CMDSET_LBA48		0x0400
+
+/* bus master registers, from the channel's base; the secondary's are 8 on */
+#define BM_COMMAND				0
+#define BM_STATUS				2
+#define BM_PRDT					4
+#define BM_CHANNEL				8
+#define BM_CMD_START			0x01
+#define BM_CMD_READ				0x08		/* device to memory */
+#define BM_ST_ERROR				0x02
+#define BM_ST_IRQ				0x04
+
+#define ATA_SECTOR				512
+#define ATA_SECTORS_PER_PAGE	8
+#define ATA_MAX_PAGES			32			/* per command: 128 kB, under LBA28's 256 sectors */
+#define ATA_PRD_EOT				0x8000		/* last entry of a PRD table */
+#define ATA_TIMEOUT				0x10000000	/* status polls before giving up on a drive */
+#define ATA_EFLAGS_IF			0x200
+
+/* one physical region descriptor: a piece of memory a DMA transfer fills.
+ * It must not cross a 64 kB boundary; a 4 kB page never does. */
+typedef struct ata_prd {
+	uint32_t addr;					/* physical address */
+	uint16_t bytes;					/* length; 0 means 64 kB */
+	uint16_t flags;					/* ATA_PRD_EOT */
+} ata_prd_t;
+
+typedef struct ata_channel {
+	uint16_t io;					/* task file */
+	uint16_t ctrl;					/* device control / alternate status */
+	uint16_t bm;					/* bus master registers; 0 before ata_init */
+	ata_prd_t* prd;					/* PRD table, in a kernel frame */
+	volatile uint8_t done;			/* set when the transfer's irq came */
+	volatile uint8_t bm_status;		/* bus master status it saw */
+	volatile uint8_t status;		/* drive status it saw */
+} ata_channel_t;
+
+typedef struct ata_drive {
+	ata_channel_t* channel;
+	uint8_t slave;
+	uint8_t lba48;
+	uint32_t sectors;				/* capacity, at most 2^32 - 1 */
+} ata_drive_t;
+
+/* finds the controller and the disks on it, selecting the first; FAIL if
+ * there is none */
+int32_t ata_init(void);
+
+/* disks found, and which of them the calls below use */
+uint32_t ata_disks(void);
+int32_t ata_select(uint32_t n);
+
+/* irq 14 and 15, from pic_handler */
+void ata_handler(uint32_t irq);
+
+/* DMA between the disk and count kernel pages (4 kB, direct mapped); lba is
+ * in sectors. One transfer at a time: a caller waits for the one under way. */
+int32_t ata_read(uint32_t lba, uint8_t* const* pages, uint32_t count);
+int32_t ata_write(uint32_t lba, uint8_t* const* pages, uint32_t count);
+
+/* size of the selected disk in 4 kB blocks, 0 without one */
+uint32_t ata_blocks(void);
+
+/* average cycles per kB of count random 4 kB reads, or of reading count kB
+ * from the start of the disk in ATA_MAX_PAGES commands */
+int32_t ata_bench(uint32_t count, uint32_t random);
+
+#endif /* _ATA_H */
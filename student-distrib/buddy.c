@@ -0,0 +1,230 @@
+/*	*********************************************************
+	# FILE NAME: buddy.c
+	# PURPOSE: buddy allocator for physical memory, fed by the multiboot memory map
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#include "buddy.h"
+#include "lib.h"
+#include "page.h"
+
+static page_desc_t pages[BUDDY_PAGES];
+static uint32_t free_head[BUDDY_MAX_ORDER + 1];	/* first free block of each order */
+static uint32_t total_pages;
+static uint32_t free_pages;
+
+static uint32_t reserved_start[BUDDY_MAX_RESERVED];
+static uint32_t reserved_end[BUDDY_MAX_RESERVED];
+static uint32_t num_reserved;
+static uint32_t lists_ready;
+
+/* void list_push(uint32_t idx, uint32_t order)
+ * INPUT: idx - page number of a free block head
+ *		  order - the block's order
+ * OUTPUT: none
+ * DESCRIPTION: puts the block at the front of its free list
+ */
+static void list_push(uint32_t idx, uint32_t order)
+{
+	pages[idx].flags = PAGE_FREE;
+	pages[idx].order = order;
+	pages[idx].prev = BUDDY_NIL;
+	pages[idx].next = free_head[order];
+	if(free_head[order] != BUDDY_NIL)
+		pages[free_head[order]].prev = idx;
+	free_head[order] = idx;
+}
+
+/* void list_remove(uint32_t idx, uint32_t order)
+ * INPUT: idx - page number of a free block head
+ *		  order - the block's order
+ * OUTPUT: none
+ * DESCRIPTION: unlinks the block from its free list
+ */
+static void list_remove(uint32_t idx, uint32_t order)
+{
+	if(pages[idx].prev != BUDDY_NIL)
+		pages[pages[idx].prev].next = pages[idx].next;
+	else
+		free_head[order] = pages[idx].next;
+	if(pages[idx].next != BUDDY_NIL)
+		pages[pages[idx].next].prev = pages[idx].prev;
+	pages[idx].flags = 0;
+}
+
+/* void free_block(uint32_t idx, uint32_t order)
+ * INPUT: idx - first page of a block that is no longer in use
+ *		  order - the block's order
+ * OUTPUT: none
+ * DESCRIPTION: merges the block with its buddy as long as the buddy is free and
+ *				whole, then files the result on the right free list
+ */
+static void free_block(uint32_t idx, uint32_t order)
+{
+	uint32_t buddy;
+
+	while(order < BUDDY_MAX_ORDER) {
+		buddy = idx ^ (1 << order);
+		if(buddy >= BUDDY_PAGES || pages[buddy].flags != PAGE_FREE || pages[buddy].order != order)
+			break;
+
+		list_remove(buddy, order);
+		idx &= ~(1 << order);
+		order++;
+	}
+
+	list_push(idx, order);
+}
+
+/* void buddy_init(void)
+ * INPUT: none
+ * OUTPUT: none
+ * DESCRIPTION: empties every free list; runs once, on the first region added
+ */
+static void buddy_init(void)
+{
+	uint32_t i;
+
+	for(i = 0; i <= BUDDY_MAX_ORDER; i++)
+		free_head[i] = BUDDY_NIL;
+	total_pages = 0;
+	free_pages = 0;
+	lists_ready = 1;
+}
+
+/* void buddy_reserve(uint32_t start, uint32_t end)
+ * INPUT: start, end - physical range (e.g. a boot module) that must stay untouched
+ * OUTPUT: none
+ * DESCRIPTION: call before buddy_add_region; pages overlapping the range are skipped
+ */
+void buddy_reserve(uint32_t start, uint32_t end)
+{
+	if(num_reserved == BUDDY_MAX_RESERVED)
+		return;
+
+	reserved_start[num_reserved] = start & ~(BYTES_PER_PAGE - 1);
+	reserved_end[num_reserved] = end;
+	num_reserved++;
+}
+
+/* void buddy_add_region(uint32_t base, uint32_t length)
+ * INPUT: base, length - a usable (type 1) range from the multiboot memory map
+ * OUTPUT: none
+ * DESCRIPTION: hands every whole page of the range that lies in
+ *				[BUDDY_START, DIRECT_MAP_END) and is not reserved to the allocator
+ */
+void buddy_add_region(uint32_t base, uint32_t length)
+{
+	uint32_t start, end, addr, i, skip;
+
+	if(!lists_ready)
+		buddy_init();
+
+	start = (base + BYTES_PER_PAGE - 1) & ~(BYTES_PER_PAGE - 1);
+	end = (length > DIRECT_MAP_END - base || base >= DIRECT_MAP_END) ? DIRECT_MAP_END : base + length;
+	end &= ~(BYTES_PER_PAGE - 1);
+	if(start < BUDDY_START)
+		start = BUDDY_START;
+
+	for(addr = start; addr < end; addr += BYTES_PER_PAGE) {
+		skip = 0;
+		for(i = 0; i < num_reserved; i++) {
+			if(addr < reserved_end[i] && addr + BYTES_PER_PAGE > reserved_start[i])
+				skip = 1;
+		}
+		if(skip || pages[addr / BYTES_PER_PAGE].flags != 0)
+			continue;		/* reserved, or already handed over */
+
+		total_pages++;
+		free_pages++;
+		free_block(addr / BYTES_PER_PAGE, 0);
+	}
+}
+
+/* uint32_t buddy_alloc(uint32_t order)
+ * INPUT: order - the block holds 2^order pages
+ * OUTPUT: kernel (direct map) address of the block, or 0 if no block that large is free
+ * DESCRIPTION: takes the smallest free block that fits and splits it down,
+ *				putting the unused halves back on their free lists
+ */
+uint32_t buddy_alloc(uint32_t order)
+{
+	uint32_t o, idx;
+
+	if(order > BUDDY_MAX_ORDER || !lists_ready)
+		return 0;
+
+	for(o = order; o <= BUDDY_MAX_ORDER; o++) {
+		if(free_head[o] != BUDDY_NIL)
+			break;
+	}
+	if(o > BUDDY_MAX_ORDER)
+		return 0;
+
+	idx = free_head[o];
+	list_remove(idx, o);
+	while(o > order) {
+		o--;
+		list_push(idx + (1 << o), o);
+	}
+
+	pages[idx].flags = PAGE_ALLOCATED;
+	pages[idx].order = order;
+	pages[idx].refs = 1;
+	free_pages -= 1 << order;
+
+	return (uint32_t)__va(idx * BYTES_PER_PAGE);
+}
+
+/* void buddy_free(uint32_t addr)
+ * INPUT: addr - address returned by buddy_alloc
+ * OUTPUT: none
+ * DESCRIPTION: gives the whole block back; anything that is not an allocated
+ *				block head is ignored
+ */
+void buddy_free(uint32_t addr)
+{
+	page_desc_t* page = buddy_page(addr);
+	uint32_t order;
+
+	if(page == NULL)
+		return;
+
+	order = page->order;
+	page->flags = 0;
+	page->refs = 0;
+	free_pages += 1 << order;
+	free_block(__pa(addr) / BYTES_PER_PAGE, order);
+}
+
+/* page_desc_t* buddy_page(uint32_t addr)
+ * INPUT: addr - kernel (direct map) address
+ * OUTPUT: descriptor of the allocated block starting at addr, NULL otherwise
+ */
+page_desc_t* buddy_page(uint32_t addr)
+{
+	if(addr < KERNEL_VBASE || __pa(addr) >= DIRECT_MAP_END || (addr & (BYTES_PER_PAGE - 1)))
+		return NULL;
+	addr = __pa(addr);
+	if(pages[addr / BYTES_PER_PAGE].flags != PAGE_ALLOCATED)
+		return NULL;
+
+	return &pages[addr / BYTES_PER_PAGE];
+}
+
+/* uint32_t buddy_total_pages(void)
+ * INPUT: none
+ * OUTPUT: number of 4 kB pages the allocator manages
+ */
+uint32_t buddy_total_pages(void)
+{
+	return total_pages;
+}
+
+/* uint32_t buddy_free_pages(void)
+ * INPUT: none
+ * OUTPUT: number of 4 kB pages currently free
+ */
+uint32_t buddy_free_pages(void)
+{
+	return free_pages;
+}
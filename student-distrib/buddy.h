@@ -0,0 +1,47 @@
+/*	*********************************************************
+	# FILE NAME: buddy.h
+	# PURPOSE: header for buddy.c, the physical page allocator
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#ifndef _BUDDY_H
+#define _BUDDY_H
+
+#include "types.h"
+
+#define BYTES_PER_PAGE		4096
+#define BUDDY_START			0x00800000	/* the kernel page, boot stack and everything below stay out */
+#define DIRECT_MAP_END		0x30000000	/* physical memory the kernel can reach through its direct map at KERNEL_VBASE: 768 MB, up to FS_WINDOW */
+#define BUDDY_PAGES			(DIRECT_MAP_END / BYTES_PER_PAGE)	/* one descriptor per 4 kB page below DIRECT_MAP_END */
+#define BUDDY_MAX_ORDER		10			/* largest block is 2^10 pages = 4 MB */
+#define BUDDY_NIL			0xFFFFFFFF	/* end of a free list */
+#define BUDDY_MAX_RESERVED	8			/* ranges that must never be handed out */
+
+/* page descriptor flags */
+#define PAGE_FREE			0x1			/* heads a free block of 2^order pages */
+#define PAGE_ALLOCATED		0x2			/* heads an allocated block of 2^order pages */
+
+/* state of one physical page */
+typedef struct page_desc {
+	uint32_t next;		/* free list links (page numbers; there are more than 2^16) */
+	uint32_t prev;
+	uint16_t refs;		/* mappings holding an allocated 4 kB frame */
+	uint8_t order;		/* size of the block this page heads */
+	uint8_t flags;		/* PAGE_FREE or PAGE_ALLOCATED on block heads, 0 otherwise */
+} page_desc_t;
+
+/* set up from the multiboot memory map (physical addresses) */
+void buddy_reserve(uint32_t start, uint32_t end);
+void buddy_add_region(uint32_t base, uint32_t length);
+
+/* blocks of 2^order pages, 4 kB aligned to their size, named by their direct map address */
+uint32_t buddy_alloc(uint32_t order);
+void buddy_free(uint32_t addr);
+
+/* descriptor of an allocated block head, NULL for memory the allocator does not own */
+page_desc_t* buddy_page(uint32_t addr);
+
+/* counters, in 4 kB pages */
+uint32_t buddy_total_pages(void);
+uint32_t buddy_free_pages(void);
+
+#endif /* _BUDDY_H */
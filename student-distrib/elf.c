@@ -0,0 +1,397 @@
+/*	*********************************************************
+	# FILE NAME: elf.c
+	# PURPOSE: loads 32-bit ELF executables into a process address space
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#include "elf.h"
+#include "lib.h"
+#include "filesys_mod.h"
+#include "syscalls.h"
+#include "page.h"
+#include "buddy.h"
+#include "sched.h"
+
+#define IMAGE_CACHE_SIZE	(MAX_PROCESSES + 2)	/* every running program has a slot, plus spares */
+
+static image_cache_entry_t image_cache[IMAGE_CACHE_SIZE];
+static uint32_t image_clock;		/* bumped on every execute */
+
+/* void image_cache_evict(image_cache_entry_t* entry)
+ * INPUT: entry - slot no process is using
+ * OUTPUT: none
+ * DESCRIPTION: drops the cache's reference on every page it holds and frees the slot
+ */
+static void image_cache_evict(image_cache_entry_t* entry)
+{
+	uint32_t i;
+
+	for(i = 0; i < IMAGE_PAGES; i++) {
+		if(entry->frames[i] != 0)
+			free_frame(entry->frames[i]);	/* fs blocks are outside the pool and ignored */
+		entry->frames[i] = 0;
+	}
+	entry->in_use = 0;
+}
+
+/* int32_t image_cache_get(uint32_t inode)
+ * INPUT: inode - executable about to run
+ * OUTPUT: slot holding the executable's pages, FAIL if every slot is busy
+ * DESCRIPTION: finds the cached image of the inode, or claims an empty slot, or
+ *				evicts the least recently executed image nobody is running
+ */
+int32_t image_cache_get(uint32_t inode)
+{
+	image_cache_entry_t* victim = NULL;
+	uint32_t i;
+
+	image_clock++;
+	for(i = 0; i < IMAGE_CACHE_SIZE; i++) {
+		if(image_cache[i].in_use && image_cache[i].inode == inode) {
+			image_cache[i].users++;
+			image_cache[i].last_use = image_clock;
+			return i;
+		}
+	}
+
+	for(i = 0; i < IMAGE_CACHE_SIZE; i++) {
+		if(!image_cache[i].in_use) {
+			victim = &image_cache[i];
+			break;
+		}
+		if(image_cache[i].users == 0 && (victim == NULL || image_cache[i].last_use < victim->last_use))
+			victim = &image_cache[i];
+	}
+	if(victim == NULL)
+		return FAIL;
+
+	if(victim->in_use)
+		image_cache_evict(victim);
+	victim->inode = inode;
+	victim->in_use = 1;
+	victim->users = 1;
+	victim->last_use = image_clock;
+	return victim - image_cache;
+}
+
+/* void image_cache_put(uint32_t slot)
+ * INPUT: slot - image cache slot of an exiting process
+ * OUTPUT: none
+ * DESCRIPTION: the pages stay cached for the next execute of the same program
+ */
+void image_cache_put(uint32_t slot)
+{
+	if(slot < IMAGE_CACHE_SIZE && image_cache[slot].users > 0)
+		image_cache[slot].users--;
+}
+
+/* int32_t image_cache_busy(uint32_t inode)
+ * INPUT: inode - a file about to be written or removed
+ * OUTPUT: 1 if a running process is executing it, 0 otherwise
+ */
+int32_t image_cache_busy(uint32_t inode)
+{
+	uint32_t i;
+
+	for(i = 0; i < IMAGE_CACHE_SIZE; i++) {
+		if(image_cache[i].in_use && image_cache[i].inode == inode && image_cache[i].users > 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* void image_cache_drop(uint32_t inode)
+ * INPUT: inode - a file that is changing and that nobody is executing
+ * OUTPUT: none
+ * DESCRIPTION: evicts its cached pages so the next execute loads the new contents
+ */
+void image_cache_drop(uint32_t inode)
+{
+	uint32_t i;
+
+	for(i = 0; i < IMAGE_CACHE_SIZE; i++) {
+		if(image_cache[i].in_use && image_cache[i].inode == inode && image_cache[i].users == 0)
+			image_cache_evict(&image_cache[i]);
+	}
+}
+
+/* uint32_t image_alloc_frame(void)
+ * INPUT: none
+ * OUTPUT: a frame from the pool, or 0 if memory is exhausted
+ * DESCRIPTION: when the pool is empty, images of programs that are not running are
+ *				dropped before giving up
+ */
+static uint32_t image_alloc_frame(void)
+{
+	uint32_t frame, i;
+
+	frame = alloc_frame();
+	if(frame != 0)
+		return frame;
+
+	for(i = 0; i < IMAGE_CACHE_SIZE; i++) {
+		if(image_cache[i].in_use && image_cache[i].users == 0)
+			image_cache_evict(&image_cache[i]);
+	}
+	return alloc_frame();
+}
+
+/* int32_t elf_check_header(elf32_ehdr_t* ehdr)
+ * INPUT: ehdr - file header read from the start of the executable
+ * OUTPUT: SUCCESS if this kernel can run the file, FAIL otherwise
+ * DESCRIPTION: accepts only little endian, 32-bit, statically linked i386 executables
+ */
+static int32_t elf_check_header(elf32_ehdr_t* ehdr)
+{
+	if(ehdr->e_ident[0] != ELF_MAGIC0 || ehdr->e_ident[1] != ELF_MAGIC1 ||
+	   ehdr->e_ident[2] != ELF_MAGIC2 || ehdr->e_ident[3] != ELF_MAGIC3)
+		return FAIL;
+
+	if(ehdr->e_ident[EI_CLASS] != ELFCLASS32 || ehdr->e_ident[EI_DATA] != ELFDATA2LSB)
+		return FAIL;
+
+	if(ehdr->e_type != ET_EXEC || ehdr->e_machine != EM_386)
+		return FAIL;
+
+	if(ehdr->e_phentsize != sizeof(elf32_phdr_t) || ehdr->e_phnum == 0 || ehdr->e_phnum > ELF_MAX_PHDRS)
+		return FAIL;
+
+	return SUCCESS;
+}
+
+/* int32_t elf_load(uint32_t inode, process_control_block_t* pcb)
+ * INPUT: inode - inode of the executable
+ *		  pcb - pcb of the new process; gets the segments and the entry point (EIP)
+ * OUTPUT: SUCCESS, or FAIL for a malformed file
+ * DESCRIPTION: validates the program header table, remembers every PT_LOAD
+ *				segment and takes a hold on the executable's image cache slot. Nothing
+ *				is copied here; elf_page_fault brings each page in the first time it
+ *				is touched.
+ */
+int32_t elf_load(uint32_t inode, process_control_block_t* pcb)
+{
+	elf32_ehdr_t ehdr;
+	elf32_phdr_t phdrs[ELF_MAX_PHDRS];
+	elf32_phdr_t* ph;
+	user_segment_t* seg;
+	uint32_t i, phdr_bytes, file_length;
+	int32_t ret;
+
+	if(inode_length(inode, &file_length) == -1)
+		return FAIL;
+
+	if(read_data(inode, 0, (uint8_t*)&ehdr, sizeof(ehdr)) != sizeof(ehdr))
+		return FAIL;
+	if(elf_check_header(&ehdr) == FAIL)
+		return FAIL;
+
+	phdr_bytes = ehdr.e_phnum * sizeof(elf32_phdr_t);
+	if(ehdr.e_phoff >= file_length || phdr_bytes > file_length - ehdr.e_phoff)
+		return FAIL;
+	if(read_data(inode, ehdr.e_phoff, (uint8_t*)phdrs, phdr_bytes) != phdr_bytes)
+		return FAIL;
+
+	pcb->exe_inode = inode;
+	pcb->num_segments = 0;
+
+	for(i = 0; i < ehdr.e_phnum; i++) {
+		ph = &phdrs[i];
+		if(ph->p_type != PT_LOAD || ph->p_memsz == 0)
+			continue;
+
+		/* the segment must come from inside the file and fit below the user stack */
+		if(ph->p_filesz > ph->p_memsz)
+			return FAIL;
+		if(ph->p_offset > file_length || ph->p_filesz > file_length - ph->p_offset)
+			return FAIL;
+		if(ph->p_vaddr < TOP_PAGE || ph->p_vaddr > BOTTOM_PAGE - USER_STACK_MAX ||
+		   ph->p_memsz > (BOTTOM_PAGE - USER_STACK_MAX) - ph->p_vaddr)
+			return FAIL;
+		if(pcb->num_segments == MAX_SEGMENTS)
+			return FAIL;
+
+		seg = &pcb->segments[pcb->num_segments++];
+		seg->vaddr = ph->p_vaddr;
+		seg->memsz = ph->p_memsz;
+		seg->file_offset = ph->p_offset;
+		seg->filesz = ph->p_filesz;
+		seg->writable = ph->p_flags & PF_W;
+	}
+
+	/* the first instruction must be in a segment that gets loaded */
+	for(i = 0; i < pcb->num_segments; i++) {
+		seg = &pcb->segments[i];
+		if(ehdr.e_entry >= seg->vaddr && ehdr.e_entry - seg->vaddr < seg->memsz)
+			break;
+	}
+	if(i == pcb->num_segments)
+		return FAIL;
+
+	ret = image_cache_get(inode);
+	if(ret == FAIL)
+		return FAIL;
+
+	pcb->image = ret;
+	pcb->eip = ehdr.e_entry;
+	return SUCCESS;
+}
+
+/* uint32_t elf_page_segments(process_control_block_t* pcb, uint32_t page, uint32_t* writable, user_segment_t** only)
+ * INPUT: pcb - process running the executable
+ *		  page - page aligned virtual address
+ *		  writable - set nonzero if any overlapping segment is writable
+ *		  only - set to the last overlapping segment
+ * OUTPUT: number of segments overlapping the page
+ */
+static uint32_t elf_page_segments(process_control_block_t* pcb, uint32_t page, uint32_t* writable, user_segment_t** only)
+{
+	user_segment_t* seg;
+	uint32_t i, overlaps = 0;
+
+	*writable = 0;
+	*only = NULL;
+	for(i = 0; i < pcb->num_segments; i++) {
+		seg = &pcb->segments[i];
+		if(seg->vaddr < page + BYTES_4KB && seg->vaddr + seg->memsz > page) {
+			overlaps++;
+			*only = seg;
+			*writable |= seg->writable;
+		}
+	}
+
+	return overlaps;
+}
+
+/* uint32_t elf_direct_block(process_control_block_t* pcb, user_segment_t* seg, uint32_t page)
+ * INPUT: pcb - running process
+ *		  seg - the only segment overlapping the page
+ *		  page - page aligned virtual address
+ * OUTPUT: address of the fs image data block holding the page, or 0 if it must be copied
+ * DESCRIPTION: a read-only page that is entirely file data and starts on a 4 kB
+ *				boundary of the file is exactly one data block of the image, so that
+ *				block can be mapped instead of copied
+ */
+static uint32_t elf_direct_block(process_control_block_t* pcb, user_segment_t* seg, uint32_t page)
+{
+	uint32_t offset, block;
+
+	if(seg->writable || page < seg->vaddr || page + BYTES_4KB > seg->vaddr + seg->filesz)
+		return 0;
+
+	offset = seg->file_offset + (page - seg->vaddr);
+	if(offset & (BYTES_4KB - 1))
+		return 0;
+
+	block = (uint32_t)fs_block_shared(inode_block(pcb->exe_inode, offset / KB4));
+	if(block == 0)
+		return 0;
+	if(block < FS_WINDOW) {
+		get_frame(block);	/* a written block is a pool frame; the cache takes its own reference */
+		return block;
+	}
+
+	block = fs_image_pa(block);
+	if(block & (BYTES_4KB - 1))
+		return 0;		/* image was not loaded page aligned */
+	if(block >= DIRECT_MAP_END)
+		return 0;		/* frames are named by their direct map address */
+
+	return (uint32_t)__va(block);
+}
+
+/* int32_t elf_page_fault(uint32_t addr)
+ * INPUT: addr - faulting address (cr2) of a not-present fault
+ * OUTPUT: SUCCESS if the page was mapped and the access can be retried, FAIL if
+ *		   addr is not part of the running program's image or its bytes could
+ *		   not be read
+ * DESCRIPTION: demand loader for executables. The pristine page is looked up in the
+ *				image cache first, so every process running the program shares it.
+ *				On a miss it either is a data block of the fs image mapped directly
+ *				or a zeroed frame filled with the file bytes of every segment
+ *				overlapping it. Pages of writable segments are mapped copy-on-write.
+ */
+int32_t elf_page_fault(uint32_t addr)
+{
+	process_control_block_t* pcb = get_pcb(process_count);
+	image_cache_entry_t* entry;
+	user_segment_t* seg;
+	user_segment_t* only;
+	uint32_t page = addr & PAGE_MASK_4KB;
+	uint32_t i, lo, hi, frame, writable, overlaps;
+
+	if(process_count == 0)
+		return FAIL;
+
+	overlaps = elf_page_segments(pcb, page, &writable, &only);
+	if(overlaps == 0)
+		return FAIL;
+
+	entry = &image_cache[pcb->image];
+	frame = entry->frames[(page - TOP_PAGE) / BYTES_4KB];
+
+	if(frame == 0 && overlaps == 1)
+		frame = elf_direct_block(pcb, only, page);
+
+	if(frame == 0) {
+		frame = image_alloc_frame();
+		if(frame == 0)
+			return FAIL;
+		memset((void*)frame, 0, BYTES_4KB);
+
+		/* copy the file bytes of each segment that land in this page */
+		for(i = 0; i < pcb->num_segments; i++) {
+			seg = &pcb->segments[i];
+			lo = (seg->vaddr > page) ? seg->vaddr : page;
+			hi = (seg->vaddr + seg->filesz < page + BYTES_4KB) ? seg->vaddr + seg->filesz : page + BYTES_4KB;
+			if(lo < hi && read_data(pcb->exe_inode, seg->file_offset + (lo - seg->vaddr),
+									(uint8_t*)(frame + (lo - page)), hi - lo) != (int32_t)(hi - lo)) {
+				free_frame(frame);		/* a block that would not decompress or read: never cache zeroes */
+				return FAIL;
+			}
+		}
+	}
+
+	/* the cache keeps the page (and its first reference); the mapping takes another */
+	entry->frames[(page - TOP_PAGE) / BYTES_4KB] = frame;
+	get_frame(frame);
+	if(user_map_frame(process_count, page, frame, writable ? PTE_COW : 0) == FAIL) {
+		free_frame(frame);
+		return FAIL;
+	}
+	return SUCCESS;
+}
+
+/* void image_cache_map(process_control_block_t* pcb, uint32_t pid)
+ * INPUT: pcb - pcb of a new process whose image slot is already held
+ *		  pid - the process's address space, which has no program pages yet
+ * OUTPUT: none
+ * DESCRIPTION: maps every page the image cache already holds for the program, the
+ *				same way elf_page_fault would, so a repeated execute takes no faults
+ *				for pages earlier runs brought in
+ */
+void image_cache_map(process_control_block_t* pcb, uint32_t pid)
+{
+	image_cache_entry_t* entry = &image_cache[pcb->image];
+	user_segment_t* only;
+	uint32_t i, page, low, high, frame, writable;
+
+	low = BOTTOM_PAGE;
+	high = TOP_PAGE;
+	for(i = 0; i < pcb->num_segments; i++) {
+		if(pcb->segments[i].vaddr < low)
+			low = pcb->segments[i].vaddr;
+		if(pcb->segments[i].vaddr + pcb->segments[i].memsz > high)
+			high = pcb->segments[i].vaddr + pcb->segments[i].memsz;
+	}
+
+	for(page = low & PAGE_MASK_4KB; page < high; page += BYTES_4KB) {
+		frame = entry->frames[(page - TOP_PAGE) / BYTES_4KB];
+		if(frame == 0 || elf_page_segments(pcb, page, &writable, &only) == 0)
+			continue;
+
+		get_frame(frame);
+		if(user_map_frame(pid, page, frame, writable ? PTE_COW : 0) == FAIL) {
+			free_frame(frame);
+			return;		/* out of memory; the rest faults in later */
+		}
+	}
+}
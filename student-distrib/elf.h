@@ -0,0 +1,87 @@
+/*	*********************************************************
+	# FILE NAME: elf.h
+	# PURPOSE: header for elf.c, 32-bit ELF structures
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#ifndef _ELF_H
+#define _ELF_H
+
+#include "types.h"
+#include "syscalls.h"
+
+#define EI_NIDENT		16
+#define ELF_MAGIC0		0x7F
+#define ELF_MAGIC1		'E'
+#define ELF_MAGIC2		'L'
+#define ELF_MAGIC3		'F'
+#define EI_CLASS		4			/* index of the class byte in e_ident */
+#define EI_DATA			5			/* index of the byte order byte in e_ident */
+#define ELFCLASS32		1
+#define ELFDATA2LSB		1
+#define ET_EXEC			2			/* statically linked executable */
+#define EM_386			3
+#define PT_LOAD			1			/* loadable segment */
+#define PF_X			0x1			/* segment permission bits */
+#define PF_W			0x2
+#define PF_R			0x4
+#define ELF_MAX_PHDRS	16			/* refuse anything with more program headers */
+
+/* ELF file header */
+typedef struct elf32_ehdr {
+	uint8_t e_ident[EI_NIDENT];		/* magic, class, byte order, ... */
+	uint16_t e_type;				/* object file type */
+	uint16_t e_machine;				/* architecture */
+	uint32_t e_version;
+	uint32_t e_entry;				/* virtual address of the first instruction */
+	uint32_t e_phoff;				/* file offset of the program header table */
+	uint32_t e_shoff;
+	uint32_t e_flags;
+	uint16_t e_ehsize;
+	uint16_t e_phentsize;			/* size of one program header */
+	uint16_t e_phnum;				/* number of program headers */
+	uint16_t e_shentsize;
+	uint16_t e_shnum;
+	uint16_t e_shstrndx;
+} __attribute__((packed)) elf32_ehdr_t;
+
+/* ELF program header: describes one segment */
+typedef struct elf32_phdr {
+	uint32_t p_type;				/* PT_LOAD, ... */
+	uint32_t p_offset;				/* file offset of the segment */
+	uint32_t p_vaddr;				/* virtual address of the segment */
+	uint32_t p_paddr;
+	uint32_t p_filesz;				/* bytes present in the file */
+	uint32_t p_memsz;				/* bytes in memory; the rest is zero (.bss) */
+	uint32_t p_flags;				/* PF_R | PF_W | PF_X */
+	uint32_t p_align;
+} __attribute__((packed)) elf32_phdr_t;
+
+#define IMAGE_PAGES		((BOTTOM_PAGE - TOP_PAGE) / BYTES_4KB)	/* pages in the program window */
+
+/* pages of one executable, shared by every process running it */
+typedef struct image_cache_entry {
+	uint32_t inode;					/* executable this entry holds */
+	uint32_t in_use;				/* slot holds an image */
+	uint32_t users;					/* processes currently running it */
+	uint32_t last_use;				/* image_clock value of the last execute, for eviction */
+	uint32_t frames[IMAGE_PAGES];	/* pristine page (pool frame or fs block) per window page, 0 if not loaded */
+} image_cache_entry_t;
+
+/* takes and drops a process's hold on its executable's cached pages */
+int32_t image_cache_get(uint32_t inode);
+void image_cache_put(uint32_t slot);
+
+/* keeps cached pages in step with files that are written */
+int32_t image_cache_busy(uint32_t inode);
+void image_cache_drop(uint32_t inode);
+
+/* maps the already cached pages of a program into a new process */
+void image_cache_map(process_control_block_t* pcb, uint32_t pid);
+
+/* records the PT_LOAD segments and entry point of an executable in a pcb */
+int32_t elf_load(uint32_t inode, process_control_block_t* pcb);
+
+/* brings in the page of the running program that contains addr */
+int32_t elf_page_fault(uint32_t addr);
+
+#endif /* _ELF_H */
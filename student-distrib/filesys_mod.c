@@ -8,36 +8,275 @@
 
 #include "filesys_mod.h"
 #include "syscalls.h"
+#include "page.h"
+#include "elf.h"
+#include "snapshot.h"
+#include "fscache.h"
+#include "ata.h"
 
 
 /* AW declare global boot block struct */
 boot_block_t fs_info;
 
-/* filesys_init(multiboot_info_t* mbi)
- * INPUTS:			mbi - pointer to the multiboot information struct
+/* hash index over the directory: open addressing with linear probing, each
+ * slot holding 1 + the index of a directory entry, 0 for an empty slot */
+static uint8_t dentry_index[DENTRY_HASH_SIZE];
+
+/* writable overlay. The boot block is copied so the directory can change;
+ * an inode that was written lives in a kernel frame that shadows the image's,
+ * and data block numbers from num_data_blocks on name kernel frames. Blocks
+ * nobody wrote are still read straight from the module. */
+static uint32_t* dir_block;							/* copy of the boot block */
+static inode_t* overlay_inodes[FS_MAX_INODES];		/* kernel copy of an inode, NULL if unchanged */
+static uint32_t overlay_blocks[FS_OVERLAY_BLOCKS];	/* kernel frame of each written block, 0 if free */
+static uint32_t overlay_hint;						/* where the search for a free block starts */
+static uint8_t inode_opens[FS_MAX_INODES];			/* open file descriptors per inode */
+static uint8_t inode_state[FS_MAX_INODES];			/* INODE_ flags below */
+
+#define INODE_ORPHAN	0x1		/* unlinked while open: freed on the last close */
+#define INODE_FREED		0x2		/* v2: released, whatever the image's table says */
+#define INODE_CREATED	0x4		/* v2: handed out since boot, whatever the image's table says */
+
+/* where the image keeps things, in blocks of the image as built. A compressed
+ * image, and one on disk, is read block by block through fscache; its blocks
+ * have no fixed address, so nothing may hold on to one past the next image
+ * read. */
+static uint32_t image_cached;		/* 1 if image blocks come from fscache */
+static uint32_t image_inode_start;	/* first block of the inode table */
+static uint32_t image_data_start;	/* block holding data block 0 */
+
+static void overlay_reset();
+static void filesys_load();
+static uint8_t* image_block(uint32_t block);
+static inode_t* inode_address(uint32_t inode);
+static uint8_t* inode_run(uint32_t inode, uint32_t index, uint32_t max, uint32_t* run);
+static int32_t dir_entry_get(uint32_t dir, uint32_t index, uint8_t* entry);
+static void dir_changed(uint32_t dir);
+static int32_t read_dentry_path(const uint8_t* path, dentry_t* dentry);
+
+/* dentry_name_len(const uint8_t* name, uint32_t max)
+ * INPUTS:			name - file name, NUL terminated unless it fills max bytes
+ *					max - bytes the name may take up
+ * RETURN VALUE:	length of the name, at most max
+ * PURPOSE:			names in the image use all FNAME_LENGTH bytes without a NUL
+ */
+static uint32_t dentry_name_len(const uint8_t* name, uint32_t max)
+{
+	uint32_t len = 0;
+
+	while(len < max && name[len] != '\0')
+		len++;
+
+	return len;
+}
+
+/* dentry_fill(const uint8_t* entry, dentry_t* dentry)
+ * INPUTS:			entry - 64-byte directory entry in the image or a directory file
+ *					dentry - struct to fill
+ * RETURN VALUE:	none
+ * PURPOSE:			a name that takes all FNAME_LENGTH bytes gets its NUL here
+ */
+static void dentry_fill(const uint8_t* entry, dentry_t* dentry)
+{
+	uint32_t len = dentry_name_len(entry, FNAME_LENGTH);
+
+	memcpy(dentry->name, entry, len);
+	dentry->name[len] = '\0';
+	dentry->type = entry[FNAME_LENGTH];
+	dentry->inode = *(uint32_t*)(entry + FNAME_LENGTH + FS_FIELD_SIZE);
+}
+
+/* dentry_hash(const uint8_t* name, uint32_t len)
+ * INPUTS:			name, len - file name and its length
+ * RETURN VALUE:	home slot of the name in dentry_index (FNV-1a)
+ */
+static uint32_t dentry_hash(const uint8_t* name, uint32_t len)
+{
+	uint32_t hash = 2166136261U;
+	uint32_t i;
+
+	for(i = 0; i < len; i++)
+		hash = (hash ^ name[i]) * 16777619U;
+
+	return hash & (DENTRY_HASH_SIZE - 1);
+}
+
+/* dentry_index_build()
+ * INPUTS:			none
+ * RETURN VALUE:	none
+ * PURPOSE:			indexes every directory entry by name. A name that appears
+ *					twice keeps its first entry, as the old linear scan did.
+ */
+static void dentry_index_build()
+{
+	uint32_t d_idx, slot, len;
+
+	memset(dentry_index, 0, sizeof(dentry_index));
+
+	for(d_idx = 0; d_idx < fs_info.num_dir_entries && d_idx < MAX_DENTRIES; d_idx++){
+		len = dentry_name_len(fs_info.dir_entries[d_idx], FNAME_LENGTH);
+		slot = dentry_hash(fs_info.dir_entries[d_idx], len);
+		while(dentry_index[slot] != 0) {
+			if(dentry_name_len(fs_info.dir_entries[dentry_index[slot] - 1], FNAME_LENGTH) == len &&
+			   strncmp((int8_t*)fs_info.dir_entries[dentry_index[slot] - 1], (int8_t*)fs_info.dir_entries[d_idx], len) == 0)
+				break;
+			slot = (slot + 1) & (DENTRY_HASH_SIZE - 1);
+		}
+		if(dentry_index[slot] == 0)
+			dentry_index[slot] = d_idx + 1;
+	}
+}
+
+/* filesys_init_v2(fs_super_t* super)
+ * INPUTS:			super - superblock at the start of a v2 image
+ * RETURN VALUE:	none
+ * PURPOSE: 		v2 block numbers count from the superblock, so the whole image
+ *					serves as the data block area. A superblock that does not add
+ *					up leaves an empty file system.
+ */
+static void filesys_init_v2(fs_super_t* super)
+{
+	fs_info.version = FS_V2_VERSION;
+	fs_info.root_inode = super->root_inode;
+	fs_info.num_inodes = super->num_inodes;
+	fs_info.num_data_blocks = super->num_blocks;
+	fs_info.num_dir_entries = 0;
+	image_inode_start = super->inode_start;
+	image_data_start = 0;
+	if(!image_cached) {
+		fs_info.inode_blocks = (uint32_t*)image_block(image_inode_start);
+		fs_info.data_blocks = image_block(0);
+	}
+
+	if(super->version != FS_V2_VERSION || super->block_size != KB4 ||
+	   super->inode_start == 0 || super->inode_start >= super->num_blocks ||
+	   super->num_inodes > (super->num_blocks - super->inode_start) * (KB4 / FS_V2_INODE_SIZE)) {
+		fs_info.num_inodes = 0;
+		return;
+	}
+
+	dir_changed(fs_info.root_inode);
+}
+
+/* filesys_init(uint32_t* file_sys_start)
+ * INPUTS:			file_sys_start - the module as mapped at FS_WINDOW
  * RETURN VALUE:	none
  * PURPOSE: 		Initialize a global struct with meta information about the file
  *					system such as the starting address, number of directory entries,
- *					number of inodes, etc.
+ *					number of inodes, etc. Anything written since the last call is
+ *					dropped. A compressed image is read through fscache, so both
+ *					formats may come compressed.
  */
 void filesys_init(uint32_t* file_sys_start)
+{
+	fs_info.filesys_ptr =  file_sys_start;
+	image_cached = (fscache_init(file_sys_start) == SUCCESS);
+	filesys_load();
+}
+
+/* image_on_disk(const uint32_t* boot, uint32_t blocks)
+ * INPUTS:			boot - block 0 of the disk
+ *					blocks - size of the disk in 4 kB blocks
+ * RETURN VALUE:	1 if it holds an image that fits on it, 0 otherwise
+ * PURPOSE:			a v1 image has no magic number, so an unformatted disk must
+ *					not pass for an empty one
+ */
+static uint32_t image_on_disk(const uint32_t* boot, uint32_t blocks)
+{
+	if(((fs_super_t*)boot)->magic == FS_V2_MAGIC)
+		return ((fs_super_t*)boot)->num_blocks <= blocks;
+
+	return boot[0] > 0 && boot[0] <= MAX_DENTRIES && boot[1] < blocks &&
+		   boot[2] < blocks && 1 + boot[1] + boot[2] <= blocks;
+}
+
+/* filesys_init_disk()
+ * INPUTS:			none
+ * RETURN VALUE:	0 if an ATA disk holds an image, which is now the file
+ *					system, -1 otherwise, leaving the file system as it was
+ * PURPOSE:			mounts an image mkfs wrote to a disk, uncompressed; the
+ *					disks are tried in order, as the first is usually the one
+ *					GRUB booted from. The image's blocks are read with DMA into
+ *					fscache as they are used.
+ */
+int32_t filesys_init_disk()
+{
+	uint32_t n, blocks, found = 0;
+	uint8_t* boot;
+
+	if((boot = (uint8_t*)alloc_frame()) == NULL)
+		return -1;
+	for(n = 0; !found && ata_select(n) == 0; n++) {
+		blocks = ata_blocks();
+		found = (ata_read(0, &boot, 1) == 0 && image_on_disk((uint32_t*)boot, blocks));
+	}
+	free_frame((uint32_t)boot);
+	if(!found || fscache_init_disk(blocks) != 0) {
+		ata_select(0);
+		return -1;
+	}
+
+	fs_info.filesys_ptr = NULL;
+	image_cached = 1;
+	filesys_load();
+	return 0;
+}
+
+/* filesys_load()
+ * INPUTS:			none
+ * RETURN VALUE:	none
+ * PURPOSE:			reads the boot block or superblock of the image just set up.
+ *					A v2 image is told apart by the magic number in its
+ *					superblock; anything else is read as the flat v1 format.
+ */
+static void filesys_load()
 {
 //	int i;
 	uint32_t d_idx;				/* index to a directory entry in the boot block */
+	uint32_t* boot;				/* boot block or v2 superblock, block 0 of the image */
 	uint8_t* filename_ptr;		/* ptr to file names in dir dentries */
 
-	//module_t* mod = (module_t*)mbi->mods_addr;				/* for starters, assume 1 module only */
-	fs_info.filesys_ptr =  file_sys_start;		/* according to boot screen this is 0x0040D000 */
+	fs_info.inode_blocks = NULL;
+	fs_info.data_blocks = NULL;
+
+	overlay_reset();
+	boot = (uint32_t*)image_block(0);
+	if(boot != NULL && ((fs_super_t*)boot)->magic == FS_V2_MAGIC) {
+		filesys_init_v2((fs_super_t*)boot);
+		return;
+	}
+	fs_info.version = 1;
+	fs_info.root_inode = 0;
+
+	/* the directory is read from a writable copy of the boot block */
+	if(dir_block == NULL)
+		dir_block = (uint32_t*)alloc_frame();
+	if(dir_block != NULL && boot != NULL) {
+		memcpy(dir_block, boot, KB4);
+		boot = dir_block;
+	} else if(image_cached) {
+		boot = NULL;				/* a cache frame would not stay put */
+	}
+	if(boot == NULL) {
+		fs_info.num_dir_entries = 0;
+		fs_info.num_inodes = 0;
+		fs_info.num_data_blocks = 0;
+		dentry_index_build();
+		return;
+	}
 
-	fs_info.num_dir_entries = *fs_info.filesys_ptr;		/* parse number of directory entries in filesys_img */
-	fs_info.filesys_ptr++;
-	fs_info.num_inodes = *fs_info.filesys_ptr;			/* parse number of inodes in filesys_img */
-	fs_info.filesys_ptr++;
-	fs_info.num_data_blocks = *fs_info.filesys_ptr;		/* parse number of data blocks in filesys_img */
-	fs_info.filesys_ptr++;
+	fs_info.num_dir_entries = *boot;		/* parse number of directory entries in filesys_img */
+	boot++;
+	fs_info.num_inodes = *boot;				/* parse number of inodes in filesys_img */
+	boot++;
+	fs_info.num_data_blocks = *boot;		/* parse number of data blocks in filesys_img */
+	boot++;
 	
-	fs_info.filesys_ptr += 13;						/* skip over 52 reserved bytes (13*4 bytes = 52 bytes) */
-	filename_ptr = (uint8_t*)fs_info.filesys_ptr;	/* now we're pointing to file names */
+	boot += 13;								/* skip over 52 reserved bytes (13*4 bytes = 52 bytes) */
+	filename_ptr = (uint8_t*)boot;			/* now we're pointing to file names */
+
+	if(fs_info.num_dir_entries > MAX_DENTRIES)
+		fs_info.num_dir_entries = MAX_DENTRIES;
 
 	/* parse pointers to directory entries */
 	for(d_idx = 0; d_idx < MAX_DENTRIES; d_idx++){
@@ -45,9 +284,14 @@ void filesys_init(uint32_t* file_sys_start)
 		filename_ptr += DENTRY_SIZE;						/* move pointer to next directory entry */
 	}
 	
-	fs_info.filesys_ptr =  file_sys_start;					/* reset file system pointer to start of file system */
-	fs_info.inode_blocks = (uint32_t*)(filename_ptr);		/* ptr to first inode block */
-	fs_info.data_blocks = ( (uint8_t*)(fs_info.inode_blocks) + fs_info.num_inodes*KB4 );	/* ptr to first data block */
+	image_inode_start = 1;
+	image_data_start = 1 + fs_info.num_inodes;
+	if(!image_cached) {
+		fs_info.inode_blocks = (uint32_t*)image_block(image_inode_start);	/* ptr to first inode block */
+		fs_info.data_blocks = image_block(image_data_start);				/* ptr to first data block */
+	}
+
+	dentry_index_build();
 
 }
 
@@ -80,29 +324,54 @@ int32_t open_directory()
  * 					nbytes - number of bytes to read
  * RETURN VALUE: 	The number of bytes read into the buffer
  * PURPOSE: 		Read consecutive bytes from the desginated file into the
- *					provided buffer and return the number of bytes read.
+ *					provided buffer and return the number of bytes read. The inode
+ *					number and block cursor kept in the fd entry make this O(1) to
+ *					start.
  */
 int32_t read_file(int32_t fd, void* buf, int32_t nbytes)
 {
-	dentry_t dentry_one;
 	int32_t ret_val;
 
-	process_control_block_t* current_pblock = (process_control_block_t*)(ADDR_8MB - process_count*ADDR_8KB);
-	uint8_t* fname = current_pblock->fde[fd].file_name;		/* AW get filename from fd struct */
-	uint32_t offset = current_pblock->fde[fd].file_pos;		/* AW get file position from fd struct */
+	fd_entry_t* file = &get_pcb(process_count)->fde[fd];	/* open() resolved the inode */
 
-	read_dentry_by_name (fname, &dentry_one);		/* fill dentry struct */
+	if(nbytes < 0)
+		return -1;
 
-	ret_val = read_data (dentry_one.inode, offset, (uint8_t*)buf, nbytes);	/* read data from file */
-	current_pblock->fde[fd].file_pos += ret_val;
+	ret_val = read_cursor(file->inode, file->file_pos, &file->cursor, (uint8_t*)buf, nbytes);
+	if(ret_val > 0)
+		file->file_pos += ret_val;
 
 	return ret_val;
 }
 
 
-/* read_directory(void* buf, int32_t nbytes)
- * INPUTS:			buf - pointer to buffer to be filled with file name
- * 					nbytes - unused
+/* dir_next(fd_entry_t* dir, dentry_t* dentry)
+ * INPUTS:			dir - descriptor of an open directory
+ *					dentry - filled with the entry at the file position
+ * RETURN VALUE:	0 and the position moves past the entry, -1 after the last
+ * PURPOSE:			the file position of a directory descriptor counts entries;
+ *					in a v2 image its inode names the directory
+ */
+static int32_t dir_next(fd_entry_t* dir, dentry_t* dentry)
+{
+	uint8_t entry[DENTRY_SIZE];
+
+	if(fs_info.version == FS_V2_VERSION) {
+		if(dir_entry_get(dir->inode, dir->file_pos, entry) == -1)
+			return -1;
+		dentry_fill(entry, dentry);
+	} else if(read_dentry_by_index(dir->file_pos, dentry) == -1) {
+		return -1;
+	}
+	dir->file_pos++;
+
+	return 0;
+}
+
+/* read_directory(int32_t fd, void* buf, int32_t nbytes)
+ * INPUTS:			fd - open directory
+ *					buf - pointer to buffer to be filled with file name
+ * 					nbytes - size of buf
  * RETURN VALUE: 	The number of bytes read into the buffer
  * PURPOSE: 		Read a filename from the directory into a buffer,
  *					with consecutive reads putting consecutive filenames into
@@ -110,51 +379,109 @@ int32_t read_file(int32_t fd, void* buf, int32_t nbytes)
  *					After the last child is reached, further calls to the 
  *					function return 0.
  */
-int32_t read_directory(uint8_t* fname, void* buf, int32_t nbytes)
+int32_t read_directory(int32_t fd, void* buf, int32_t nbytes)
 {
 	dentry_t dentry_one;
-
-	static uint32_t dir_read_count = 0;
-
 	int32_t bytes_read;
 
-	int ret_value = read_dentry_by_index (dir_read_count, &dentry_one);	/* fill dentry struct */
+	fd_entry_t* dir = &get_pcb(process_count)->fde[fd];
 
-	if(ret_value == -1)
-	{
-		dir_read_count = 0;
+	if(nbytes < 0)
+		return -1;
+
+	if(dir_next(dir, &dentry_one) == -1)
 		return 0;
+
+	bytes_read = strlen((int8_t*)dentry_one.name);
+	if(bytes_read > nbytes)
+		bytes_read = nbytes;
+	memcpy(buf, dentry_one.name, bytes_read);	/* put file name into buffer */
+
+	return bytes_read;
+}
+
+/* read_dirents(int32_t fd, dirent_t* buf, uint32_t count)
+ * INPUTS:			fd - open directory
+ *					buf - records to fill
+ *					count - records buf has room for
+ * RETURN VALUE:	number of records filled, 0 after the last entry
+ * PURPOSE:			read_directory for many entries at once, with what a
+ *					listing needs to know about each file. Directories of a v1
+ *					image and the rtc have size 0.
+ */
+int32_t read_dirents(int32_t fd, dirent_t* buf, uint32_t count)
+{
+	dentry_t dentry;
+	uint32_t filled;
+	fs_stat_t st;
+
+	fd_entry_t* dir = &get_pcb(process_count)->fde[fd];
+
+	for(filled = 0; filled < count && dir_next(dir, &dentry) == 0; filled++) {
+		fs_stat(dentry.type, dentry.inode, &st);
+		buf[filled].inode = dentry.inode;
+		buf[filled].type = dentry.type;
+		buf[filled].size = st.size;
+		memcpy(buf[filled].name, dentry.name, FNAME_LENGTH + 1);
+		memset(buf[filled].reserved, 0, sizeof(buf[filled].reserved));
 	}
-	else
-	{
 
-		dir_read_count++;
+	return filled;
+}
 
-		strcpy(((int8_t*)buf), ((int8_t*)&dentry_one.name));	/* put file name into buffer */
+/* fs_stat(uint32_t type, uint32_t inode, fs_stat_t* st)
+ * INPUTS:			type - FILE_TYPE_* of the directory entry
+ *					inode - its inode number
+ *					st - filled in
+ * RETURN VALUE:	0, or -1 if the inode of a file does not exist
+ * PURPOSE:			directories of a v1 image are the boot block, and the rtc
+ *					has no data; both report size 0
+ */
+int32_t fs_stat(uint32_t type, uint32_t inode, fs_stat_t* st)
+{
+	st->inode = inode;
+	st->type = type;
+	st->size = 0;
 
-		bytes_read = strlen(((int8_t*)buf));
+	if(type == FILE_TYPE_REGULAR || (type == FILE_TYPE_DIRECTORY && fs_info.version == FS_V2_VERSION)) {
+		if(inode_length(inode, &st->size) == -1)
+			return -1;
 	}
+	st->blocks = (st->size + KB4 - 1) / KB4;
 
-	return bytes_read;
+	return 0;
 }
 
 
-/* write_file(void* buf, int32_t nbytes)
- * INPUTS:			buf - unused
- * 					nbytes - unused
- * RETURN VALUE: -1 because the file system is read-only
- * PURPOSE: Place holder function to be integrated into system calls
+/* write_file(int32_t fd, const void* buf, int32_t nbytes)
+ * INPUTS:			fd - open regular file
+ *					buf - bytes to write
+ * 					nbytes - number of bytes to write
+ * RETURN VALUE:	number of bytes written; -1 if none could be
+ * PURPOSE: 		Write at the file position into the overlay and move the
+ *					position past the bytes written, growing the file as needed.
  */
-int32_t write_file(uint8_t* fname, void* buf, int32_t nbytes)
+int32_t write_file(int32_t fd, const void* buf, int32_t nbytes)
 {
-	return -1;
+	int32_t ret_val;
+
+	fd_entry_t* file = &get_pcb(process_count)->fde[fd];
+
+	if(nbytes < 0)
+		return -1;
+
+	ret_val = write_cursor(file->inode, file->file_pos, &file->cursor, (const uint8_t*)buf, nbytes);
+	if(ret_val > 0)
+		file->file_pos += ret_val;
+
+	return ret_val;
 }
 
 
 /* write_directory(void* buf, int32_t nbytes)
  * INPUTS:			buf - unused
  * 					nbytes - unused
- * RETURN VALUE: -1 because the file system is read-only
+ * RETURN VALUE: -1; entries are added and removed with create and unlink
  * PURPOSE: Place holder function to be integrated into system calls
  */
 int32_t write_directory(uint8_t* fname, void* buf, int32_t nbytes)
@@ -190,53 +517,44 @@ int32_t close_directory()
  *			dentry - pointer to struct to fill with directory entry information
  * RETURN VALUE: 0 means success; -1 means failure
  * PURPOSE: Given a file name and a pointer to a (empty) dentry struct in memory,
- *			this function searches the through the directory entries in the file system
- *			for the named file and populates the dentry struct with info from the
- *			directory entry such as filename, inode #, and file type
+ *			this function looks the name up in the hash index filesys_init built
+ *			and populates the dentry struct with info from the directory entry
+ *			such as filename, inode #, and file type. In a v2 image the name is a
+ *			path from the root directory.
  */
 int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry)
 {
 	if( fname == NULL || dentry == NULL)
 		return -1;
+	if(fs_info.version == FS_V2_VERSION)
+		return read_dentry_path(fname, dentry);
 
-	int check, compare;
+	uint32_t fname_len = dentry_name_len(fname, FNAME_LENGTH + 1);
+	uint32_t slot;
 	uint8_t* fs_dentry_ptr;
-	uint8_t fname_len = strlen((int8_t*)fname);
-	uint8_t dentry_filename_len;
-	uint8_t* dentry_filename;
-	
-	//Check every entry to check name
-		/* Note that we are assuming (here or somewhere) that all dir entries are packed
-	 	 * consecutively at the beginning of the directory entry array in the boot block */
-	for(check = 0; check < fs_info.num_dir_entries; check++)
+
+	if(fname_len > FNAME_LENGTH)
+		return -1;
+
+	/* probe from the name's home slot until it or an empty slot turns up */
+	for(slot = dentry_hash(fname, fname_len); dentry_index[slot] != 0; slot = (slot + 1) & (DENTRY_HASH_SIZE - 1))
 	{
-		//Check if name is the same
-
-		dentry_filename = fs_info.dir_entries[check];
-		dentry_filename_len = strlen((int8_t*)dentry_filename);
-		
-		compare = 1;
-
-		if(dentry_filename_len == fname_len)
-			compare = strncmp( (int8_t*)(fname), (int8_t*)(fs_info.dir_entries[check]), fname_len );
-		
-		if(compare == 0)
-		{
-			//Create a copy of dentry at the given check into the pointer
-			fs_dentry_ptr = fs_info.dir_entries[check];
-
-			//Copy every element in the struct
-			strcpy((int8_t*)(dentry->name), (int8_t*)fname );	/* file name */
-			fs_dentry_ptr += FNAME_LENGTH;
-			dentry->type = *fs_dentry_ptr;					/* file type */
-			fs_dentry_ptr += FS_FIELD_SIZE;
-			dentry->inode = *((uint32_t*)(fs_dentry_ptr));	/* index node number */
-		
-			//Success
-			return 0;
-		}
+		fs_dentry_ptr = fs_info.dir_entries[dentry_index[slot] - 1];
+		if(dentry_name_len(fs_dentry_ptr, FNAME_LENGTH) != fname_len ||
+		   strncmp((int8_t*)fname, (int8_t*)fs_dentry_ptr, fname_len) != 0)
+			continue;
+
+		//Copy every element in the struct
+		strcpy((int8_t*)(dentry->name), (int8_t*)fname );	/* file name */
+		fs_dentry_ptr += FNAME_LENGTH;
+		dentry->type = *fs_dentry_ptr;					/* file type */
+		fs_dentry_ptr += FS_FIELD_SIZE;
+		dentry->inode = *((uint32_t*)(fs_dentry_ptr));	/* index node number */
+
+		//Success
+		return 0;
 	}
-	
+
 	//In the case of error
 	return -1;
 }
@@ -249,23 +567,27 @@ int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry)
  * RETURN VALUE: 0 means success; -1 means failure
  * PURPOSE: Given an index and a pointer to a (empty) dentry struct in memory,
  *			this function gets the name of the file specified by the index and populates
- * 			the dentry struct with info from the directory entry such as filename, inode #, and file type
+ * 			the dentry struct with info from the directory entry such as filename, inode #, and file type.
+ *			In a v2 image the index counts entries of the root directory.
  */
 int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry)
 {
-	if(index < 0 || index >= fs_info.num_dir_entries || dentry == NULL)
+	uint8_t entry[DENTRY_SIZE];
+
+	if(dentry == NULL)
 		return -1;
 
-	//Create a copy of dentry at the given check into the pointer
-	uint8_t* fs_dentry_ptr;
-	fs_dentry_ptr = fs_info.dir_entries[index];
+	if(fs_info.version == FS_V2_VERSION) {
+		if(dir_entry_get(fs_info.root_inode, index, entry) == -1)
+			return -1;
+		dentry_fill(entry, dentry);
+		return 0;
+	}
+
+	if(index >= fs_info.num_dir_entries)
+		return -1;
 
-	//Copy every element in the struct
-	strcpy((int8_t*)(dentry->name), (int8_t*)fs_dentry_ptr );	/* file name */
-	fs_dentry_ptr += FNAME_LENGTH;
-	dentry->type = *fs_dentry_ptr;					/* file type */
-	fs_dentry_ptr += FS_FIELD_SIZE;
-	dentry->inode = *((uint32_t*)(fs_dentry_ptr));	/* index node number */
+	dentry_fill(fs_info.dir_entries[index], dentry);
 
 	//Success
 	return 0;
@@ -287,132 +609,1415 @@ int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry)
  */
 int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length)
 {
-	inode_t* inode_ptr_two;
-	uint32_t length_check, file_check;
-	uint32_t adjusted_length;
-	int check = 0;
-	int block_ct = 0;
-	int byte_ct = 0;
-	uint32_t read_bytes = length;
-	uint32_t size_total = offset + length;
-	uint32_t return_bytes;
-	uint8_t* offset_pointer;
-	uint8_t* buffer;
-	
-	adjusted_length = length;
-	
-	//Set inode_ptr_two
-	inode_ptr_two = (inode_t*)((uint8_t*)(fs_info.filesys_ptr) + KB4*(inode + 1));
-	
-	//Set length
-	length_check = inode_ptr_two->file_length - offset;
-	
-	//Check the size of the file
-	int size_check = KB4 * MAX_DBLOCKS_PER_FILE; // Declared in filesys_mod.h
-	
-	if(inode_ptr_two->file_length > size_check)
-	{
-		//Invalid
+	file_cursor_t cursor;
+
+	if(buf == NULL)
 		return -1;
-	}
-	
-	//Ensure file fits or trim
-	file_check = inode_ptr_two->file_length;
-	
-	if(offset + length > inode_ptr_two->file_length)
-	{
-		//Trim
-		adjusted_length = inode_ptr_two->file_length - offset;
-		size_total = offset + adjusted_length;
-	}
-	
-	//Check if read past file
-	if(length_check <= 0)
-	{
-		//Simply return
+
+	cursor.block = offset / KB4;
+	cursor.offset = offset % KB4;
+	return read_cursor(inode, offset, &cursor, buf, length);
+}
+
+/* Read Data at a Cursor
+ * read_cursor(uint32_t inode, uint32_t file_pos, file_cursor_t* cursor, uint8_t* buf, uint32_t length)
+ * INPUTS:	inode - inode number of the file to read
+ *			file_pos - where to start reading (bytes from start of file)
+ *			cursor - block index and offset of file_pos, moved past the bytes read
+ *			buf - pointer to buffer to be filled with data
+ *			length - number of bytes to read from file
+ * RETURN VALUE: number of bytes of data that was read; -1 means failure
+ * PURPOSE: The read path of open files. A cursor left by the previous read of
+ *			the same file already points at file_pos, so a sequential read starts
+ *			without searching; any other cursor is recomputed from file_pos.
+ *			Data blocks that lie back to back in memory are copied with one
+ *			memcpy.
+ */
+int32_t read_cursor (uint32_t inode, uint32_t file_pos, file_cursor_t* cursor, uint8_t* buf, uint32_t length)
+{
+	uint32_t file_length, run, run_bytes, copied;
+	uint8_t* first;
+
+	if(inode_length(inode, &file_length) == -1)
+		return -1;
+
+	if(file_pos >= file_length)
 		return 0;
+	if(length > file_length - file_pos)
+		length = file_length - file_pos;
+
+	if(cursor->block * KB4 + cursor->offset != file_pos) {
+		cursor->block = file_pos / KB4;
+		cursor->offset = file_pos % KB4;
 	}
-	
-	//Calculate the blocks
-	read_bytes = adjusted_length;
-	block_ct = size_total / KB4;
-	byte_ct = size_total % KB4;
-	
-	
-	//Check the offset to see the amount of skipped blocks
-	while(offset > KB4)
-	{
-		offset = offset - KB4;
-		check++;
-		block_ct--;
-	}
-	
-	return_bytes = read_bytes;
-	
-	buffer = buf;
-	
-	while(read_bytes > 0)
-	{
-		if(block_ct <= 0)
-		{
-			//Copy the end
-			offset_pointer = (uint8_t*) &fs_info.data_blocks[KB4 * inode_ptr_two->dblock_numbers[check]] + offset;
-			memcpy(buffer, offset_pointer, read_bytes);
-			read_bytes = 0;
-						
-		}
-		else
-		{
-			//Decrement the amount of blocks
-			block_ct--;
-			
-			//Set offset pointer
-			offset_pointer = (uint8_t*) &fs_info.data_blocks[KB4 * inode_ptr_two->dblock_numbers[check]] + offset;
-			memcpy(buffer, offset_pointer, (KB4 - offset));
-			
-			//Reset buffer and read_bytes
-			buffer = buffer + KB4 - offset;
-			read_bytes = read_bytes - (KB4 - offset);
-			offset = 0;
-			
-			//Increment
-			check++;
-			
-		}
+
+	for(copied = 0; copied < length; copied += run_bytes) {
+		first = inode_run(inode, cursor->block, (length - copied) / KB4 + 2, &run);
+		if(first == NULL)
+			return -1;
+		run_bytes = run * KB4 - cursor->offset;
+		if(run_bytes > length - copied)
+			run_bytes = length - copied;
+
+		memcpy(buf + copied, first + cursor->offset, run_bytes);
+
+		cursor->offset += run_bytes;
+		cursor->block += cursor->offset / KB4;
+		cursor->offset %= KB4;
 	}
-	
-	//Return amount of bytes read
-	return return_bytes;
+
+	return length;
+}
+
+/* fs_map(uint32_t inode, uint32_t offset, uint32_t length, uint8_t** data)
+ * INPUTS:	inode - inode number of the file
+ *			offset - bytes from the start of the file
+ *			length - most bytes wanted
+ *			data - set to the address of the byte at offset
+ * RETURN VALUE: bytes from *data on that are the file's, in one piece; 0 at
+ *			the end of the file; -1 on failure or when the block has no fixed
+ *			address (a compressed image or one on disk), in which case read_cursor still works
+ * PURPOSE: lets a caller use file data where it lies instead of copying it
+ *			out; the bytes are valid until the file is written or removed
+ */
+int32_t fs_map (uint32_t inode, uint32_t offset, uint32_t length, uint8_t** data)
+{
+	uint32_t file_length, run, bytes;
+	uint8_t* first;
+
+	if(inode_length(inode, &file_length) == -1)
+		return -1;
+	if(offset >= file_length)
+		return 0;
+	if(length > file_length - offset)
+		length = file_length - offset;
+
+	if(fs_block_shared(inode_block(inode, offset / KB4)) == NULL)
+		return -1;
+	first = inode_run(inode, offset / KB4, (offset % KB4 + length + KB4 - 1) / KB4, &run);
+	if(first == NULL)
+		return -1;
+
+	*data = first + offset % KB4;
+	bytes = run * KB4 - offset % KB4;
+	return (bytes < length) ? bytes : length;
 }
 
 /*
 * inode_address
 *
-* DESCRIPTION: gives the address to a particular inode
+* DESCRIPTION: gives the address to a particular inode in the v1 layout, the
+*				overlay's copy if it was written. A v2 inode nobody wrote has
+*				no such layout; inode_v2 finds it.
 * INPUTS: (inode) the given inode that we want the address for
-* OUTPUS: the address of the inode, -1 on failure
+* OUTPUS: the address of the inode, NULL on failure
 */
-inode_t * inode_address (uint32_t inode)
+static inode_t * inode_address (uint32_t inode)
 {
-	uint32_t start_address = (uint32_t)fs_info.filesys_ptr;
-	
-	inode_t * temporary;
-	
-	boot_block_t * get_block = (boot_block_t *) start_address;
-	
-	//Compute the address
-	temporary = (inode_t*) (start_address + KB4 + inode * KB4);
-	
-	if(inode >= get_block->num_inodes)
-	{
+	if(inode < FS_MAX_INODES && overlay_inodes[inode] != NULL)
+		return overlay_inodes[inode];
+
+	if(inode >= fs_info.num_inodes || fs_info.version == FS_V2_VERSION)
+		return NULL;
+
+	return (inode_t*)image_block(image_inode_start + inode);
+}
+
+/*
+* inode_v2
+*
+* DESCRIPTION: gives the image's copy of a v2 inode
+* INPUTS: (inode) inode number
+* OUTPUS: the address of the inode, NULL if it is out of range, unused, or was
+*		  released since boot
+*/
+static inode_v2_t * inode_v2 (uint32_t inode)
+{
+	inode_v2_t* inode_ptr;
+	uint8_t* block;
+
+	if(fs_info.version != FS_V2_VERSION || inode >= fs_info.num_inodes)
+		return NULL;
+	if(inode < FS_MAX_INODES && (inode_state[inode] & INODE_FREED))
+		return NULL;
+
+	block = image_block(image_inode_start + inode / (KB4 / FS_V2_INODE_SIZE));
+	if(block == NULL)
+		return NULL;
+	inode_ptr = (inode_v2_t*)(block + inode % (KB4 / FS_V2_INODE_SIZE) * FS_V2_INODE_SIZE);
+	return (inode_ptr->type == 0) ? NULL : inode_ptr;
+}
+
+/*
+* extent_find
+*
+* DESCRIPTION: walks the extent tree of a v2 inode down to the leaf extent
+*				holding a file block. Each level is searched in halves for
+*				the last entry starting at or before the block; a node that
+*				does not look like one ends the walk.
+* INPUTS: (inode_ptr) image inode, (index) block of the file
+* OUTPUS: the extent, NULL if the block is not mapped
+*/
+static extent_t * extent_find (inode_v2_t* inode_ptr, uint32_t index)
+{
+	extent_header_t* header = &inode_ptr->root;
+	extent_t* entries = inode_ptr->extents;
+	uint32_t depth = header->depth;
+	uint32_t limit = EXT_INLINE;
+	uint32_t low, high, mid;
+	uint8_t* node;
+
+	if(depth > EXT_MAX_DEPTH)
 		return NULL;
+
+	while(1) {
+		if(header->magic != EXT_MAGIC || header->depth != depth ||
+		   header->entries == 0 || header->entries > limit)
+			return NULL;
+
+		low = 0;
+		high = header->entries;
+		while(high - low > 1) {
+			mid = (low + high) / 2;
+			if(entries[mid].logical <= index)
+				low = mid;
+			else
+				high = mid;
+		}
+		if(entries[low].logical > index)
+			return NULL;
+
+		if(depth == 0)
+			return (index - entries[low].logical < entries[low].count) ? &entries[low] : NULL;
+
+		if(entries[low].start >= fs_info.num_data_blocks)
+			return NULL;
+		node = fs_block(entries[low].start);
+		if(node == NULL)
+			return NULL;
+		header = (extent_header_t*)node;
+		entries = (extent_t*)(node + sizeof(extent_header_t));
+		limit = EXT_PER_BLOCK;
+		depth--;
 	}
-	
-	else
-	{
-		return temporary;
+}
+
+/*
+* inode_length
+*
+* DESCRIPTION: gives the length of a file
+* INPUTS: (inode) inode number, (length) set to the length in bytes
+* OUTPUS: 0, or -1 for an inode that does not exist
+*/
+int32_t inode_length (uint32_t inode, uint32_t* length)
+{
+	inode_t* inode_ptr = inode_address(inode);
+	inode_v2_t* v2_ptr;
+
+	if(inode_ptr != NULL) {
+		if(inode_ptr->file_length > KB4 * MAX_DBLOCKS_PER_FILE)
+			return -1;
+		*length = inode_ptr->file_length;
+		return 0;
+	}
+
+	v2_ptr = inode_v2(inode);
+	if(v2_ptr == NULL)
+		return -1;
+	*length = v2_ptr->file_length;
+	return 0;
+}
+
+/*
+* inode_block
+*
+* DESCRIPTION: maps a block of a file to its data block number
+* INPUTS: (inode) inode number, (index) block of the file
+* OUTPUS: the data block number, FS_NO_BLOCK if there is none
+*/
+uint32_t inode_block (uint32_t inode, uint32_t index)
+{
+	inode_t* inode_ptr = inode_address(inode);
+	inode_v2_t* v2_ptr;
+	extent_t* extent;
+
+	if(inode_ptr != NULL)
+		return (index < MAX_DBLOCKS_PER_FILE) ? inode_ptr->dblock_numbers[index] : FS_NO_BLOCK;
+
+	v2_ptr = inode_v2(inode);
+	if(v2_ptr == NULL || (extent = extent_find(v2_ptr, index)) == NULL)
+		return FS_NO_BLOCK;
+	return extent->start + (index - extent->logical);
+}
+
+/*
+* inode_run
+*
+* DESCRIPTION: finds a block of a file and how many of the blocks after it
+*				follow it in memory, so a read can copy them at once. An extent
+*				of the image is one such run; elsewhere the addresses of the
+*				blocks are compared. A cached image has no runs: its
+*				blocks come through fscache one at a time.
+* INPUTS: (inode) inode number, (index) first block of the file,
+*		  (max) most blocks wanted, (run) set to the blocks in the run
+* OUTPUS: the address of the first block, NULL if it is not mapped
+*/
+static uint8_t * inode_run (uint32_t inode, uint32_t index, uint32_t max, uint32_t* run)
+{
+	inode_v2_t* v2_ptr;
+	extent_t* extent;
+	uint8_t* first;
+
+	if(image_cached) {
+		*run = 1;
+		return fs_block(inode_block(inode, index));
+	}
+
+	if(inode_address(inode) == NULL && (v2_ptr = inode_v2(inode)) != NULL) {
+		extent = extent_find(v2_ptr, index);
+		if(extent == NULL || extent->start + extent->count < extent->start ||
+		   extent->start + extent->count > fs_info.num_data_blocks)
+			return NULL;
+		*run = extent->count - (index - extent->logical);
+		if(*run > max)
+			*run = max;
+		return fs_block(extent->start + (index - extent->logical));
 	}
 
+	first = fs_block(inode_block(inode, index));
+	for(*run = 1; first != NULL && *run < max &&
+				  fs_block(inode_block(inode, index + *run)) == first + *run * KB4; (*run)++)
+		;
+	return first;
 }
 
+/*
+* fs_block
+*
+* DESCRIPTION: gives the address of a data block, in the module or the overlay
+* INPUTS: (block) data block number from an inode
+* OUTPUS: the address of the block, NULL for a block that does not exist
+*/
+uint8_t* fs_block (uint32_t block)
+{
+	if(block < fs_info.num_data_blocks)
+		return image_block(image_data_start + block);
+
+	block -= fs_info.num_data_blocks;
+	if(block >= FS_OVERLAY_BLOCKS)
+		return NULL;
+
+	return (uint8_t*)overlay_blocks[block];
+}
 
+/*
+* fs_block_shared
+*
+* DESCRIPTION: like fs_block, for callers that keep the address: a block of
+*				a compressed image or one on disk only lives in the cache until it
+*				is reused
+* INPUTS: (block) data block number from an inode
+* OUTPUS: the address of the block, NULL if it does not exist or does not
+*		  stay put
+*/
+uint8_t* fs_block_shared (uint32_t block)
+{
+	if(image_cached && block < fs_info.num_data_blocks)
+		return NULL;
+
+	return fs_block(block);
+}
+
+/*
+* image_block
+*
+* DESCRIPTION: gives a block of the image as it was built, counting from the
+*				boot block or superblock
+* INPUTS: (block) block number in the image
+* OUTPUS: the address of the block, NULL if a cached image has no such
+*		  block or it cannot be read; a module image is not bounds checked
+*/
+static uint8_t* image_block (uint32_t block)
+{
+	if(image_cached)
+		return fscache_block(block);
+
+	return (uint8_t*)fs_info.filesys_ptr + KB4 * block;
+}
+
+/************** v2 directories ******************/
+
+/* dir_entry_get(uint32_t dir, uint32_t index, uint8_t* entry)
+ * INPUTS:			dir - inode of a directory
+ *					index - entry to read
+ *					entry - DENTRY_SIZE bytes to fill
+ * RETURN VALUE:	0 on success, -1 past the last entry
+ */
+static int32_t dir_entry_get(uint32_t dir, uint32_t index, uint8_t* entry)
+{
+	file_cursor_t cursor;
+
+	if(index >= FS_NO_BLOCK / DENTRY_SIZE)
+		return -1;
+
+	cursor.block = index * DENTRY_SIZE / KB4;
+	cursor.offset = index * DENTRY_SIZE % KB4;
+	return (read_cursor(dir, index * DENTRY_SIZE, &cursor, entry, DENTRY_SIZE) == DENTRY_SIZE) ? 0 : -1;
+}
+
+/* dir_entry_put(uint32_t dir, uint32_t index, const uint8_t* entry)
+ * INPUTS:			dir - inode of a directory
+ *					index - entry to write, at most one past the last
+ *					entry - DENTRY_SIZE bytes to store
+ * RETURN VALUE:	0 on success, -1 on failure
+ */
+static int32_t dir_entry_put(uint32_t dir, uint32_t index, const uint8_t* entry)
+{
+	file_cursor_t cursor;
+
+	cursor.block = index * DENTRY_SIZE / KB4;
+	cursor.offset = index * DENTRY_SIZE % KB4;
+	return (write_cursor(dir, index * DENTRY_SIZE, &cursor, entry, DENTRY_SIZE) == DENTRY_SIZE) ? 0 : -1;
+}
+
+/* dir_count(uint32_t dir)
+ * INPUTS:			dir - inode of a directory
+ * RETURN VALUE:	number of entries in it
+ */
+static uint32_t dir_count(uint32_t dir)
+{
+	uint32_t length;
+
+	if(inode_length(dir, &length) == -1)
+		return 0;
+
+	return length / DENTRY_SIZE;
+}
+
+/* dir_changed(uint32_t dir)
+ * INPUTS:			dir - directory that gained or lost an entry
+ * RETURN VALUE:	none
+ * PURPOSE:			keeps num_dir_entries counting the root directory
+ */
+static void dir_changed(uint32_t dir)
+{
+	if(dir == fs_info.root_inode)
+		fs_info.num_dir_entries = dir_count(dir);
+}
+
+/* dentry_compare(const uint8_t* key, const uint8_t* entry)
+ * INPUTS:			key - name padded with NULs to FNAME_LENGTH bytes
+ *					entry - directory entry, its name padded the same way
+ * RETURN VALUE:	<0, 0 or >0 as key sorts before, with or after entry
+ * PURPOSE:			the order mkfs sorts by: bytes compared as unsigned
+ */
+static int32_t dentry_compare(const uint8_t* key, const uint8_t* entry)
+{
+	uint32_t i;
+
+	for(i = 0; i < FNAME_LENGTH; i++)
+		if(key[i] != entry[i])
+			return (int32_t)key[i] - (int32_t)entry[i];
+
+	return 0;
+}
+
+/* dir_search(uint32_t dir, const uint8_t* key, uint32_t* index, uint8_t* entry)
+ * INPUTS:			dir - inode of a directory
+ *					key - name padded with NULs to FNAME_LENGTH bytes
+ *					index - set to the entry's index, or where it would go
+ *					entry - filled with the entry if found; may be NULL
+ * RETURN VALUE:	0 if the name is in the directory, -1 if not
+ * PURPOSE:			the entries are sorted, so they are searched in halves
+ */
+static int32_t dir_search(uint32_t dir, const uint8_t* key, uint32_t* index, uint8_t* entry)
+{
+	uint8_t probe[DENTRY_SIZE];
+	uint32_t low = 0, high = dir_count(dir), mid;
+	int32_t cmp;
+
+	while(low < high) {
+		mid = (low + high) / 2;
+		if(dir_entry_get(dir, mid, probe) == -1)
+			return -1;
+		cmp = dentry_compare(key, probe);
+		if(cmp == 0) {
+			*index = mid;
+			if(entry != NULL)
+				memcpy(entry, probe, DENTRY_SIZE);
+			return 0;
+		}
+		if(cmp < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+
+	*index = low;
+	return -1;
+}
+
+/* dir_insert(uint32_t dir, uint32_t index, const uint8_t* entry)
+ * INPUTS:			dir - inode of a directory
+ *					index - sorted place of the new entry
+ *					entry - DENTRY_SIZE bytes to insert
+ * RETURN VALUE:	0 on success, -1 on failure
+ */
+static int32_t dir_insert(uint32_t dir, uint32_t index, const uint8_t* entry)
+{
+	uint8_t moved[DENTRY_SIZE];
+	uint32_t i;
+
+	for(i = dir_count(dir); i > index; i--) {
+		if(dir_entry_get(dir, i - 1, moved) == -1 || dir_entry_put(dir, i, moved) == -1)
+			return -1;
+	}
+
+	return dir_entry_put(dir, index, entry);
+}
+
+/* dir_remove(uint32_t dir, uint32_t index)
+ * INPUTS:			dir - inode of a directory
+ *					index - entry to remove
+ * RETURN VALUE:	0 on success, -1 on failure
+ */
+static int32_t dir_remove(uint32_t dir, uint32_t index)
+{
+	uint8_t moved[DENTRY_SIZE];
+	uint32_t count = dir_count(dir);
+	uint32_t i;
+
+	for(i = index; i + 1 < count; i++) {
+		if(dir_entry_get(dir, i + 1, moved) == -1 || dir_entry_put(dir, i, moved) == -1)
+			return -1;
+	}
+
+	return fs_truncate(dir, (count - 1) * DENTRY_SIZE);
+}
+
+/* path_parent(const uint8_t* path, uint32_t* dir, uint8_t* key)
+ * INPUTS:			path - names separated by '/', from the root directory
+ *					dir - set to the inode of the directory holding the last name
+ *					key - FNAME_LENGTH bytes, set to the last name padded with NULs
+ * RETURN VALUE:	0 on success; -1 if a name is empty or too long, or a
+ *					directory on the way does not exist
+ */
+static int32_t path_parent(const uint8_t* path, uint32_t* dir, uint8_t* key)
+{
+	uint8_t entry[DENTRY_SIZE];
+	uint32_t pos = 0, len, index;
+
+	*dir = fs_info.root_inode;
+	while(1) {
+		while(pos < FS_PATH_MAX && path[pos] == '/')
+			pos++;
+		for(len = 0; pos + len < FS_PATH_MAX && path[pos + len] != '\0' && path[pos + len] != '/'; len++)
+			;
+		if(len == 0 || len > FNAME_LENGTH)
+			return -1;
+
+		memset(key, 0, FNAME_LENGTH);
+		memcpy(key, path + pos, len);
+		for(pos += len; pos < FS_PATH_MAX && path[pos] == '/'; pos++)
+			;
+		if(pos >= FS_PATH_MAX)
+			return -1;
+		if(path[pos] == '\0')
+			return 0;
+
+		if(dir_search(*dir, key, &index, entry) == -1 || entry[FNAME_LENGTH] != FILE_TYPE_DIRECTORY)
+			return -1;
+		*dir = *(uint32_t*)(entry + FNAME_LENGTH + FS_FIELD_SIZE);
+	}
+}
+
+/* read_dentry_path(const uint8_t* path, dentry_t* dentry)
+ * INPUTS:			path - names separated by '/', from the root directory
+ *					dentry - filled with the entry of the last name
+ * RETURN VALUE:	0 on success, -1 if the path leads nowhere
+ */
+static int32_t read_dentry_path(const uint8_t* path, dentry_t* dentry)
+{
+	uint8_t key[FNAME_LENGTH];
+	uint8_t entry[DENTRY_SIZE];
+	uint32_t dir, index;
+
+	if(path_parent(path, &dir, key) == -1 || dir_search(dir, key, &index, entry) == -1)
+		return -1;
+
+	dentry_fill(entry, dentry);
+	return 0;
+}
+
+/************** writable overlay ******************/
+
+/* overlay_reset()
+ * INPUTS:			none
+ * RETURN VALUE:	none
+ * PURPOSE:			gives every overlay inode and block back to the allocator
+ */
+static void overlay_reset()
+{
+	uint32_t i;
+
+	for(i = 0; i < FS_MAX_INODES; i++) {
+		if(overlay_inodes[i] != NULL)
+			free_frame((uint32_t)overlay_inodes[i]);
+		overlay_inodes[i] = NULL;
+		inode_opens[i] = 0;
+		inode_state[i] = 0;
+	}
+	for(i = 0; i < FS_OVERLAY_BLOCKS; i++) {
+		if(overlay_blocks[i] != 0)
+			free_frame(overlay_blocks[i]);
+		overlay_blocks[i] = 0;
+	}
+	overlay_hint = 0;
+}
+
+/* overlay_block_alloc()
+ * INPUTS:			none
+ * RETURN VALUE:	number of a new zeroed data block, FS_NO_BLOCK if the overlay
+ *					or memory is full
+ */
+static uint32_t overlay_block_alloc()
+{
+	uint32_t i, slot, frame;
+
+	for(i = 0; i < FS_OVERLAY_BLOCKS; i++) {
+		slot = (overlay_hint + i) % FS_OVERLAY_BLOCKS;
+		if(overlay_blocks[slot] != 0)
+			continue;
+
+		frame = alloc_frame();
+		if(frame == 0)
+			return FS_NO_BLOCK;
+		memset((void*)frame, 0, KB4);
+		overlay_blocks[slot] = frame;
+		overlay_hint = slot + 1;
+		return fs_info.num_data_blocks + slot;
+	}
+
+	return FS_NO_BLOCK;
+}
+
+/* overlay_block_free(uint32_t block)
+ * INPUTS:			block - data block number
+ * RETURN VALUE:	none
+ * PURPOSE:			blocks of the module are left alone
+ */
+static void overlay_block_free(uint32_t block)
+{
+	if(block < fs_info.num_data_blocks || block - fs_info.num_data_blocks >= FS_OVERLAY_BLOCKS)
+		return;
+
+	block -= fs_info.num_data_blocks;
+	free_frame(overlay_blocks[block]);		/* a program mapping the block keeps its own reference */
+	overlay_blocks[block] = 0;
+}
+
+/* inode_writable(uint32_t inode)
+ * INPUTS:			inode - inode number
+ * RETURN VALUE:	the overlay copy of the inode, made from the image's on first
+ *					use; NULL if there is no such inode or no memory
+ */
+static inode_t* inode_writable(uint32_t inode)
+{
+	inode_t* copy;
+	uint32_t length, i;
+
+	if(inode >= FS_MAX_INODES || inode_length(inode, &length) == -1)
+		return NULL;
+	if(overlay_inodes[inode] != NULL)
+		return overlay_inodes[inode];
+	if(length > KB4 * MAX_DBLOCKS_PER_FILE)
+		return NULL;
+
+	copy = (inode_t*)alloc_frame();
+	if(copy == NULL)
+		return NULL;
+
+	/* a v2 inode's extents are written out as a block list */
+	if(fs_info.version == FS_V2_VERSION) {
+		memset(copy, 0, KB4);
+		copy->file_length = length;
+		for(i = 0; i < (length + KB4 - 1) / KB4; i++) {
+			copy->dblock_numbers[i] = inode_block(inode, i);
+			if(copy->dblock_numbers[i] >= fs_info.num_data_blocks) {
+				free_frame((uint32_t)copy);
+				return NULL;
+			}
+		}
+	} else {
+		memcpy(copy, inode_address(inode), KB4);
+	}
+
+	overlay_inodes[inode] = copy;
+	return copy;
+}
+
+/* block_writable(inode_t* inode_ptr, uint32_t index)
+ * INPUTS:			inode_ptr - overlay inode
+ *					index - data block of the file, below its length
+ * RETURN VALUE:	address of the block, copied out of the module first if it was
+ *					still the image's; NULL if no memory is left
+ */
+static uint8_t* block_writable(inode_t* inode_ptr, uint32_t index)
+{
+	uint32_t block = inode_ptr->dblock_numbers[index];
+	uint32_t copy;
+
+	if(block >= fs_info.num_data_blocks)
+		return fs_block(block);
+
+	copy = overlay_block_alloc();
+	if(copy == FS_NO_BLOCK)
+		return NULL;
+	memcpy(fs_block(copy), fs_block(block), KB4);
+	inode_ptr->dblock_numbers[index] = copy;
+	return fs_block(copy);
+}
+
+/* inode_release(uint32_t inode)
+ * INPUTS:			inode - inode no directory entry or descriptor refers to
+ * RETURN VALUE:	none
+ * PURPOSE:			frees the file's overlay blocks and its overlay inode; in a
+ *					v2 image the number is free again too
+ */
+static void inode_release(uint32_t inode)
+{
+	inode_t* inode_ptr = overlay_inodes[inode];
+	uint32_t i;
+
+	if(fs_info.version == FS_V2_VERSION)
+		inode_state[inode] = (inode_state[inode] | INODE_FREED) & ~INODE_CREATED;
+	if(inode_ptr == NULL)
+		return;
+
+	for(i = 0; i < (inode_ptr->file_length + KB4 - 1) / KB4; i++)
+		overlay_block_free(inode_ptr->dblock_numbers[i]);
+	free_frame((uint32_t)inode_ptr);
+	overlay_inodes[inode] = NULL;
+}
+
+/* fs_modify(uint32_t inode)
+ * INPUTS:			inode - file about to change
+ * RETURN VALUE:	0, or -1 if a running program is executing the file
+ * PURPOSE:			forgets the cached pages and snapshot of the program in the
+ *					file, which would go stale
+ */
+static int32_t fs_modify(uint32_t inode)
+{
+	if(image_cache_busy(inode))
+		return -1;
+
+	image_cache_drop(inode);
+	snapshot_drop(inode);
+	return 0;
+}
+
+/* fs_truncate(uint32_t inode, uint32_t length)
+ * INPUTS:			inode - file to resize
+ *					length - new length in bytes
+ * RETURN VALUE:	0 on success, -1 on failure
+ * PURPOSE:			Cuts the file, freeing the overlay blocks past the end, or
+ *					grows it with zeroes.
+ */
+int32_t fs_truncate (uint32_t inode, uint32_t length)
+{
+	inode_t* inode_ptr;
+	uint8_t* tail;
+	uint32_t old_blocks, new_blocks, i, block;
+
+	if(length > KB4 * MAX_DBLOCKS_PER_FILE || fs_modify(inode) == -1)
+		return -1;
+
+	inode_ptr = inode_writable(inode);
+	if(inode_ptr == NULL)
+		return -1;
+
+	old_blocks = (inode_ptr->file_length + KB4 - 1) / KB4;
+	new_blocks = (length + KB4 - 1) / KB4;
+
+	if(length <= inode_ptr->file_length) {
+		for(i = new_blocks; i < old_blocks; i++)
+			overlay_block_free(inode_ptr->dblock_numbers[i]);
+		inode_ptr->file_length = length;
+		return 0;
+	}
+
+	/* bytes past the old end of its last block may be left from a longer file */
+	if(inode_ptr->file_length % KB4 != 0) {
+		tail = block_writable(inode_ptr, old_blocks - 1);
+		if(tail == NULL)
+			return -1;
+		memset(tail + inode_ptr->file_length % KB4, 0, KB4 - inode_ptr->file_length % KB4);
+	}
+
+	for(i = old_blocks; i < new_blocks; i++) {
+		block = overlay_block_alloc();
+		if(block == FS_NO_BLOCK) {
+			inode_ptr->file_length = i * KB4;
+			return -1;
+		}
+		inode_ptr->dblock_numbers[i] = block;
+	}
+	inode_ptr->file_length = length;
+	return 0;
+}
+
+/* Write Data at a Cursor
+ * write_cursor(uint32_t inode, uint32_t file_pos, file_cursor_t* cursor, const uint8_t* buf, uint32_t length)
+ * INPUTS:	inode - file to write
+ *			file_pos - where to start writing (bytes from start of file)
+ *			cursor - block index and offset of file_pos, moved past the bytes written
+ *			buf - bytes to write
+ *			length - number of bytes to write
+ * RETURN VALUE: number of bytes written; -1 if none could be
+ * PURPOSE: The write path of open files. Blocks still in the module are copied
+ *			into the overlay the first time they are written, blocks past the
+ *			end are added zeroed, and a write beyond the end fills the gap with
+ *			zeroes first.
+ */
+int32_t write_cursor (uint32_t inode, uint32_t file_pos, file_cursor_t* cursor, const uint8_t* buf, uint32_t length)
+{
+	inode_t* inode_ptr;
+	uint8_t* block;
+	uint32_t written, chunk, new_block;
+
+	if(file_pos >= KB4 * MAX_DBLOCKS_PER_FILE || fs_modify(inode) == -1)
+		return -1;
+	if(length > KB4 * MAX_DBLOCKS_PER_FILE - file_pos)
+		length = KB4 * MAX_DBLOCKS_PER_FILE - file_pos;
+
+	inode_ptr = inode_writable(inode);
+	if(inode_ptr == NULL)
+		return -1;
+	if(file_pos > inode_ptr->file_length && fs_truncate(inode, file_pos) == -1)
+		return -1;
+
+	if(cursor->block * KB4 + cursor->offset != file_pos) {
+		cursor->block = file_pos / KB4;
+		cursor->offset = file_pos % KB4;
+	}
+
+	for(written = 0; written < length; written += chunk) {
+		if(cursor->block * KB4 < inode_ptr->file_length) {
+			block = block_writable(inode_ptr, cursor->block);
+		} else {
+			new_block = overlay_block_alloc();
+			block = (new_block == FS_NO_BLOCK) ? NULL : fs_block(new_block);
+			if(block != NULL)
+				inode_ptr->dblock_numbers[cursor->block] = new_block;
+		}
+		if(block == NULL)
+			break;
+
+		chunk = KB4 - cursor->offset;
+		if(chunk > length - written)
+			chunk = length - written;
+		memcpy(block + cursor->offset, buf + written, chunk);
+
+		cursor->offset += chunk;
+		cursor->block += cursor->offset / KB4;
+		cursor->offset %= KB4;
+		if(file_pos + written + chunk > inode_ptr->file_length)
+			inode_ptr->file_length = file_pos + written + chunk;
+	}
+
+	return (written == 0 && length != 0) ? -1 : (int32_t)written;
+}
+
+/* inode_alloc()
+ * INPUTS:			none
+ * RETURN VALUE:	number of a new empty inode, -1 if none is free or memory is out
+ * PURPOSE:			An inode is free when no descriptor holds it and, in v1, no
+ *					entry names it; v2 keeps its own record in the inode table
+ *					and inode_state. Inode 0 of a v2 image is never handed out.
+ */
+static int32_t inode_alloc()
+{
+	static uint8_t used[FS_MAX_INODES];
+	uint32_t i, inode;
+
+	for(i = 0; i < FS_MAX_INODES; i++)
+		used[i] = inode_opens[i] || (inode_state[i] & INODE_ORPHAN);
+
+	if(fs_info.version == FS_V2_VERSION) {
+		used[0] = 1;
+		for(i = 1; i < FS_MAX_INODES; i++)
+			used[i] |= (inode_state[i] & INODE_CREATED) || inode_v2(i) != NULL;
+	} else {
+		for(i = 0; i < fs_info.num_dir_entries; i++) {
+			inode = *(uint32_t*)(fs_info.dir_entries[i] + FNAME_LENGTH + FS_FIELD_SIZE);
+			if(inode < FS_MAX_INODES)
+				used[inode] = 1;
+		}
+	}
+
+	for(inode = 0; inode < FS_MAX_INODES && used[inode]; inode++)
+		;
+	if(inode == FS_MAX_INODES)
+		return -1;
+
+	/* the number may have belonged to a deleted file, even one in the module */
+	if(fs_modify(inode) == -1)
+		return -1;
+	inode_release(inode);
+	overlay_inodes[inode] = (inode_t*)alloc_frame();
+	if(overlay_inodes[inode] == NULL)
+		return -1;
+	memset(overlay_inodes[inode], 0, KB4);
+	if(fs_info.version == FS_V2_VERSION)
+		inode_state[inode] = (inode_state[inode] & ~INODE_FREED) | INODE_CREATED;
+
+	return inode;
+}
+
+/* create_v1(const uint8_t* fname)
+ * INPUTS:			fname - name of the new file
+ * RETURN VALUE:	0 on success, -1 on failure
+ * PURPOSE:			appends an entry to the boot block's flat directory
+ */
+static int32_t create_v1(const uint8_t* fname)
+{
+	dentry_t existing;
+	uint8_t* entry;
+	uint32_t len;
+	int32_t inode;
+
+	len = dentry_name_len(fname, FNAME_LENGTH + 1);
+	if(len == 0 || len > FNAME_LENGTH || dir_block == NULL)
+		return -1;
+	if(read_dentry_by_name(fname, &existing) == 0 || fs_info.num_dir_entries >= MAX_DENTRIES)
+		return -1;
+
+	inode = inode_alloc();
+	if(inode == -1)
+		return -1;
+
+	entry = fs_info.dir_entries[fs_info.num_dir_entries];
+	memset(entry, 0, DENTRY_SIZE);
+	memcpy(entry, fname, len);
+	entry[FNAME_LENGTH] = FILE_TYPE_REGULAR;
+	*(uint32_t*)(entry + FNAME_LENGTH + FS_FIELD_SIZE) = inode;
+	dir_block[0] = ++fs_info.num_dir_entries;
+
+	dentry_index_build();
+	return 0;
+}
+
+/* create_v2(const uint8_t* fname)
+ * INPUTS:			fname - path of the new file
+ * RETURN VALUE:	0 on success, -1 on failure
+ * PURPOSE:			inserts an entry at its sorted place in the parent directory
+ */
+static int32_t create_v2(const uint8_t* fname)
+{
+	uint8_t entry[DENTRY_SIZE];
+	uint32_t dir, index;
+	int32_t inode;
+
+	memset(entry, 0, DENTRY_SIZE);
+	if(path_parent(fname, &dir, entry) == -1 || dir_search(dir, entry, &index, NULL) == 0)
+		return -1;
+
+	inode = inode_alloc();
+	if(inode == -1)
+		return -1;
+
+	entry[FNAME_LENGTH] = FILE_TYPE_REGULAR;
+	*(uint32_t*)(entry + FNAME_LENGTH + FS_FIELD_SIZE) = inode;
+	if(dir_insert(dir, index, entry) == -1) {
+		inode_release(inode);
+		return -1;
+	}
+
+	dir_changed(dir);
+	return 0;
+}
+
+/* fs_create(const uint8_t* fname)
+ * INPUTS:			fname - name of the new file, a path in a v2 image
+ * RETURN VALUE:	0 on success; -1 if the name is taken or invalid, or the
+ *					directory or the inodes are full
+ * PURPOSE:			adds an empty regular file with an unused inode number
+ */
+int32_t fs_create (const uint8_t* fname)
+{
+	if(fname == NULL)
+		return -1;
+
+	if(fs_info.version == FS_V2_VERSION)
+		return create_v2(fname);
+	return create_v1(fname);
+}
+
+/* unlink_v1(const uint8_t* fname, uint32_t* inode)
+ * INPUTS:			fname - regular file to remove
+ *					inode - set to the file's inode
+ * RETURN VALUE:	0 on success, -1 on failure
+ * PURPOSE:			the last entry of the flat directory moves into the hole
+ */
+static int32_t unlink_v1(const uint8_t* fname, uint32_t* inode)
+{
+	dentry_t dentry;
+	uint32_t i;
+
+	if(read_dentry_by_name(fname, &dentry) == -1 || dentry.type != FILE_TYPE_REGULAR)
+		return -1;
+	if(dentry.inode >= FS_MAX_INODES || fs_modify(dentry.inode) == -1)
+		return -1;
+
+	for(i = 0; i < fs_info.num_dir_entries; i++) {
+		if(*(uint32_t*)(fs_info.dir_entries[i] + FNAME_LENGTH + FS_FIELD_SIZE) == dentry.inode &&
+		   fs_info.dir_entries[i][FNAME_LENGTH] == FILE_TYPE_REGULAR)
+			break;
+	}
+	if(i == fs_info.num_dir_entries)
+		return -1;
+	memcpy(fs_info.dir_entries[i], fs_info.dir_entries[fs_info.num_dir_entries - 1], DENTRY_SIZE);
+	dir_block[0] = --fs_info.num_dir_entries;
+	dentry_index_build();
+
+	*inode = dentry.inode;
+	return 0;
+}
+
+/* unlink_v2(const uint8_t* fname, uint32_t* inode)
+ * INPUTS:			fname - path of the regular file to remove
+ *					inode - set to the file's inode
+ * RETURN VALUE:	0 on success, -1 on failure
+ * PURPOSE:			the entries after it move down so the directory stays sorted
+ */
+static int32_t unlink_v2(const uint8_t* fname, uint32_t* inode)
+{
+	uint8_t key[FNAME_LENGTH];
+	uint8_t entry[DENTRY_SIZE];
+	uint32_t dir, index;
+
+	if(path_parent(fname, &dir, key) == -1 || dir_search(dir, key, &index, entry) == -1)
+		return -1;
+	if(entry[FNAME_LENGTH] != FILE_TYPE_REGULAR)
+		return -1;
+
+	*inode = *(uint32_t*)(entry + FNAME_LENGTH + FS_FIELD_SIZE);
+	if(*inode >= FS_MAX_INODES || fs_modify(*inode) == -1)
+		return -1;
+	if(dir_remove(dir, index) == -1)
+		return -1;
+
+	dir_changed(dir);
+	return 0;
+}
+
+/* fs_unlink(const uint8_t* fname)
+ * INPUTS:			fname - regular file to remove, a path in a v2 image
+ * RETURN VALUE:	0 on success; -1 if there is no such file or a running program
+ *					is executing it
+ * PURPOSE:			removes the directory entry. The data goes now, or with the
+ *					last close if the file is still open.
+ */
+int32_t fs_unlink (const uint8_t* fname)
+{
+	uint32_t inode;
+
+	if(fname == NULL)
+		return -1;
+	if((fs_info.version == FS_V2_VERSION ? unlink_v2(fname, &inode) : unlink_v1(fname, &inode)) == -1)
+		return -1;
+
+	if(inode_opens[inode] != 0)
+		inode_state[inode] |= INODE_ORPHAN;
+	else
+		inode_release(inode);
+	return 0;
+}
+
+/* fs_inode_open(uint32_t inode)
+ * INPUTS:			inode - inode a new descriptor refers to
+ * RETURN VALUE:	none
+ */
+void fs_inode_open (uint32_t inode)
+{
+	if(inode < FS_MAX_INODES)
+		inode_opens[inode]++;
+}
+
+/* fs_inode_close(uint32_t inode)
+ * INPUTS:			inode - inode a closing descriptor referred to
+ * RETURN VALUE:	none
+ * PURPOSE:			the last close of an unlinked file frees it
+ */
+void fs_inode_close (uint32_t inode)
+{
+	if(inode >= FS_MAX_INODES || inode_opens[inode] == 0)
+		return;
+
+	if(--inode_opens[inode] == 0 && (inode_state[inode] & INODE_ORPHAN)) {
+		inode_state[inode] &= ~INODE_ORPHAN;
+		inode_release(inode);
+	}
+}
+
+/************** write back ******************/
+
+/* fs_sync writes the overlay of a v2 image on disk into blocks no inode uses:
+ * it marks the blocks the image still needs, writes every overlay block to a
+ * free one, and rewrites the inode table blocks holding a changed inode and
+ * last the superblock. The image keeps its blocks in place, so whatever is
+ * cached from it stays right. */
+#define SYNC_MAP_BITS	(KB4 * 8)		/* image blocks one bitmap frame covers */
+
+static uint32_t* sync_map[FS_SYNC_MAP_FRAMES];	/* 1 bits for blocks in use */
+static uint32_t sync_next;						/* where the search for a free block goes on */
+static uint32_t sync_end;						/* blocks the image takes up now */
+static uint32_t sync_disk;						/* blocks on the disk */
+static uint8_t* sync_pages[ATA_MAX_PAGES];		/* run of blocks waiting to be written */
+static uint32_t sync_first;						/* disk block of the first of them */
+static uint32_t sync_count;
+
+/* sync_mark(uint32_t block, uint32_t count)
+ * INPUTS:			block - first image block in use
+ *					count - blocks from it on
+ * RETURN VALUE:	0, or -1 if they are not all inside the image
+ */
+static int32_t sync_mark(uint32_t block, uint32_t count)
+{
+	if(block + count < block || block + count > fs_info.num_data_blocks)
+		return -1;
+
+	for(; count > 0; block++, count--)
+		sync_map[block / SYNC_MAP_BITS][block % SYNC_MAP_BITS / 32] |= 1 << (block % 32);
+	return 0;
+}
+
+/* sync_node(uint32_t inode, uint32_t node)
+ * INPUTS:			inode - v2 inode the image still describes
+ *					node - tree block, FS_NO_BLOCK for the inode's root
+ * RETURN VALUE:	the node's header, its entries following it; NULL if it
+ *					cannot be read
+ */
+static extent_header_t* sync_node(uint32_t inode, uint32_t node)
+{
+	inode_v2_t* inode_ptr;
+
+	if(node != FS_NO_BLOCK)
+		return (extent_header_t*)fs_block(node);
+
+	inode_ptr = inode_v2(inode);
+	return (inode_ptr == NULL) ? NULL : &inode_ptr->root;
+}
+
+/* sync_mark_tree(uint32_t inode, uint32_t node, uint32_t depth)
+ * INPUTS:			inode - v2 inode the image still describes
+ *					node - tree block, FS_NO_BLOCK for the inode's root
+ *					depth - index levels below node
+ * RETURN VALUE:	0, or -1 for a node that does not look like one
+ * PURPOSE:			marks the tree blocks and data blocks under node. The node
+ *					is looked up again for every entry, as walking the one
+ *					below may push it out of fscache.
+ */
+static int32_t sync_mark_tree(uint32_t inode, uint32_t node, uint32_t depth)
+{
+	extent_header_t* header;
+	extent_t entry;
+	uint32_t i;
+
+	if(depth > EXT_MAX_DEPTH)
+		return -1;
+
+	for(i = 0; ; i++) {
+		header = sync_node(inode, node);
+		if(header == NULL || header->magic != EXT_MAGIC || header->depth != depth ||
+		   header->entries > ((node == FS_NO_BLOCK) ? EXT_INLINE : EXT_PER_BLOCK))
+			return -1;
+		if(i == header->entries)
+			return 0;
+
+		entry = ((extent_t*)(header + 1))[i];
+		if(depth == 0) {
+			if(sync_mark(entry.start, entry.count) == -1)
+				return -1;
+		} else if(sync_mark(entry.start, 1) == -1 || sync_mark_tree(inode, entry.start, depth - 1) == -1) {
+			return -1;
+		}
+	}
+}
+
+/* sync_alloc()
+ * INPUTS:			none
+ * RETURN VALUE:	the first block from sync_next on nothing uses, past the end
+ *					of the image if need be; FS_NO_BLOCK if the disk is full
+ */
+static uint32_t sync_alloc()
+{
+	uint32_t block;
+
+	for(block = sync_next; block < sync_disk; block++) {
+		if(block < fs_info.num_data_blocks &&
+		   (sync_map[block / SYNC_MAP_BITS][block % SYNC_MAP_BITS / 32] & (1 << (block % 32))))
+			continue;
+
+		sync_next = block + 1;
+		if(sync_end < sync_next)
+			sync_end = sync_next;
+		return block;
+	}
+
+	return FS_NO_BLOCK;
+}
+
+/* sync_flush()
+ * INPUTS:			none
+ * RETURN VALUE:	0, or -1 if the disk failed
+ * PURPOSE:			writes the blocks sync_write gathered in one transfer
+ */
+static int32_t sync_flush()
+{
+	uint32_t count = sync_count;
+
+	sync_count = 0;
+	if(count == 0)
+		return 0;
+	return ata_write(sync_first * (KB4 / ATA_SECTOR), sync_pages, count);
+}
+
+/* sync_write(uint32_t block, uint8_t* page)
+ * INPUTS:			block - disk block to write
+ *					page - kernel page holding it, left alone until sync_flush
+ * RETURN VALUE:	0, or -1 if the disk failed
+ * PURPOSE:			gathers blocks that follow each other on the disk
+ */
+static int32_t sync_write(uint32_t block, uint8_t* page)
+{
+	if(sync_count != 0 && (block != sync_first + sync_count || sync_count == ATA_MAX_PAGES) &&
+	   sync_flush() == -1)
+		return -1;
+
+	if(sync_count == 0)
+		sync_first = block;
+	sync_pages[sync_count++] = page;
+	return 0;
+}
+
+/* sync_extents(const uint32_t* list, uint32_t blocks, uint32_t skip, uint32_t max, extent_t* out)
+ * INPUTS:			list - disk block of each block of a file
+ *					blocks - blocks in the file
+ *					skip - runs of consecutive blocks to pass over first
+ *					max - most extents wanted
+ *					out - filled with an extent per run after those, may be NULL
+ * RETURN VALUE:	extents given
+ */
+static uint32_t sync_extents(const uint32_t* list, uint32_t blocks, uint32_t skip, uint32_t max, extent_t* out)
+{
+	uint32_t i, end, runs = 0, n = 0;
+
+	for(i = 0; i < blocks && n < max; i = end) {
+		for(end = i + 1; end < blocks && list[end] == list[end - 1] + 1; end++)
+			;
+		if(runs++ < skip)
+			continue;
+
+		if(out != NULL) {
+			out[n].logical = i;
+			out[n].start = list[i];
+			out[n].count = end - i;
+		}
+		n++;
+	}
+	return n;
+}
+
+/* sync_inode(uint32_t inode, inode_v2_t* dest, uint32_t* list, uint8_t* leaf)
+ * INPUTS:			inode - inode with an overlay copy
+ *					dest - its entry in a copy of the inode table, the image's
+ *					list - page for the file's block list
+ *					leaf - page for building tree blocks in
+ * RETURN VALUE:	0, or -1 if the disk is full or failed
+ * PURPOSE:			writes the file's overlay blocks to free blocks and
+ *					describes all its blocks in dest, in the inode while the
+ *					extents fit, else in a level of tree blocks
+ */
+static int32_t sync_inode(uint32_t inode, inode_v2_t* dest, uint32_t* list, uint8_t* leaf)
+{
+	inode_t* inode_ptr = overlay_inodes[inode];
+	uint32_t blocks = (inode_ptr->file_length + KB4 - 1) / KB4;
+	uint32_t type = dest->type;
+	uint32_t extents, leaves, block, i;
+	extent_header_t* header;
+
+	for(i = 0; i < blocks; i++) {
+		list[i] = inode_ptr->dblock_numbers[i];
+		if(list[i] < fs_info.num_data_blocks)
+			continue;
+		if(fs_block(list[i]) == NULL || (list[i] = sync_alloc()) == FS_NO_BLOCK ||
+		   sync_write(list[i], fs_block(inode_ptr->dblock_numbers[i])) == -1)
+			return -1;
+	}
+
+	memset(dest, 0, FS_V2_INODE_SIZE);
+	dest->type = (type == 0 || (inode_state[inode] & INODE_CREATED)) ? FILE_TYPE_REGULAR : type;
+	dest->file_length = inode_ptr->file_length;
+	dest->num_blocks = blocks;
+	dest->root.magic = EXT_MAGIC;
+	dest->root.max = EXT_INLINE;
+
+	extents = sync_extents(list, blocks, 0, MAX_DBLOCKS_PER_FILE, NULL);
+	if(extents <= EXT_INLINE) {
+		dest->root.entries = sync_extents(list, blocks, 0, EXT_INLINE, dest->extents);
+		return 0;
+	}
+
+	/* 1023 blocks make at most four tree blocks of extents */
+	leaves = (extents + EXT_PER_BLOCK - 1) / EXT_PER_BLOCK;
+	header = (extent_header_t*)leaf;
+	for(i = 0; i < leaves; i++) {
+		block = sync_alloc();
+		if(block == FS_NO_BLOCK || sync_flush() == -1)
+			return -1;
+
+		memset(leaf, 0, KB4);
+		header->magic = EXT_MAGIC;
+		header->max = EXT_PER_BLOCK;
+		header->entries = sync_extents(list, blocks, i * EXT_PER_BLOCK, EXT_PER_BLOCK, (extent_t*)(header + 1));
+		if(ata_write(block * (KB4 / ATA_SECTOR), &leaf, 1) != 0)
+			return -1;
+
+		dest->extents[i].logical = ((extent_t*)(header + 1))[0].logical;
+		dest->extents[i].start = block;
+	}
+	dest->root.entries = leaves;
+	dest->root.depth = 1;
+	return 0;
+}
+
+/* sync_image(uint32_t* list, uint8_t* leaf, uint8_t* table)
+ * INPUTS:			list, leaf - pages for sync_inode
+ *					table - page for a block of the inode table
+ * RETURN VALUE:	0, or -1 if the image does not add up or the disk is full or
+ *					failed
+ * PURPOSE:			the write back itself, with the bitmap set up empty
+ */
+static int32_t sync_image(uint32_t* list, uint8_t* leaf, uint8_t* table)
+{
+	uint32_t per_block = KB4 / FS_V2_INODE_SIZE;
+	uint32_t table_blocks = (fs_info.num_inodes + per_block - 1) / per_block;
+	uint32_t i, t, changed;
+	inode_t* inode_ptr;
+	uint8_t* block;
+
+	sync_next = 0;
+	sync_end = fs_info.num_data_blocks;
+	sync_disk = ata_blocks();
+	sync_count = 0;
+
+	/* the superblock and inode table, and the blocks of every file */
+	if(sync_mark(0, image_inode_start + table_blocks) == -1)
+		return -1;
+	for(i = 0; i < fs_info.num_inodes; i++) {
+		inode_ptr = (i < FS_MAX_INODES) ? overlay_inodes[i] : NULL;
+		if(inode_ptr != NULL) {
+			for(t = 0; t < (inode_ptr->file_length + KB4 - 1) / KB4; t++)
+				if(inode_ptr->dblock_numbers[t] < fs_info.num_data_blocks)
+					sync_mark(inode_ptr->dblock_numbers[t], 1);
+		} else if(sync_node(i, FS_NO_BLOCK) != NULL &&
+				  sync_mark_tree(i, FS_NO_BLOCK, sync_node(i, FS_NO_BLOCK)->depth) == -1) {
+			return -1;
+		}
+	}
+
+	for(t = 0; t < table_blocks; t++) {
+		changed = 0;
+		for(i = t * per_block; i < (t + 1) * per_block && i < FS_MAX_INODES; i++)
+			changed |= (overlay_inodes[i] != NULL) || (inode_state[i] & (INODE_FREED | INODE_CREATED));
+		if(!changed)
+			continue;
+
+		if((block = image_block(image_inode_start + t)) == NULL)
+			return -1;
+		memcpy(table, block, KB4);
+		for(i = t * per_block; i < (t + 1) * per_block && i < FS_MAX_INODES; i++) {
+			if(overlay_inodes[i] != NULL) {
+				if(sync_inode(i, (inode_v2_t*)(table + (i - t * per_block) * FS_V2_INODE_SIZE), list, leaf) == -1)
+					return -1;
+			} else if(inode_state[i] & INODE_FREED) {
+				memset(table + (i - t * per_block) * FS_V2_INODE_SIZE, 0, FS_V2_INODE_SIZE);
+			}
+		}
+
+		/* the data goes first, so the table never names blocks not written yet */
+		if(sync_flush() == -1 || ata_write((image_inode_start + t) * (KB4 / ATA_SECTOR), &table, 1) != 0)
+			return -1;
+	}
+
+	if((block = image_block(0)) == NULL)
+		return -1;
+	memcpy(table, block, KB4);
+	((fs_super_t*)table)->num_blocks = sync_end;
+	return ata_write(0, &table, 1);
+}
+
+/* fs_sync()
+ * INPUTS:			none
+ * RETURN VALUE:	0 on success; -1 if the file system is not a v2 image on
+ *					disk, a file unlinked while open is still open, a file was
+ *					created past the end of the inode table, or the disk is
+ *					full or failed
+ * PURPOSE:			Writes everything written since the image was mounted to
+ *					the disk, which is then mounted again with nothing in the
+ *					overlay; open files stay open. A v1 image cannot grow its
+ *					inodes, as the data follows them. The disk is not kept
+ *					consistent should the machine stop halfway.
+ */
+int32_t fs_sync ()
+{
+	static uint8_t opens[FS_MAX_INODES];
+	uint32_t* list = (uint32_t*)alloc_frame();
+	uint8_t* leaf = (uint8_t*)alloc_frame();
+	uint8_t* table = (uint8_t*)alloc_frame();
+	uint32_t frames = (fs_info.num_data_blocks + SYNC_MAP_BITS - 1) / SYNC_MAP_BITS;
+	uint32_t i;
+	int32_t ret = -1;
+
+	if(fs_info.filesys_ptr == NULL && image_cached && fs_info.version == FS_V2_VERSION &&
+	   fs_info.num_inodes != 0 && frames <= FS_SYNC_MAP_FRAMES)
+		ret = 0;
+	for(i = 0; i < FS_MAX_INODES; i++) {
+		if((inode_state[i] & INODE_ORPHAN) || (i >= fs_info.num_inodes &&
+		   (overlay_inodes[i] != NULL || (inode_state[i] & INODE_CREATED))))
+			ret = -1;
+	}
+	for(i = 0; i < FS_SYNC_MAP_FRAMES; i++) {
+		sync_map[i] = (ret == 0 && i < frames) ? (uint32_t*)alloc_frame() : NULL;
+		if(sync_map[i] != NULL)
+			memset(sync_map[i], 0, KB4);
+		else if(i < frames)
+			ret = -1;
+	}
+
+	if(ret == 0 && list != NULL && leaf != NULL && table != NULL)
+		ret = sync_image(list, leaf, table);
+	else
+		ret = -1;
+
+	for(i = 0; i < FS_SYNC_MAP_FRAMES; i++)
+		if(sync_map[i] != NULL)
+			free_frame((uint32_t)sync_map[i]);
+	if(list != NULL)
+		free_frame((uint32_t)list);
+	if(leaf != NULL)
+		free_frame((uint32_t)leaf);
+	if(table != NULL)
+		free_frame((uint32_t)table);
+	if(ret == -1)
+		return -1;
+
+	/* the cache holds the blocks as they were; the descriptors stay open */
+	memcpy(opens, inode_opens, FS_MAX_INODES);
+	if(fscache_init_disk(ata_blocks()) != 0)
+		return -1;
+	filesys_load();
+	memcpy(inode_opens, opens, FS_MAX_INODES);
+	return 0;
+}
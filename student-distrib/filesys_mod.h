@@ -22,6 +22,27 @@
 #define KB4 4096
 #define MAX_DBLOCKS_PER_FILE 1023
 #define MAX_DENTRIES 63
+#define DENTRY_HASH_SIZE 128		/* name index slots: a power of two, at least twice MAX_DENTRIES */
+#define FS_MAX_INODES 1024			/* inode numbers the overlay can hand out */
+#define FS_OVERLAY_BLOCKS 4096		/* data blocks written since boot (16 MB) */
+#define FS_NO_BLOCK 0xFFFFFFFF
+#define FS_PATH_MAX 1024			/* bytes of a path the lookup looks at */
+#define FS_SYNC_MAP_FRAMES 32		/* used block bitmap of fs_sync: images up to 4 GB */
+#define FILE_TYPE_RTC 0
+#define FILE_TYPE_DIRECTORY 1
+#define FILE_TYPE_REGULAR 2
+
+/* format v2: block 0 is a superblock starting with FS_V2_MAGIC ("QFS2"),
+ * which a v1 directory entry count can never be. Inodes describe their data
+ * as extents; directories are files of sorted 64-byte v1 style entries. */
+#define FS_V2_MAGIC 0x32534651
+#define FS_V2_VERSION 2
+#define FS_V2_INODE_SIZE 128
+#define FS_V2_ROOT_INODE 1			/* inode 0 is reserved; rtc entries name it */
+#define EXT_MAGIC 0xE47E
+#define EXT_INLINE 8				/* extents held in the inode itself */
+#define EXT_PER_BLOCK 340			/* (KB4 - header) / extent: entries of a tree block */
+#define EXT_MAX_DEPTH 4
 
 /* AW directory entry struct */
 typedef struct dentry {
@@ -41,6 +62,8 @@ typedef struct boot_block {
 	uint8_t* dir_entries[MAX_DENTRIES];	/* static array of pointers to directory entries in the file system */
 	uint32_t* inode_blocks;				/* pointer to first 4-byte long in first inode block */
 	uint8_t* data_blocks;				/* pointer to first byte in first data block */
+	uint32_t version;					/* 1 for the flat format, FS_V2_VERSION */
+	uint32_t root_inode;				/* v2: inode of the root directory */
 } boot_block_t;
 
 extern boot_block_t fs_info;			/* global struct to collect data from boot block */
@@ -51,18 +74,84 @@ typedef struct index_node {
 	uint32_t dblock_numbers[MAX_DBLOCKS_PER_FILE];	/* array of data block numbers that correspond to this file */
 } inode_t;
 
+/* v2 superblock, block 0 of the image */
+typedef struct fs_super {
+	uint32_t magic;					/* FS_V2_MAGIC */
+	uint32_t version;				/* FS_V2_VERSION */
+	uint32_t block_size;			/* KB4 */
+	uint32_t num_blocks;			/* blocks in the image, superblock included */
+	uint32_t num_inodes;			/* inodes in the table */
+	uint32_t inode_start;			/* first block of the inode table */
+	uint32_t root_inode;			/* FS_V2_ROOT_INODE */
+} fs_super_t;
+
+/* head of an extent tree node: the inode's root or a whole tree block */
+typedef struct extent_header {
+	uint16_t magic;					/* EXT_MAGIC */
+	uint16_t entries;				/* entries in use */
+	uint16_t max;					/* entries the node has room for */
+	uint16_t depth;					/* 0 for a leaf of extents, else index levels below */
+} extent_header_t;
+
+/* a leaf entry maps count file blocks from logical on to image blocks from
+ * start on; an index entry names in start the tree block covering file blocks
+ * from logical up to the next entry's, and count is unused */
+typedef struct extent {
+	uint32_t logical;
+	uint32_t start;
+	uint32_t count;
+} extent_t;
+
+/* v2 inode, FS_V2_INODE_SIZE bytes */
+typedef struct inode_v2 {
+	uint32_t type;					/* 0 while free, else FILE_TYPE_DIRECTORY or FILE_TYPE_REGULAR */
+	uint32_t file_length;			/* length of file in bytes */
+	uint32_t num_blocks;			/* data blocks, tree blocks not counted */
+	uint32_t reserved;
+	extent_header_t root;
+	extent_t extents[EXT_INLINE];
+	uint32_t reserved2[2];
+} inode_v2_t;
+
+/* record getdents fills for a directory entry; mirrored in ece391syscall.h */
+typedef struct dirent {
+	uint32_t inode;					/* index node number */
+	uint32_t size;					/* length of the file in bytes */
+	uint32_t type;					/* FILE_TYPE_RTC, FILE_TYPE_DIRECTORY or FILE_TYPE_REGULAR */
+	char name[FNAME_LENGTH + 1];	/* NUL terminated */
+	uint8_t reserved[3];
+} dirent_t;
+
+/* what stat and fstat report about a file; mirrored in ece391syscall.h */
+typedef struct fs_stat {
+	uint32_t inode;					/* index node number */
+	uint32_t size;					/* length of the file in bytes */
+	uint32_t type;					/* FILE_TYPE_RTC, FILE_TYPE_DIRECTORY or FILE_TYPE_REGULAR */
+	uint32_t blocks;				/* 4 kB data blocks holding it */
+} fs_stat_t;
+
+/* position of an open file as a data block index and an offset inside it */
+typedef struct file_cursor {
+	uint32_t block;					/* block index inside the file */
+	uint32_t offset;				/* byte within that block */
+} file_cursor_t;
+
 /************ function declarations *************************/
 int32_t open_file();
 
 int32_t read_file(int32_t fd, void* buf, int32_t nbytes);
 
-int32_t write_file(uint8_t* fname, void* buf, int32_t nbytes);
+int32_t write_file(int32_t fd, const void* buf, int32_t nbytes);
 
 int32_t close_file();
 
 int32_t open_directory();
 
-int32_t read_directory(uint8_t* fname, void* buf, int32_t nbytes);
+int32_t read_directory(int32_t fd, void* buf, int32_t nbytes);
+
+int32_t read_dirents(int32_t fd, dirent_t* buf, uint32_t count);
+
+int32_t fs_stat(uint32_t type, uint32_t inode, fs_stat_t* st);
 
 int32_t write_directory(uint8_t* fname, void* buf, int32_t nbytes);
 
@@ -70,6 +159,8 @@ int32_t close_directory();
 
 void filesys_init(uint32_t* file_sys_start);	/* function to gather info from boot block into global struct */
 
+int32_t filesys_init_disk();					/* the same for an image on the ATA disk */
+
 /* AW helper functions from spec */
 int32_t read_dentry_by_name (const uint8_t* fname, dentry_t* dentry);
 
@@ -77,7 +168,33 @@ int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry);
 
 int32_t read_data (uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
 
-inode_t * inode_address (uint32_t inode);
+int32_t read_cursor (uint32_t inode, uint32_t file_pos, file_cursor_t* cursor, uint8_t* buf, uint32_t length);
+
+int32_t fs_map (uint32_t inode, uint32_t offset, uint32_t length, uint8_t** data);
+
+int32_t inode_length (uint32_t inode, uint32_t* length);
+
+uint32_t inode_block (uint32_t inode, uint32_t index);
+
+uint8_t* fs_block (uint32_t block);
+
+uint8_t* fs_block_shared (uint32_t block);
+
+/* writable overlay on top of the boot image */
+int32_t write_cursor (uint32_t inode, uint32_t file_pos, file_cursor_t* cursor, const uint8_t* buf, uint32_t length);
+
+int32_t fs_create (const uint8_t* fname);
+
+int32_t fs_unlink (const uint8_t* fname);
+
+int32_t fs_truncate (uint32_t inode, uint32_t length);
+
+void fs_inode_open (uint32_t inode);
+
+void fs_inode_close (uint32_t inode);
+
+/* writes the overlay back to a v2 image on disk */
+int32_t fs_sync ();
 
 
 
@@ -0,0 +1,291 @@
+/*	*********************************************************
+	# FILE NAME: fscache.c
+	# PURPOSE: LRU cache of file system image blocks that are not in memory as
+	#		   they are: blocks of a compressed image are decompressed into it,
+	#		   blocks of an image on disk read into it with DMA. filesys_mod.c
+	#		   reads every image block through it.
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#include "fscache.h"
+#include "filesys_mod.h"
+#include "lz4.h"
+#include "ata.h"
+#include "page.h"
+#include "lib.h"
+#include "syscalls.h"
+
+static const uint8_t* image;		/* the compressed module; NULL if it is not one */
+static const uint32_t* offsets;		/* num_blocks + 1 entries after the header */
+static uint32_t on_disk;			/* 1 if blocks are read from the ATA disk instead */
+static uint32_t num_blocks;
+
+static fscache_entry_t cache[FSCACHE_BLOCKS];
+static uint16_t bucket[FSCACHE_HASH];	/* first entry of each hash chain */
+static uint16_t lru_head;				/* most recently used */
+static uint16_t lru_tail;				/* next to be reused */
+
+/* statistics */
+static uint32_t hits;
+static uint32_t misses;
+
+/* void lru_unlink(uint16_t i)
+ * INPUT: i - entry to take out of the LRU list
+ * OUTPUT: none
+ */
+static void lru_unlink(uint16_t i)
+{
+	if(cache[i].prev != FSCACHE_NONE)
+		cache[cache[i].prev].next = cache[i].next;
+	else
+		lru_head = cache[i].next;
+	if(cache[i].next != FSCACHE_NONE)
+		cache[cache[i].next].prev = cache[i].prev;
+	else
+		lru_tail = cache[i].prev;
+}
+
+/* void lru_push(uint16_t i)
+ * INPUT: i - entry that is not on the LRU list
+ * OUTPUT: none
+ * DESCRIPTION: makes the entry the most recently used
+ */
+static void lru_push(uint16_t i)
+{
+	cache[i].prev = FSCACHE_NONE;
+	cache[i].next = lru_head;
+	if(lru_head != FSCACHE_NONE)
+		cache[lru_head].prev = i;
+	else
+		lru_tail = i;
+	lru_head = i;
+}
+
+/* void hash_remove(uint16_t i)
+ * INPUT: i - entry holding a block
+ * OUTPUT: none
+ */
+static void hash_remove(uint16_t i)
+{
+	uint16_t* link = &bucket[cache[i].block & (FSCACHE_HASH - 1)];
+
+	while(*link != i)
+		link = &cache[*link].chain;
+	*link = cache[i].chain;
+}
+
+/* uint16_t cache_find(uint32_t block)
+ * INPUT: block - image block
+ * OUTPUT: the entry holding it, FSCACHE_NONE if none does
+ */
+static uint16_t cache_find(uint32_t block)
+{
+	uint16_t i;
+
+	for(i = bucket[block & (FSCACHE_HASH - 1)]; i != FSCACHE_NONE; i = cache[i].chain) {
+		if(cache[i].block == block)
+			return i;
+	}
+	return FSCACHE_NONE;
+}
+
+/* uint16_t cache_take(void)
+ * INPUT: none
+ * OUTPUT: the least recently used entry, emptied and off the LRU list
+ */
+static uint16_t cache_take(void)
+{
+	uint16_t i = lru_tail;
+
+	lru_unlink(i);
+	if(cache[i].block != FS_NO_BLOCK)
+		hash_remove(i);
+	cache[i].block = FS_NO_BLOCK;
+	return i;
+}
+
+/* void cache_insert(uint16_t i, uint32_t block)
+ * INPUT: i - entry from cache_take, now holding the block
+ *		  block - image block
+ * OUTPUT: none
+ * DESCRIPTION: makes it findable and the most recently used
+ */
+static void cache_insert(uint16_t i, uint32_t block)
+{
+	cache[i].block = block;
+	cache[i].chain = bucket[block & (FSCACHE_HASH - 1)];
+	bucket[block & (FSCACHE_HASH - 1)] = i;
+	lru_push(i);
+}
+
+/* int32_t cache_reset(void)
+ * INPUT: none
+ * OUTPUT: SUCCESS, or FAIL if there are no frames to cache in
+ * DESCRIPTION: empties the cache and takes its frames on first use
+ */
+static int32_t cache_reset(void)
+{
+	uint32_t i;
+
+	hits = 0;
+	misses = 0;
+	lru_head = FSCACHE_NONE;
+	lru_tail = FSCACHE_NONE;
+	for(i = 0; i < FSCACHE_HASH; i++)
+		bucket[i] = FSCACHE_NONE;
+	for(i = 0; i < FSCACHE_BLOCKS; i++) {
+		if(cache[i].data == NULL)
+			cache[i].data = (uint8_t*)alloc_frame();
+		cache[i].block = FS_NO_BLOCK;
+		cache[i].chain = FSCACHE_NONE;
+		if(cache[i].data != NULL)
+			lru_push(i);
+	}
+
+	return (lru_head != FSCACHE_NONE) ? SUCCESS : FAIL;
+}
+
+/* int32_t fscache_init(const uint32_t* module)
+ * INPUT: module - start of the file system module
+ * OUTPUT: SUCCESS if it is a compressed image, FAIL otherwise
+ * DESCRIPTION: empties the cache. A compressed image whose header or offset
+ *				table does not add up reads as having no blocks.
+ */
+int32_t fscache_init(const uint32_t* module)
+{
+	const fsz_header_t* header = (const fsz_header_t*)module;
+	uint32_t i;
+
+	image = NULL;
+	on_disk = 0;
+	if(header->magic != FSZ_MAGIC)
+		return FAIL;
+
+	image = (const uint8_t*)module;
+	offsets = (const uint32_t*)(header + 1);
+	num_blocks = header->num_blocks;
+
+	if(header->version != FSZ_VERSION || header->block_size != KB4 ||
+	   offsets[0] != sizeof(fsz_header_t) + (num_blocks + 1) * sizeof(uint32_t))
+		num_blocks = 0;
+	for(i = 0; i < num_blocks; i++) {
+		if(offsets[i + 1] < offsets[i] || offsets[i + 1] - offsets[i] > KB4)
+			num_blocks = 0;
+	}
+
+	if(cache_reset() == FAIL)
+		num_blocks = 0;
+
+	return SUCCESS;
+}
+
+/* int32_t fscache_init_disk(uint32_t blocks)
+ * INPUT: blocks - size of the ATA disk in 4 kB blocks
+ * OUTPUT: SUCCESS, or FAIL if there are no frames to cache in
+ * DESCRIPTION: serves the image from the disk, block i at sector 8 * i
+ */
+int32_t fscache_init_disk(uint32_t blocks)
+{
+	image = NULL;
+	on_disk = 1;
+	num_blocks = blocks;
+
+	if(cache_reset() == FAIL) {
+		on_disk = 0;
+		return FAIL;
+	}
+	return SUCCESS;
+}
+
+/* uint8_t* disk_fill(uint32_t block)
+ * INPUT: block - image block that missed
+ * OUTPUT: the block, NULL if the disk could not read it
+ * DESCRIPTION: reads it and up to FSCACHE_READAHEAD - 1 blocks after it
+ *				that are not cached yet in one transfer, a PRD entry per
+ *				entry's frame, as files are mostly read front to back
+ */
+static uint8_t* disk_fill(uint32_t block)
+{
+	uint16_t taken[FSCACHE_READAHEAD];
+	uint8_t* pages[FSCACHE_READAHEAD];
+	uint32_t n, i;
+
+	for(n = 0; n < FSCACHE_READAHEAD && block + n < num_blocks && lru_tail != FSCACHE_NONE; n++) {
+		if(n > 0 && cache_find(block + n) != FSCACHE_NONE)
+			break;
+		taken[n] = cache_take();
+		pages[n] = cache[taken[n]].data;
+	}
+	if(n == 0)			/* past the image, or no entry to read into */
+		return NULL;
+
+	if(ata_read(block * (KB4 / ATA_SECTOR), pages, n) == FAIL) {
+		for(i = 0; i < n; i++)
+			lru_push(taken[i]);
+		return NULL;
+	}
+
+	/* the block asked for ends up the most recently used */
+	for(i = n; i-- > 0; )
+		cache_insert(taken[i], block + i);
+	return cache[taken[0]].data;
+}
+
+/* uint8_t* fscache_block(uint32_t block)
+ * INPUT: block - block number of the image (before compression)
+ * OUTPUT: the block, NULL if there is no such block, it is corrupt or the
+ *		   disk failed
+ * DESCRIPTION: a miss fills the least recently used entries, at most
+ *				FSCACHE_READAHEAD of them, so the address is only good until
+ *				FSCACHE_BLOCKS / FSCACHE_READAHEAD more misses; callers copy
+ *				out right away
+ */
+uint8_t* fscache_block(uint32_t block)
+{
+	uint16_t i;
+	uint32_t len;
+
+	if((image == NULL && !on_disk) || block >= num_blocks)
+		return NULL;
+
+	if((i = cache_find(block)) != FSCACHE_NONE) {
+		hits++;
+		lru_unlink(i);
+		lru_push(i);
+		return cache[i].data;
+	}
+
+	misses++;
+	if(on_disk)
+		return disk_fill(block);
+
+	i = cache_take();
+	len = offsets[block + 1] - offsets[block];
+	if(len == KB4)
+		memcpy(cache[i].data, image + offsets[block], KB4);
+	else if(lz4_decompress(image + offsets[block], len, cache[i].data, KB4) != KB4) {
+		lru_push(i);
+		return NULL;
+	}
+
+	cache_insert(i, block);
+	return cache[i].data;
+}
+
+/* uint32_t fscache_hits(void)
+ * INPUT: none
+ * OUTPUT: block reads the cache answered since the image was set up
+ */
+uint32_t fscache_hits(void)
+{
+	return hits;
+}
+
+/* uint32_t fscache_misses(void)
+ * INPUT: none
+ * OUTPUT: block reads that had to decompress or go to the disk since the
+ *		   image was set up
+ */
+uint32_t fscache_misses(void)
+{
+	return misses;
+}
@@ -0,0 +1,50 @@
+/*	*********************************************************
+	# FILE NAME: fscache.h
+	# PURPOSE: header for fscache.c, reading a compressed file system image,
+	#		   or one on disk, through a cache of its blocks
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#ifndef _FSCACHE_H
+#define _FSCACHE_H
+
+#include "types.h"
+
+#define FSZ_MAGIC			0x5A534651	/* "QFSZ" at the start of a compressed image */
+#define FSZ_VERSION			1
+#define FSCACHE_BLOCKS		64			/* blocks kept (256 kB) */
+#define FSCACHE_HASH		128			/* lookup buckets, a power of two */
+#define FSCACHE_NONE		0xFFFF		/* no entry: end of a list, or an empty slot */
+#define FSCACHE_READAHEAD	8			/* disk blocks read per miss (32 kB), at most ATA_MAX_PAGES */
+
+/* a compressed image starts with this header, then num_blocks + 1 byte
+ * offsets from the start of the image: block i is the bytes from offsets[i]
+ * up to offsets[i + 1], LZ4 compressed unless there are exactly 4 kB of them */
+typedef struct fsz_header {
+	uint32_t magic;					/* FSZ_MAGIC */
+	uint32_t version;				/* FSZ_VERSION */
+	uint32_t block_size;			/* 4 kB */
+	uint32_t num_blocks;			/* blocks of the image before compression */
+} fsz_header_t;
+
+/* one cached block */
+typedef struct fscache_entry {
+	uint32_t block;					/* image block held; FS_NO_BLOCK while empty */
+	uint8_t* data;					/* a kernel frame */
+	uint16_t prev, next;			/* LRU list, most recently used first */
+	uint16_t chain;					/* next entry in the same bucket */
+} fscache_entry_t;
+
+/* set up for an image; FAIL if it is not a compressed one */
+int32_t fscache_init(const uint32_t* image);
+
+/* set up for an image on the ATA disk; FAIL without frames */
+int32_t fscache_init_disk(uint32_t blocks);
+
+/* block of the image before compression; valid until the next miss */
+uint8_t* fscache_block(uint32_t block);
+
+/* statistics */
+uint32_t fscache_hits(void);
+uint32_t fscache_misses(void);
+
+#endif /* _FSCACHE_H */
@@ -14,6 +14,9 @@
 #include "keyboard.h"
 #include "syscalls.h"
 #include "sched.h"
+#include "elf.h"
+#include "ksm.h"
+#include "ata.h"
 
 
 
@@ -120,14 +123,44 @@ void idt_set_vector(uint8_t vec, uint32_t dpl, void* handler_address)
 /* idt_handler(registers_t regs)
  * INPUT: regs - contains register values, flags, pushed error code, and the interrupt number
  * OUTPUT: none
- * DESCRIPTION: prints the error code and the interrupt number to the screen
- * 				spins for fatal errors to indicate that the kernel should restart
+ * DESCRIPTION: services page faults the memory manager can resolve. Any other
+ *				exception raised by a user program, or a fault on a user address
+ *				during a system call, kills that program and its parent's execute
+ *				returns EXCEPTION_STATUS. Exceptions in the kernel itself print the
+ *				error code and the interrupt number and spin.
  */
 void idt_handler(registers_t regs)
 {
 	uint32_t flags;
+	uint32_t fault_addr = 0;
 	cli_and_save(flags);
 
+	/* a not-present fault inside the running program is serviced from zram, by the
+	 * demand loader or with a zeroed stack or heap page, a write to a shared page by copy-on-write;
+	 * returning retries the faulting instruction */
+	if(regs.int_num == PAGE_FAULT) {
+		asm volatile("movl %%cr2, %0" : "=r"(fault_addr));
+		if(regs.error_code & PF_PROTECTION) {
+			if(user_cow_fault(process_count, fault_addr) == SUCCESS) {
+				restore_flags(flags);
+				return;
+			}
+		} else if(user_swap_fault(process_count, fault_addr) == SUCCESS || elf_page_fault(fault_addr) == SUCCESS ||
+				  user_zero_fault(process_count, fault_addr) == SUCCESS) {
+			restore_flags(flags);
+			return;
+		}
+	}
+
+	/* only the faulting program dies, not the machine */
+	if(process_count > 0 &&
+	   (regs.cs == USER_CS ||
+	    (regs.int_num == PAGE_FAULT && fault_addr >= TOP_PAGE && fault_addr < USER_END))) {
+		printf("%s at 0x%x, killing process %d\n",
+			   (regs.int_num < SUPPORTED_INT) ? int_desc[regs.int_num] : "exception", regs.eip, process_count);
+		process_exit(EXCEPTION_STATUS);
+	}
+
 	//clear();
 	if (regs.int_num < SUPPORTED_INT) {
 		printf("Error Code: %d\n", regs.error_code);
@@ -165,6 +198,10 @@ void pic_handler(registers_t regs)
 		case IRQ_8:
 			rtc_handler();
 			break;
+		case IRQ_14:
+		case IRQ_15:
+			ata_handler(regs.int_num);
+			break;
 		default:
 			break; 
 	}
@@ -200,5 +237,7 @@ void pit_handler(registers_t regs)
 
 	//if(process_count >= NUM_TERMINALS)
 	//	change_task(regs);
+
+	ksm_tick();
 }
 
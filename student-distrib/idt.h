@@ -15,9 +15,14 @@
 #define IRQ_1 1
 #define IRQ_8 8
 #define IRQ_0 0
+#define IRQ_14 14
+#define IRQ_15 15
 
 #define SYSCALL 128
 
+#define PAGE_FAULT 14
+#define PF_PROTECTION 0x1	/* page fault error code bit: set for a protection violation, clear for not present */
+
 /* size of int desc array */
 #define SUPPORTED_INT 18
 
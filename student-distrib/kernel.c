@@ -16,12 +16,19 @@
 #include "pit.h"
 #include "keyboard.h"
 #include "sched.h"
+#include "buddy.h"
+#include "slab.h"
+#include "zram.h"
+#include "ata.h"
 
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
 #define CHECK_FLAG(flags,bit)   ((flags) & (1 << (bit)))
 
+#define MMAP_TYPE_USABLE	1			/* memory map entry type for free RAM */
+#define ADDR_1MB			0x100000	/* mem_upper counts from here */
+
 uint32_t process_count;
 
 
@@ -32,6 +39,8 @@ entry (unsigned long magic, unsigned long addr)
 {
 	multiboot_info_t* mbi;
 	uint32_t* file_sys_start;	/* AW pointer to starting address of file system */
+	uint32_t fs_mod_start = 0;	/* its physical range, from the multiboot module list */
+	uint32_t fs_mod_end = 0;
 
 	/* Clear the screen. */
 	clear();
@@ -43,8 +52,9 @@ entry (unsigned long magic, unsigned long addr)
 		return;
 	}
 
-	/* Set MBI to the address of the Multiboot information structure. */
-	mbi = (multiboot_info_t *) addr;
+	/* Set MBI to the address of the Multiboot information structure. GRUB hands
+	 * out physical addresses; we reach them through the direct map. */
+	mbi = (multiboot_info_t *) __va(addr);
 
 	/* Print out the flags. */
 	printf ("flags = 0x%#x\n", (unsigned) mbi->flags);
@@ -60,23 +70,25 @@ entry (unsigned long magic, unsigned long addr)
 
 	/* Is the command line passed? */
 	if (CHECK_FLAG (mbi->flags, 2))
-		printf ("cmdline = %s\n", (char *) mbi->cmdline);
+		printf ("cmdline = %s\n", (char *) __va(mbi->cmdline));
 
 	if (CHECK_FLAG (mbi->flags, 3)) {
 		int mod_count = 0;
 		int i;
-		module_t* mod = (module_t*)mbi->mods_addr;
+		module_t* mod = (module_t*)__va(mbi->mods_addr);
 
-		file_sys_start = (uint32_t*)(mod->mod_start);	/* AW get starting address of file system */
+		fs_mod_start = mod->mod_start;		/* AW the first module is the file system */
+		fs_mod_end = mod->mod_end;
 
 		while(mod_count < mbi->mods_count) {
 			printf("Module %d loaded at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_start);
 			printf("Module %d ends at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_end);
 			printf("First few bytes of module:\n");
 			for(i = 0; i<16; i++) {
-				printf("0x%x ", *((char*)(mod->mod_start+i)));
+				printf("0x%x ", *((char*)__va(mod->mod_start+i)));
 			}
 			printf("\n");
+			buddy_reserve(mod->mod_start, mod->mod_end);	/* keep the allocator off the module */
 			mod_count++;
 			mod++;
 		}
@@ -106,10 +118,10 @@ entry (unsigned long magic, unsigned long addr)
 
 		printf ("mmap_addr = 0x%#x, mmap_length = 0x%x\n",
 				(unsigned) mbi->mmap_addr, (unsigned) mbi->mmap_length);
-		for (mmap = (memory_map_t *) mbi->mmap_addr;
-				(unsigned long) mmap < mbi->mmap_addr + mbi->mmap_length;
+		for (mmap = (memory_map_t *) __va(mbi->mmap_addr);
+				(unsigned long) mmap < (unsigned long) __va(mbi->mmap_addr + mbi->mmap_length);
 				mmap = (memory_map_t *) ((unsigned long) mmap
-					+ mmap->size + sizeof (mmap->size)))
+					+ mmap->size + sizeof (mmap->size))) {
 			printf (" size = 0x%x,     base_addr = 0x%#x%#x\n"
 					"     type = 0x%x,  length    = 0x%#x%#x\n",
 					(unsigned) mmap->size,
@@ -118,7 +130,19 @@ entry (unsigned long magic, unsigned long addr)
 					(unsigned) mmap->type,
 					(unsigned) mmap->length_high,
 					(unsigned) mmap->length_low);
+
+			/* free RAM below 4 GB feeds the physical page allocator */
+			if (mmap->type == MMAP_TYPE_USABLE && mmap->base_addr_high == 0)
+				buddy_add_region(mmap->base_addr_low,
+						(mmap->length_high != 0) ? -mmap->base_addr_low : mmap->length_low);
+		}
 	}
+	else if (CHECK_FLAG (mbi->flags, 0))
+	{
+		/* no memory map: everything above 1 MB is usable */
+		buddy_add_region(ADDR_1MB, mbi->mem_upper * 1024);
+	}
+	printf ("physical pages: %u free of %u\n", buddy_free_pages(), buddy_total_pages());
 
 	/* Construct an LDT entry in the GDT */
 	{
@@ -157,7 +181,7 @@ entry (unsigned long magic, unsigned long addr)
 
 		tss.ldt_segment_selector = KERNEL_LDT;
 		tss.ss0 = KERNEL_DS;
-		tss.esp0 = 0x800000;
+		tss.esp0 = KERNEL_VBASE + 0x800000;
 		ltr(KERNEL_TSS);
 	}
 
@@ -192,9 +216,19 @@ entry (unsigned long magic, unsigned long addr)
 	/* initialize paging */
 	init_page();
 
-	/* initialize the file system */
+	/* initialize the kernel heap and the compressed page store */
+	kmem_init();
+	zram_init();
+
+	/* map the file system image into its own window and initialize it */
+	file_sys_start = (uint32_t*)map_fs_image(fs_mod_start, fs_mod_end);
 	filesys_init(file_sys_start);
 
+	/* an image on the first ATA disk takes the module's place; it is read
+	 * with DMA, polled until interrupts are enabled below */
+	if(ata_init() == 0 && filesys_init_disk() == 0)
+		printf("File system mounted from disk\n");
+
 	/* initialize process queue */
 	pq_init();
 
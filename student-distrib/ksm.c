@@ -0,0 +1,202 @@
+/*	*********************************************************
+	# FILE NAME: ksm.c
+	# PURPOSE: same-page merging: the hash table of known pages and the timing
+	#		   of merge passes; the page table walk is user_merge in syscalls.c
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#include "ksm.h"
+#include "page.h"
+#include "lib.h"
+#include "syscalls.h"
+
+#define FNV_OFFSET		2166136261U
+#define FNV_PRIME		16777619U
+
+static ksm_entry_t table[KSM_ENTRIES];
+
+static uint32_t ksm_on = 1;			/* merge passes run */
+static uint32_t ticks;				/* pit ticks since the last pass was due */
+static volatile uint32_t pass_due;	/* set by the pit, cleared by the pass */
+
+/* uint32_t ksm_hash(uint32_t frame)
+ * INPUT: frame - kernel address of a 4 kB page
+ * OUTPUT: FNV-1a hash of the page, a word at a time
+ */
+uint32_t ksm_hash(uint32_t frame)
+{
+	uint32_t* words = (uint32_t*)frame;
+	uint32_t hash = FNV_OFFSET;
+	uint32_t i;
+
+	for(i = 0; i < BYTES_4KB / sizeof(uint32_t); i++)
+		hash = (hash ^ words[i]) * FNV_PRIME;
+
+	return hash;
+}
+
+/* uint32_t pages_equal(uint32_t a, uint32_t b)
+ * INPUT: a, b - kernel addresses of 4 kB pages
+ * OUTPUT: 1 if they hold the same bytes, 0 otherwise
+ */
+static uint32_t pages_equal(uint32_t a, uint32_t b)
+{
+	uint32_t i;
+
+	for(i = 0; i < BYTES_4KB / sizeof(uint32_t); i++)
+		if(((uint32_t*)a)[i] != ((uint32_t*)b)[i])
+			return 0;
+
+	return 1;
+}
+
+/* ksm_entry_t* ksm_lookup(uint32_t hash, uint32_t frame)
+ * INPUT: hash - ksm_hash(frame)
+ *		  frame - page being looked up
+ * OUTPUT: an entry holding the same contents (possibly frame itself), NULL if
+ *		   there is none
+ * DESCRIPTION: contents are compared byte for byte, so a hash collision or a
+ *				candidate written since it was recorded never matches. Stable
+ *				frames that only the table still holds are dropped on the way.
+ */
+ksm_entry_t* ksm_lookup(uint32_t hash, uint32_t frame)
+{
+	ksm_entry_t* entry;
+	uint32_t i;
+
+	for(i = 0; i < KSM_PROBE; i++) {
+		entry = &table[(hash + i) & (KSM_ENTRIES - 1)];
+		if(entry->frame == 0)
+			continue;
+		if(entry->pid == 0 && frame_ref_count(entry->frame) == 1) {
+			ksm_remove(entry);
+			continue;
+		}
+		if(entry->hash == hash && (entry->frame == frame || pages_equal(entry->frame, frame)))
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* void ksm_insert(uint32_t hash, uint32_t frame, uint32_t pid, uint32_t vaddr)
+ * INPUT: hash - ksm_hash(frame)
+ *		  frame - private page to record
+ *		  pid, vaddr - where it is mapped
+ * OUTPUT: none
+ * DESCRIPTION: records a candidate in the first free slot of its probe window.
+ *				A full window gives up its first candidate, or failing that its
+ *				home slot, so the table never grows.
+ */
+void ksm_insert(uint32_t hash, uint32_t frame, uint32_t pid, uint32_t vaddr)
+{
+	ksm_entry_t* entry;
+	ksm_entry_t* victim = NULL;
+	uint32_t i;
+
+	for(i = 0; i < KSM_PROBE; i++) {
+		entry = &table[(hash + i) & (KSM_ENTRIES - 1)];
+		if(entry->frame == 0) {
+			victim = entry;
+			break;
+		}
+		if(victim == NULL && entry->pid != 0)
+			victim = entry;
+	}
+	if(victim == NULL)
+		victim = &table[hash & (KSM_ENTRIES - 1)];
+
+	ksm_remove(victim);
+	victim->frame = frame;
+	victim->hash = hash;
+	victim->pid = pid;
+	victim->vaddr = vaddr;
+}
+
+/* void ksm_remove(ksm_entry_t* entry)
+ * INPUT: entry - slot to clear
+ * OUTPUT: none
+ * DESCRIPTION: a stable entry gives back the table's reference on its frame
+ */
+void ksm_remove(ksm_entry_t* entry)
+{
+	if(entry->frame != 0 && entry->pid == 0)
+		free_frame(entry->frame);
+	entry->frame = 0;
+}
+
+/* void ksm_make_stable(ksm_entry_t* entry)
+ * INPUT: entry - candidate whose mapping the caller has write-protected
+ * OUTPUT: none
+ * DESCRIPTION: the table takes a reference so the frame stays shared, and hence
+ *				unchanged, for as long as it is listed
+ */
+void ksm_make_stable(ksm_entry_t* entry)
+{
+	get_frame(entry->frame);
+	entry->pid = 0;
+}
+
+/* void ksm_tick(void)
+ * INPUT: none
+ * OUTPUT: none
+ * DESCRIPTION: called from the pit handler; marks a pass due every KSM_INTERVAL
+ *				ticks. The pass itself cannot run in the interrupt, which may
+ *				have landed in the middle of a page table or allocator update.
+ */
+void ksm_tick(void)
+{
+	if(++ticks >= KSM_INTERVAL) {
+		ticks = 0;
+		pass_due = 1;
+	}
+}
+
+/* void ksm_idle(void)
+ * INPUT: none
+ * OUTPUT: none
+ * DESCRIPTION: called from loops that wait on a device; runs a due merge pass
+ *				of KSM_BATCH pages while the machine would otherwise spin
+ */
+void ksm_idle(void)
+{
+	if(pass_due && ksm_on) {
+		pass_due = 0;
+		user_merge(KSM_BATCH);
+	}
+}
+
+/* int32_t ksm_enable(int32_t enable)
+ * INPUT: enable - 1 to run merge passes, 0 to stop them, -1 to only query
+ * OUTPUT: previous setting, or -1 for a bad value
+ * DESCRIPTION: pages merged already stay shared until written
+ */
+int32_t ksm_enable(int32_t enable)
+{
+	int32_t old = ksm_on;
+
+	if(enable == -1)
+		return old;
+	if(enable != 0 && enable != 1)
+		return -1;
+
+	ksm_on = enable;
+	return old;
+}
+
+/* int32_t ksm_pages_saved(void)
+ * INPUT: none
+ * OUTPUT: frames freed by merging that are still saved
+ * DESCRIPTION: every mapping of a stable frame past the first is a page saved;
+ *				the table's own reference is not a mapping
+ */
+int32_t ksm_pages_saved(void)
+{
+	int32_t saved = 0;
+	uint32_t i;
+
+	for(i = 0; i < KSM_ENTRIES; i++)
+		if(table[i].frame != 0 && table[i].pid == 0)
+			saved += frame_ref_count(table[i].frame) - 2;
+
+	return saved;
+}
@@ -0,0 +1,43 @@
+/*	*********************************************************
+	# FILE NAME: ksm.h
+	# PURPOSE: header for ksm.c, the table behind same-page merging of user
+	#		   pages
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#ifndef _KSM_H
+#define _KSM_H
+
+#include "types.h"
+
+#define KSM_ENTRIES			1024		/* table slots, a power of two */
+#define KSM_PROBE			8			/* slots looked at per hash */
+#define KSM_INTERVAL		19			/* pit ticks between merge passes (about 1 s) */
+#define KSM_BATCH			64			/* pages hashed per pass */
+#define KSM_SCAN_MAX		4096		/* page table entries the clock looks at per pass */
+
+/* one page the merger knows about. A candidate is a private page seen once,
+ * named by its owner; a stable entry is a shared read-only frame that the
+ * table holds a reference on. */
+typedef struct ksm_entry {
+	uint32_t frame;				/* kernel address; 0 while the slot is free */
+	uint32_t hash;				/* ksm_hash of the contents when recorded */
+	uint32_t pid;				/* candidate owner; 0 once stable */
+	uint32_t vaddr;				/* where the owner maps the candidate */
+} ksm_entry_t;
+
+/* the table; frames are kernel addresses */
+uint32_t ksm_hash(uint32_t frame);
+ksm_entry_t* ksm_lookup(uint32_t hash, uint32_t frame);
+void ksm_insert(uint32_t hash, uint32_t frame, uint32_t pid, uint32_t vaddr);
+void ksm_remove(ksm_entry_t* entry);
+void ksm_make_stable(ksm_entry_t* entry);
+
+/* background merging: ticks from the pit, passes from idle loops */
+void ksm_tick(void);
+void ksm_idle(void);
+int32_t ksm_enable(int32_t enable);
+
+/* statistics */
+int32_t ksm_pages_saved(void);
+
+#endif /* _KSM_H */
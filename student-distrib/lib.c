@@ -3,7 +3,9 @@
  */
 
 #include "lib.h"
-#define VIDEO 0xB8000
+#include "x86_desc.h"
+#include "syscalls.h"
+#define VIDEO (KERNEL_VBASE + 0xB8000)	/* video memory through the kernel's direct map */
 #define NUM_COLS 80
 #define NUM_ROWS 25
 #define ATTRIB 0x7
@@ -575,6 +577,51 @@ strncpy(int8_t* dest, const int8_t* src, uint32_t n)
 	return dest;
 }
 
+/*
+* int32_t bad_userspace_addr(const void* addr, int32_t len)
+*   Inputs: const void* addr = start of a buffer a system call was handed
+*			int32_t len = its length in bytes
+*   Return Value: 1 unless all of it is user memory, [TOP_PAGE, USER_END); 0 if it is
+*	Function: lets a system call refuse a pointer into the kernel before writing
+*			  through it. Whether the pages are mapped is left to the page fault handler.
+*/
+
+int32_t
+bad_userspace_addr(const void* addr, int32_t len)
+{
+	uint32_t start = (uint32_t)addr;
+
+	if(len < 0 || start < TOP_PAGE || start >= USER_END)
+		return 1;
+	return (uint32_t)len > USER_END - start;
+}
+
+/*
+* int32_t safe_strncpy(int8_t* dest, const int8_t* src, int32_t n)
+*   Inputs: int8_t* dest = kernel buffer of n bytes
+*			const int8_t* src = string a system call was handed
+*			int32_t n = most bytes to copy, the terminating null included
+*   Return Value: length of the string copied, or -1 if a byte of it is not user
+*				  memory or it has no null within n bytes
+*	Function: copies a name from user memory checking each byte's address first,
+*			  so a string running up to USER_END is never read past it
+*/
+
+int32_t
+safe_strncpy(int8_t* dest, const int8_t* src, int32_t n)
+{
+	int32_t i;
+
+	for(i = 0; i < n; i++) {
+		if(bad_userspace_addr(src + i, 1))
+			return -1;
+		dest[i] = src[i];
+		if(dest[i] == '\0')
+			return i;
+	}
+	return -1;
+}
+
 /*
 * void test_interrupts(void)
 *   Inputs: void
@@ -28,7 +28,9 @@ int8_t* strcpy(int8_t* dest, const int8_t*src);
 int8_t* strncpy(int8_t* dest, const int8_t*src, uint32_t n);
 void test_interrupts(void);
 
-/* Userspace address-check functions */
+/* Userspace address-check functions; bad_userspace_addr is 1 unless all of
+ * [addr, addr + len) lies in [TOP_PAGE, USER_END), safe_strncpy copies a
+ * string from there and is -1 if it leaves it or is not null terminated */
 int32_t bad_userspace_addr(const void* addr, int32_t len);
 int32_t safe_strncpy(int8_t* dest, const int8_t* src, int32_t n);
 
@@ -93,7 +95,7 @@ do {                                    \
 /* Writes four bytes to four consecutive ports */
 #define outl(data, port)                \
 do {                                    \
-	asm volatile("outl  %l1, (%w0)"     \
+	asm volatile("outl  %k1, (%w0)"     \
 			:                           \
 			: "d" (port), "a" (data)    \
 			: "memory", "cc" );         \
@@ -146,4 +148,16 @@ do {                                    \
 			);                      \
 } while(0)
 
+/* Read time stamp counter
+ * Puts the low 32 bits of the cycle counter into "lo".  Good for timing
+ * anything shorter than 2^32 cycles. */
+#define rdtsc_low(lo)                   \
+do {                                    \
+	asm volatile("rdtsc"                \
+			: "=a"(lo)              \
+			:                       \
+			: "edx"                 \
+			);                      \
+} while(0)
+
 #endif /* _LIB_H */
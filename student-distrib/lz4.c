@@ -0,0 +1,200 @@
+/*	*********************************************************
+	# FILE NAME: lz4.c
+	# PURPOSE: LZ4 block compressor and decompressor, used to keep user pages
+	#		   compressed in memory
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#include "lz4.h"
+#include "lib.h"
+#include "syscalls.h"
+
+#define TOKEN_MAX		15			/* a 4 bit length field; more follows in extra bytes */
+
+/* positions of recently seen 4 byte sequences. Inputs are at most 64 kB, so
+ * 16 bits are enough. Not reentrant: callers keep interrupts off. */
+static uint16_t hash_table[1 << LZ4_HASH_BITS];
+
+/* uint32_t read32(const uint8_t* p)
+ * INPUT: p - any address
+ * OUTPUT: the 4 bytes at p
+ */
+static uint32_t read32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* uint32_t hash4(uint32_t seq)
+ * INPUT: seq - 4 input bytes
+ * OUTPUT: index into hash_table (Knuth's multiplicative hash)
+ */
+static uint32_t hash4(uint32_t seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+/* uint32_t put_length(uint8_t* op, uint32_t len)
+ * INPUT: op - output position
+ *		  len - what is left of a length after the TOKEN_MAX in the token
+ * OUTPUT: bytes written
+ */
+static uint32_t put_length(uint8_t* op, uint32_t len)
+{
+	uint32_t n = 0;
+
+	while(len >= 255) {
+		op[n++] = 255;
+		len -= 255;
+	}
+	op[n++] = len;
+	return n;
+}
+
+/* int32_t emit(uint8_t* dst, uint32_t* op, uint32_t dst_cap, const uint8_t* lit,
+ *				uint32_t lit_len, uint32_t offset, uint32_t match_len)
+ * INPUT: dst, op, dst_cap - output buffer, write position and size
+ *		  lit, lit_len - literals that precede the match
+ *		  offset, match_len - the match, match_len 0 for the final literals
+ * OUTPUT: SUCCESS, or FAIL if the sequence does not fit
+ */
+static int32_t emit(uint8_t* dst, uint32_t* op, uint32_t dst_cap, const uint8_t* lit,
+					uint32_t lit_len, uint32_t offset, uint32_t match_len)
+{
+	uint32_t worst = 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1;
+	uint8_t* token;
+	uint32_t o = *op;
+
+	if(o + worst > dst_cap)
+		return FAIL;
+
+	token = &dst[o++];
+	if(lit_len >= TOKEN_MAX) {
+		*token = TOKEN_MAX << 4;
+		o += put_length(&dst[o], lit_len - TOKEN_MAX);
+	} else {
+		*token = lit_len << 4;
+	}
+	memcpy(&dst[o], lit, lit_len);
+	o += lit_len;
+
+	if(match_len != 0) {
+		dst[o++] = offset & 0xFF;
+		dst[o++] = offset >> 8;
+		match_len -= LZ4_MIN_MATCH;
+		if(match_len >= TOKEN_MAX) {
+			*token |= TOKEN_MAX;
+			o += put_length(&dst[o], match_len - TOKEN_MAX);
+		} else {
+			*token |= match_len;
+		}
+	}
+
+	*op = o;
+	return SUCCESS;
+}
+
+/* int32_t lz4_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap)
+ * INPUT: src, src_len - data to compress, at most 64 kB
+ *		  dst, dst_cap - output buffer
+ * OUTPUT: compressed size, -1 if it would exceed dst_cap
+ * DESCRIPTION: greedy single pass: every position is looked up in a hash table
+ *				of 4 byte sequences, and a hit is extended as far as it goes
+ */
+int32_t lz4_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap)
+{
+	uint32_t ip = 0, anchor = 0, op = 0;
+	uint32_t seq, h, ref, len;
+
+	memset(hash_table, 0, sizeof(hash_table));
+
+	if(src_len > LZ4_MF_LIMIT) {
+		while(ip < src_len - LZ4_MF_LIMIT) {
+			seq = read32(&src[ip]);
+			h = hash4(seq);
+			ref = hash_table[h];
+			hash_table[h] = ip;
+
+			if(ref >= ip || ip - ref > LZ4_MAX_OFFSET || read32(&src[ref]) != seq) {
+				ip++;
+				continue;
+			}
+
+			len = LZ4_MIN_MATCH;
+			while(ip + len < src_len - LZ4_LAST_LITERALS && src[ref + len] == src[ip + len])
+				len++;
+
+			if(emit(dst, &op, dst_cap, &src[anchor], ip - anchor, ip - ref, len) == FAIL)
+				return FAIL;
+			ip += len;
+			anchor = ip;
+		}
+	}
+
+	if(emit(dst, &op, dst_cap, &src[anchor], src_len - anchor, 0, 0) == FAIL)
+		return FAIL;
+
+	return op;
+}
+
+/* int32_t lz4_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap)
+ * INPUT: src, src_len - one compressed block
+ *		  dst, dst_cap - output buffer
+ * OUTPUT: decompressed size, -1 if the block is malformed or does not fit
+ */
+int32_t lz4_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap)
+{
+	uint32_t ip = 0, op = 0;
+	uint32_t token, len, offset;
+	uint8_t b;
+
+	while(ip < src_len) {
+		token = src[ip++];
+
+		/* literals */
+		len = token >> 4;
+		if(len == TOKEN_MAX) {
+			do {
+				if(ip >= src_len)
+					return FAIL;
+				b = src[ip++];
+				len += b;
+			} while(b == 255);
+		}
+		if(len > src_len - ip || len > dst_cap - op)
+			return FAIL;
+		memcpy(&dst[op], &src[ip], len);
+		ip += len;
+		op += len;
+
+		if(ip == src_len)
+			break;		/* the last sequence has no match */
+
+		/* match */
+		if(src_len - ip < 2)
+			return FAIL;
+		offset = src[ip] | (src[ip + 1] << 8);
+		ip += 2;
+		if(offset == 0 || offset > op)
+			return FAIL;
+
+		len = token & TOKEN_MAX;
+		if(len == TOKEN_MAX) {
+			do {
+				if(ip >= src_len)
+					return FAIL;
+				b = src[ip++];
+				len += b;
+			} while(b == 255);
+		}
+		len += LZ4_MIN_MATCH;
+		if(len > dst_cap - op)
+			return FAIL;
+
+		/* byte by byte: the match may overlap what it produces */
+		while(len-- > 0) {
+			dst[op] = dst[op - offset];
+			op++;
+		}
+	}
+
+	return op;
+}
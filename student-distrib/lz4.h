@@ -0,0 +1,22 @@
+/*	*********************************************************
+	# FILE NAME: lz4.h
+	# PURPOSE: header for lz4.c, LZ4 block compression
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#ifndef _LZ4_H
+#define _LZ4_H
+
+#include "types.h"
+
+#define LZ4_MIN_MATCH		4			/* shortest match the format can express */
+#define LZ4_LAST_LITERALS	5			/* the last bytes of a block are always literals */
+#define LZ4_MF_LIMIT		12			/* no match may start this close to the end */
+#define LZ4_HASH_BITS		12			/* match finder table: 4096 entries */
+#define LZ4_MAX_OFFSET		0xFFFF
+
+/* LZ4 block format (no frame header). Both return the output size, or -1 if
+ * the output does not fit (compress) or the input is malformed (decompress). */
+int32_t lz4_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap);
+int32_t lz4_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap);
+
+#endif /* _LZ4_H */
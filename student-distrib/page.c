@@ -6,7 +6,6 @@
 ********************************************************* */
 
 #define PAGE_ENTRY				1024
-#define KERNEL_ENTRY			0x00400183
 /* specific bit controls */
 #define PRESENT					0x1
 #define READWRITE				0x2
@@ -14,6 +13,7 @@
 #define CACHE					0x8
 #define IGNORE					0x80
 #define PT_IDX_VIDMEM			184			/* AW The middle 10 digits of video memory (0xB8000) imply a page table index of 184 */
+#define VIDEO_PHYS				0x000B8000
 #define PT_IDX_T1_VID			185
 #define PT_IDX_T2_VID			186
 #define PT_IDX_T3_VID			187
@@ -25,22 +25,47 @@
 #define BACKING_PAGES_START		0x000B9000	/* AW the address of the first video backing page; subsequent backing pages will
 												follow at 4kB intervals */
 #define CR4_PSE					0x00000010
-#define CR0_VALUE				0x80000000
+#define CR4_PGE					0x00000080
+#define CR0_VALUE				0x80010000	/* paging, plus write protect so kernel writes honour copy-on-write */
+#define MSR_PAT					0x277
+#define CPUID_PAT				0x00010000	/* cpuid 1, edx bit 16 */
+#define PAT_LOW					0x00070406	/* PA0-3 as at reset: WB, WT, UC-, UC */
+#define PAT_HIGH				0x00070401	/* PA4 WC instead of WB; PA5-7 as at reset */
+#define PTE_PWT					0x8
+#define PTE_PCD					0x10
+#define PTE_PAT					0x80		/* in a 4 kB page table entry */
+#define PDE_PAT					0x1000		/* in a 4 MB page directory entry */
 
 #include "page.h"
 #include "x86_desc.h"
 #include "lib.h"
 #include "terminal.h"
+#include "buddy.h"
+#include "zram.h"
+#include "syscalls.h"
+
+/* physical address the filesystem window starts at (4 MB aligned) */
+static uint32_t fs_image_base;
+
+/* the first 4 MB of the direct map in 4 kB pages, so video memory can get its
+ * own memory type without changing the rest */
+static uint32_t pt_low[PAGE_ENTRY] __attribute__((aligned(BYTES_4KB)));
+
+/* set once the PAT holds the layout pat_init writes */
+static uint32_t pat_ready;
+
 
 /* void set_read_write()
  * INPUT: none
  * OUTPUT: none
- * DESCRIPTION: initializes the page directory by setting the read/write for all of the page tables
+ * DESCRIPTION: initializes the user half of the page directory by setting the read/write
+ *				for all of the page tables. This also drops the identity map boot.S ran on
+ *				while it jumped to the kernel half.
  */
 void set_read_write()
 {	
 	int i;
-	for(i = 0; i < PAGE_ENTRY; i++) {
+	for(i = 0; i < PD_IDX_KERNEL; i++) {
 		pd[i] = READWRITE;				/* set bit 1 */
 	}
 }
@@ -68,8 +93,12 @@ void init_table()
 /* void init_page()
  * INPUT: none
  * OUTPUT: none
- * DESCRIPTION: initializes the kernel page and video memory,
- * 				kernel and Video memory set up in paging scheme, CR3 and CR4 set to appropriate values.
+ * DESCRIPTION: initializes the kernel half and video memory. boot.S already runs us
+ *				with paging on; this drops its identity map, maps all of
+ *				[0, DIRECT_MAP_END) at KERNEL_VBASE with global 4 MB pages (the first
+ *				one split into 4 kB pages) and keeps the video page table at 0 for
+ *				vidmap. CR3 and CR4 set to appropriate values. Video memory is made
+ *				write-combining last.
  */
 void init_page()
 {
@@ -77,17 +106,28 @@ void init_page()
 	init_table();
 	
 	int PDE_video = 0;
-	int PDE_kernel = 1;
 	
 	uint32_t reg_cr0 = 0;
 	uint32_t reg_cr4 = 0;
 	
-	pd[PDE_video] = (uint32_t) pt_0_4 | USER | PRESENT | READWRITE;
-	pd[PDE_kernel] = KERNEL_ENTRY;
+	pd[PDE_video] = __pa(pt_0_4) | USER | PRESENT | READWRITE;
+
+	/* the kernel image, the fs module, video memory and every frame the buddy
+	 * allocator hands out are reached through this direct map. Every page
+	 * directory shares it, so it is global. */
+	uint32_t addr;
+	for(addr = 0; addr < DIRECT_MAP_END; addr += BYTES_4MB) {
+		pd[PD_IDX_KERNEL + (addr >> 22)] = addr | PTE_GLOBAL | PDE_4MB_PAGE | READWRITE | PRESENT;
+	}
+	for(addr = 0; addr < BYTES_4MB; addr += BYTES_4KB) {
+		pt_low[addr >> 12] = addr | PTE_GLOBAL | READWRITE | PRESENT;
+	}
+	pd[PD_IDX_KERNEL] = __pa(pt_low) | PTE_GLOBAL | READWRITE | PRESENT;
+
 	/* sets c variable reg_cr4 equal to register cr4 */
 	asm volatile ("mov %%CR4, %0;"
 					: "=c"(reg_cr4));	
-	reg_cr4 |= CR4_PSE;
+	reg_cr4 |= CR4_PSE | CR4_PGE;
 	/* put modified value back into register cr4 */
 	asm volatile ("mov %0, %%CR4;"
 					:
@@ -95,7 +135,7 @@ void init_page()
 	/* puts address of page directory into cr3 */
 	asm volatile ("mov %0, %%CR3"
 					:
-					: "c"(pd));		
+					: "c"(__pa(pd)));		
 	/* sets c variable reg_cr0 equal to register cr0 */
 	asm volatile ("mov %%CR0, %0"
 					: "=c"(reg_cr0));	
@@ -104,6 +144,93 @@ void init_page()
 	asm volatile ("mov %0, %%CR0"
 					:
 					: "c"(reg_cr0));
+
+	/* video memory, through the direct map and the vidmap table */
+	pat_init();
+	set_memory_type(KERNEL_VBASE + VGA_MEM_START, VGA_MEM_END - VGA_MEM_START, MEM_TYPE_WC);
+	set_memory_type(VIDEO_PHYS, (PT_IDX_T3_VID - PT_IDX_VIDMEM + 1) * BYTES_4KB, MEM_TYPE_WC);
+}
+
+/* void pat_init(void)
+ * INPUT: none
+ * OUTPUT: none
+ * DESCRIPTION: programs the page attribute table so PA4 is write-combining. PA4 is
+ *				picked by the PAT bit alone, which nothing set before, and PA0-3
+ *				keep their reset types, so every existing PWT/PCD combination
+ *				means what it did. Does nothing on a cpu without PAT.
+ */
+void pat_init(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	asm volatile ("cpuid"
+					: "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+					: "a"(1));
+	if(!(edx & CPUID_PAT))
+		return;
+
+	asm volatile ("wbinvd;"
+				  "wrmsr"
+					:
+					: "c"(MSR_PAT), "a"(PAT_LOW), "d"(PAT_HIGH)
+					: "memory");
+	set_cr3((uint32_t*)pd);
+	pat_ready = 1;
+}
+
+/* int32_t set_memory_type(uint32_t vaddr, uint32_t length, uint32_t type)
+ * INPUT: vaddr, length - page aligned range mapped by the boot page directory
+ *		  type - MEM_TYPE_WB, MEM_TYPE_WC or MEM_TYPE_UC
+ * OUTPUT: SUCCESS, or FAIL if part of the range is not mapped, only partly
+ *		   covers a 4 MB page, or the cpu cannot do the type
+ * DESCRIPTION: sets the caching bits of the range's page table entries and drops
+ *				their TLB entries. Page tables are shared by every page
+ *				directory; a 4 MB page is copied into each one, so those must be
+ *				typed before the first process starts, like a linear framebuffer
+ *				mapped at boot.
+ */
+int32_t set_memory_type(uint32_t vaddr, uint32_t length, uint32_t type)
+{
+	uint32_t bits, large_bits, addr, pde;
+	uint32_t* pte;
+
+	switch(type) {
+		case MEM_TYPE_WB:
+			bits = 0;
+			large_bits = 0;
+			break;
+		case MEM_TYPE_WC:
+			if(!pat_ready)
+				return FAIL;
+			bits = PTE_PAT;
+			large_bits = PDE_PAT;
+			break;
+		case MEM_TYPE_UC:
+			bits = PTE_PCD | PTE_PWT;
+			large_bits = PTE_PCD | PTE_PWT;
+			break;
+		default:
+			return FAIL;
+	}
+
+	for(addr = vaddr; addr < vaddr + length; addr += BYTES_4KB) {
+		pde = pd[addr >> 22];
+		if(!(pde & PRESENT))
+			return FAIL;
+
+		if(pde & PDE_4MB_PAGE) {
+			if((addr & (BYTES_4MB - 1)) || vaddr + length - addr < BYTES_4MB)
+				return FAIL;
+			pd[addr >> 22] = (pde & ~(PDE_PAT | PTE_PCD | PTE_PWT)) | large_bits;
+			addr += BYTES_4MB - BYTES_4KB;
+		} else {
+			pte = &((uint32_t*)__va(pde & PTE_ADDR_MASK))[(addr >> 12) & (PAGE_ENTRY - 1)];
+			*pte = (*pte & ~(PTE_PAT | PTE_PCD | PTE_PWT)) | bits;
+		}
+		invlpg(addr & ~(BYTES_4KB - 1));
+	}
+
+	return SUCCESS;
 }
 
 /* void init_4mb_user_pde(pd_entry_t* pde, uint32_t page_base_addr)
@@ -130,16 +257,126 @@ void init_4mb_user_pde(pd_entry_t* pde, uint32_t page_base_addr)
 }
 
 /* void set_cr3(uint32_t* page_dir)
- * INPUT: uint32_t* page_dir - process' page directory
+ * INPUT: uint32_t* page_dir - process' page directory (kernel address)
  * OUTPUT: none
  * DESCRIPTION: set cr3 register to point to a give process' page directory 
  */
 void set_cr3(uint32_t* page_dir)
 {
-	/* puts address of page directory into cr3 */
+	/* puts physical address of page directory into cr3 */
 	asm volatile ("mov %0, %%CR3"
 		:
-		: "c"(page_dir));
+		: "c"(__pa(page_dir)));
+}
+
+/* void invlpg(uint32_t vaddr)
+ * INPUT: uint32_t vaddr - any address inside the page
+ * OUTPUT: none
+ * DESCRIPTION: removes the TLB entry of one page (4 kB or 4 MB) after its
+ *				mapping changed, instead of flushing the whole TLB
+ */
+void invlpg(uint32_t vaddr)
+{
+	asm volatile ("invlpg (%0)"
+		:
+		: "r"(vaddr)
+		: "memory");
+}
+
+/* int32_t set_global_pages(int32_t enable)
+ * INPUT: int32_t enable - 1 to keep kernel TLB entries across cr3 loads,
+ *		  0 to flush them with everything else, -1 to only query
+ * OUTPUT: previous setting, or -1 for a bad value
+ * DESCRIPTION: toggles CR4.PGE. Changing it flushes the whole TLB, global
+ *				entries included.
+ */
+int32_t set_global_pages(int32_t enable)
+{
+	uint32_t reg_cr4;
+	int32_t old;
+
+	asm volatile ("mov %%CR4, %0;"
+					: "=c"(reg_cr4));
+	old = (reg_cr4 & CR4_PGE) ? 1 : 0;
+
+	if(enable == -1)
+		return old;
+	if(enable != 0 && enable != 1)
+		return -1;
+
+	if(enable)
+		reg_cr4 |= CR4_PGE;
+	else
+		reg_cr4 &= ~CR4_PGE;
+	asm volatile ("mov %0, %%CR4;"
+					:
+					: "c"(reg_cr4));
+	return old;
+}
+
+/* uint32_t map_fs_image(uint32_t start, uint32_t end)
+ * INPUT: start, end - physical range of the filesystem module
+ * OUTPUT: kernel address of start
+ * DESCRIPTION: maps the module at FS_WINDOW with as many 4 MB pages as it spans,
+ *				read-only and global like the rest of the kernel half, so even an
+ *				image of a hundred MB or more costs one TLB entry per 4 MB. An image
+ *				too large for the window is cut off at its end. Call after
+ *				init_page and before the first page_dir_alloc.
+ */
+uint32_t map_fs_image(uint32_t start, uint32_t end)
+{
+	uint32_t base = start & ~(BYTES_4MB - 1);
+	uint32_t addr;
+
+	if(end - base > FS_WINDOW_END - FS_WINDOW) {
+		printf("fs image too large: only the first %d MB are mapped\n", (FS_WINDOW_END - FS_WINDOW) >> 20);
+		end = base + (FS_WINDOW_END - FS_WINDOW);
+	}
+
+	fs_image_base = base;
+	for(addr = base; addr < end; addr += BYTES_4MB)
+		pd[(FS_WINDOW + (addr - base)) >> 22] = addr | PTE_GLOBAL | PDE_4MB_PAGE | PRESENT;
+
+	return FS_WINDOW + (start - base);
+}
+
+/* uint32_t fs_image_pa(uint32_t vaddr)
+ * INPUT: vaddr - address inside the filesystem window
+ * OUTPUT: the physical address behind it
+ */
+uint32_t fs_image_pa(uint32_t vaddr)
+{
+	return fs_image_base + (vaddr - FS_WINDOW);
+}
+
+/* uint32_t* page_dir_alloc(void)
+ * INPUT: none
+ * OUTPUT: a new page directory, NULL if out of memory
+ * DESCRIPTION: copies the kernel half and the vidmap table of the boot page
+ *				directory and leaves the user window not present
+ */
+uint32_t* page_dir_alloc(void)
+{
+	uint32_t* page_dir = (uint32_t*)alloc_frame();
+	int i;
+
+	if(page_dir == NULL)
+		return NULL;
+
+	for(i = 0; i < PAGE_ENTRY; i++)
+		page_dir[i] = (pd[i] & PTE_GLOBAL) ? pd[i] : READWRITE;
+	page_dir[0] = pd[0];		/* video memory table */
+
+	return page_dir;
+}
+
+/* void page_dir_free(uint32_t* page_dir)
+ * INPUT: uint32_t* page_dir - directory from page_dir_alloc that is not loaded
+ * OUTPUT: none
+ */
+void page_dir_free(uint32_t* page_dir)
+{
+	free_frame((uint32_t)page_dir);
 }
 
 /* uint8_t* get_backing_page(int terminal_num)
@@ -150,7 +387,7 @@ void set_cr3(uint32_t* page_dir)
  */
 uint8_t* get_backing_page(int terminal_num)
 {
-	return (uint8_t*)(BACKING_PAGES_START + terminal_num * BYTES_4KB);
+	return (uint8_t*)__va(BACKING_PAGES_START + terminal_num * BYTES_4KB);
 }
 
 /* int copy_4kb_page(uint8_t* source, uint8_t* dest)
@@ -166,3 +403,73 @@ int copy_4kb_page(uint8_t* source, uint8_t* dest)
 
 	return 0;
 }
+
+/* uint32_t alloc_frame(void)
+ * INPUT: none
+ * OUTPUT: kernel address of a free 4 kB frame, or 0 if memory is exhausted
+ * DESCRIPTION: order 0 block from the buddy allocator, holding one reference.
+ *				The frame contents are not cleared. Runs the zram page clock
+ *				first when memory is low.
+ */
+uint32_t alloc_frame(void)
+{
+	/* keep some room: compress pages of idle processes while kmalloc can
+	 * still get pages for the compressed copies */
+	if(buddy_free_pages() < ZRAM_LOW_WATER)
+		user_reclaim(ZRAM_BATCH);
+
+	return buddy_alloc(0);
+}
+
+/* void free_frame(uint32_t frame)
+ * INPUT: frame - kernel address of a frame returned by alloc_frame
+ * OUTPUT: none
+ * DESCRIPTION: drops one reference to a frame and returns it to the allocator when
+ *				the last one is gone; memory the allocator does not own is ignored
+ */
+void free_frame(uint32_t frame)
+{
+	page_desc_t* page = buddy_page(frame);
+
+	if(page == NULL)
+		return;
+	if(--page->refs != 0)
+		return;		/* still shared */
+
+	buddy_free(frame);
+}
+
+/* void get_frame(uint32_t frame)
+ * INPUT: frame - kernel address of an allocated frame
+ * OUTPUT: none
+ * DESCRIPTION: takes an extra reference so the frame can be mapped more than once;
+ *				memory the allocator does not own is ignored
+ */
+void get_frame(uint32_t frame)
+{
+	page_desc_t* page = buddy_page(frame);
+
+	if(page != NULL)
+		page->refs++;
+}
+
+/* uint32_t frame_ref_count(uint32_t frame)
+ * INPUT: frame - kernel address of a frame
+ * OUTPUT: number of references held on an allocated frame, 0 for memory the
+ *		   allocator does not own
+ */
+uint32_t frame_ref_count(uint32_t frame)
+{
+	page_desc_t* page = buddy_page(frame);
+
+	return (page == NULL) ? 0 : page->refs;
+}
+
+/* uint32_t free_frame_count(void)
+ * INPUT: none
+ * OUTPUT: number of frames alloc_frame can still hand out
+ */
+uint32_t free_frame_count(void)
+{
+	return buddy_free_pages();
+}
@@ -10,8 +10,40 @@
 
 #define NUM_PD_ENTRIES			1024
 #define BYTES_4KB				4096
+#define BYTES_4MB				0x00400000
+
+/* page table entry bits */
+#define PTE_PRESENT				0x1
+#define PTE_READWRITE			0x2
+#define PTE_USER				0x4
+#define PTE_ACCESSED			0x20		/* set by the cpu on every access */
+#define PDE_4MB_PAGE			0x80		/* page size bit: directory entry maps a 4 MB page */
+#define PTE_GLOBAL				0x100		/* kept in the TLB across cr3 loads while CR4.PGE is set */
+#define PTE_COW					0x200		/* available bit 9: read-only now, private copy on first write */
+#define PTE_SWAP				0x400		/* available bit 10: not present, zram slot in the address bits */
+#define PTE_SWAP_SHIFT			12
+#define PTE_ADDR_MASK			0xFFFFF000
+
+/* memory types for set_memory_type, see pat_init for the PAT layout */
+#define MEM_TYPE_WB				0			/* write-back, the default */
+#define MEM_TYPE_WC				1			/* write-combining: stores are batched into bursts */
+#define MEM_TYPE_UC				2			/* uncached */
+
+#define VGA_MEM_START			0x000A0000	/* legacy VGA window: text memory and the */
+#define VGA_MEM_END				0x000C0000	/* terminal backing pages live here */
+
+/* the filesystem module gets its own read-only window above the direct map,
+ * so an image of any size up to FS_WINDOW_END - FS_WINDOW (252 MB) is
+ * reachable; larger ones mount from disk */
+#define FS_WINDOW				0xF0000000	/* KERNEL_VBASE + DIRECT_MAP_END */
+#define FS_WINDOW_END			0xFFC00000	/* the last 4 MB stay unmapped */
 
 #include "types.h"
+#include "x86_desc.h"
+
+/* convert between kernel virtual addresses in the direct map and physical ones */
+#define __pa(vaddr)				((uint32_t)(vaddr) - KERNEL_VBASE)
+#define __va(paddr)				((void*)((uint32_t)(paddr) + KERNEL_VBASE))
 
 typedef struct pd_entry_t {
 	union {
@@ -46,6 +78,30 @@ void init_page();
 void init_4mb_user_pde(pd_entry_t * pde, uint32_t page_base_addr);
 /* flush TLB for system calls */
 void set_cr3(uint32_t* page_dir);
+/* drop the TLB entry of a single page */
+void invlpg(uint32_t vaddr);
+/* turn global kernel pages (CR4.PGE) on or off */
+int32_t set_global_pages(int32_t enable);
+
+/* page attribute table and per-page memory types */
+void pat_init(void);
+int32_t set_memory_type(uint32_t vaddr, uint32_t length, uint32_t type);
+
+/* map the filesystem module and find its frames again */
+uint32_t map_fs_image(uint32_t start, uint32_t end);
+uint32_t fs_image_pa(uint32_t vaddr);
+
+/* per-process page directories sharing the kernel mappings */
+uint32_t* page_dir_alloc(void);
+void page_dir_free(uint32_t* page_dir);
+
+/* reference counted 4 kB frames for user pages, named by their kernel
+ * (direct map) address; page table entries hold __pa() of it */
+uint32_t alloc_frame(void);
+void free_frame(uint32_t frame);
+void get_frame(uint32_t frame);
+uint32_t frame_ref_count(uint32_t frame);
+uint32_t free_frame_count(void);
 
 /* used for saving terminal state and switching terminals */
 uint8_t* get_backing_page(int terminal_num);
@@ -0,0 +1,79 @@
+/*	*********************************************************
+	# FILE NAME: pci.c
+	# PURPOSE: PCI configuration space: finding a controller by its class and
+	#		   reading or setting its registers
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#include "pci.h"
+#include "lib.h"
+#include "syscalls.h"
+
+/* uint32_t pci_address(const pci_func_t* func, uint32_t offset)
+ * INPUT: func - bus, device and function
+ *		  offset - register in its configuration space
+ * OUTPUT: the value for CONFIG_ADDRESS
+ */
+static uint32_t pci_address(const pci_func_t* func, uint32_t offset)
+{
+	return PCI_ENABLE | (func->bus << 16) | (func->device << 11) |
+		   (func->function << 8) | (offset & 0xFC);
+}
+
+/* uint32_t pci_read(const pci_func_t* func, uint32_t offset)
+ * INPUT: func - bus, device and function
+ *		  offset - 4-byte aligned register in its configuration space
+ * OUTPUT: the register, all ones if the function does not exist
+ */
+uint32_t pci_read(const pci_func_t* func, uint32_t offset)
+{
+	outl(pci_address(func, offset), PCI_CONFIG_ADDRESS);
+	return inl(PCI_CONFIG_DATA);
+}
+
+/* void pci_write(const pci_func_t* func, uint32_t offset, uint32_t value)
+ * INPUT: func - bus, device and function
+ *		  offset - 4-byte aligned register in its configuration space
+ *		  value - what to write
+ * OUTPUT: none
+ */
+void pci_write(const pci_func_t* func, uint32_t offset, uint32_t value)
+{
+	outl(pci_address(func, offset), PCI_CONFIG_ADDRESS);
+	outl(value, PCI_CONFIG_DATA);
+}
+
+/* int32_t pci_find_class(uint8_t class, uint8_t subclass, pci_func_t* func)
+ * INPUT: class, subclass - what kind of controller
+ *		  func - filled in with where it is
+ * OUTPUT: SUCCESS, or FAIL if no function has that class
+ * DESCRIPTION: scans every bus by brute force; functions 1-7 are only looked
+ *				at on multifunction devices
+ */
+int32_t pci_find_class(uint8_t class, uint8_t subclass, pci_func_t* func)
+{
+	uint32_t bus, device, function, functions, reg;
+
+	for(bus = 0; bus < PCI_BUSES; bus++) {
+		for(device = 0; device < PCI_DEVICES; device++) {
+			func->bus = bus;
+			func->device = device;
+			func->function = 0;
+			if((pci_read(func, PCI_ID) & 0xFFFF) == PCI_NO_VENDOR)
+				continue;
+			functions = (pci_read(func, PCI_HEADER) & PCI_MULTIFUNCTION) ? PCI_FUNCTIONS : 1;
+
+			for(function = 0; function < functions; function++) {
+				func->function = function;
+				if((pci_read(func, PCI_ID) & 0xFFFF) == PCI_NO_VENDOR)
+					continue;
+				reg = pci_read(func, PCI_CLASS);
+				if((reg >> 24) == class && ((reg >> 16) & 0xFF) == subclass) {
+					func->prog_if = (reg >> 8) & 0xFF;
+					return SUCCESS;
+				}
+			}
+		}
+	}
+
+	return FAIL;
+}
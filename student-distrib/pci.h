@@ -0,0 +1,49 @@
+/*	*********************************************************
+	# FILE NAME: pci.h
+	# PURPOSE: header for pci.c, configuration space access through the
+	#		   0xCF8/0xCFC ports
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#ifndef _PCI_H
+#define _PCI_H
+
+#include "types.h"
+
+#define PCI_CONFIG_ADDRESS	0xCF8
+#define PCI_CONFIG_DATA		0xCFC
+#define PCI_ENABLE			0x80000000	/* CONFIG_ADDRESS: access configuration space */
+
+#define PCI_BUSES			256
+#define PCI_DEVICES			32
+#define PCI_FUNCTIONS		8
+
+/* configuration space registers, as 32-bit offsets */
+#define PCI_ID				0x00		/* vendor id low, device id high */
+#define PCI_COMMAND			0x04		/* command low, status high */
+#define PCI_CLASS			0x08		/* revision, prog if, subclass, class from low to high */
+#define PCI_HEADER			0x0C		/* header type in bits 16-23 */
+#define PCI_BAR0			0x10		/* base address registers 0-5, 4 bytes apart */
+
+#define PCI_NO_VENDOR		0xFFFF		/* vendor id read where there is no function */
+#define PCI_MULTIFUNCTION	0x00800000	/* PCI_HEADER: functions 1-7 may exist */
+#define PCI_CMD_IO			0x0001		/* respond to its I/O port ranges */
+#define PCI_CMD_MASTER		0x0004		/* may start bus master transfers */
+#define PCI_BAR_IO			0x1			/* base address register maps I/O ports */
+#define PCI_BAR_IO_MASK		0xFFFFFFFC
+
+/* one function found by pci_find_class */
+typedef struct pci_func {
+	uint8_t bus;
+	uint8_t device;
+	uint8_t function;
+	uint8_t prog_if;			/* programming interface byte of the class code */
+} pci_func_t;
+
+/* configuration space of a function; offset is 4-byte aligned */
+uint32_t pci_read(const pci_func_t* func, uint32_t offset);
+void pci_write(const pci_func_t* func, uint32_t offset, uint32_t value);
+
+/* first function of the class and subclass; FAIL if there is none */
+int32_t pci_find_class(uint8_t class, uint8_t subclass, pci_func_t* func);
+
+#endif /* _PCI_H */
@@ -6,6 +6,7 @@
 ********************************************************* */
 
 #include "rtc.h"
+#include "ksm.h"
 
 /* rtc_init()
  * INPUT: none
@@ -118,7 +119,9 @@ rtc_read(uint8_t* fname, void* buf, int32_t nbytes)
     /* set rtc_read for next tick */
     RTC_READ = 1;
 	/* waiting for next rtc tick */
-	while(RTC_READ){}
+	while(RTC_READ){
+		ksm_idle();
+	}
 	return 0;	
 }
 
@@ -4,6 +4,9 @@
 #include "i8259.h"
 #include "idt.h"
 
+/* cost of the address space switches since the last sched_switch_cycles() call */
+static uint32_t switch_cycles;
+static uint32_t switch_count;
 
 /* AW */
 /* pq_init()
@@ -60,7 +63,7 @@ int pq_enqueue(process_queue_t* process_q_ptr, uint32_t process_num)
 	}
 
 	/* calculate address of PCB for this process */
-	process_control_block_t* this_pcb = (process_control_block_t*)(ADDR_8MB - process_num*ADDR_8KB);
+	process_control_block_t* this_pcb = get_pcb(process_num);
 
 	/* update rear of queue */
 	old_rear = process_q_ptr->rear;	/* save old rear to revert if error occurs */
@@ -176,8 +179,11 @@ void pq_rotate(process_queue_t* process_q_ptr)
  */
 void change_task(registers_t regs)
 {
+	uint32_t start_cycles, end_cycles;
+
 	/* create critical section */
 	cli();
+	rdtsc_low(start_cycles);
 
 	/* get the current process from the top of the queue */
 	process_control_block_t* curr_pcb = pq_peak(&process_q);
@@ -218,21 +224,16 @@ void change_task(registers_t regs)
 	uint32_t tmp_ecx = next_pcb->ecx;
 	uint32_t tmp_eax = next_pcb->eax;
 	uint32_t tmp_eflags = next_pcb->eflags; 
-	tss.esp0 = ADDR_8MB - (next_pcb->pid)*ADDR_8KB - 4;	/* set address of kernel stack pointer */
+	tss.esp0 = kernel_stack_top(next_pcb->pid);	/* set address of kernel stack pointer */
 
 	/* update memory space */
-		pd_entry_t pde;		/* declare a pde struct */
-
-		/* populate pde struct; first user prog is at 8MB, next at 12MB, etc */
-		init_4mb_user_pde(&pde, ADDR_4MB + next_pcb->pid*ADDR_4MB);
-
-		pd[PD_IDX_USER] = pde.val;	/* enter page directory entry into page directory */
-
-		/* set cr3 */
-		set_cr3(pd);	/* (flushes TLB) */
+		set_process_pages(next_pcb->pid);	/* (flushes user TLB entries) */
 
 	send_eoi(0);	/* end of interrupt */
 
+	rdtsc_low(end_cycles);
+	sched_switch_done(end_cycles - start_cycles);
+
 	//asm volatile("movl %0, %%eip" :: "g" (tmp_eip));
 	//asm volatile("movl %0, %%ebp" :: "g" (tmp_ebp));
 	asm volatile("movl %0, %%edi" :: "g" (tmp_edi));
@@ -256,6 +257,46 @@ void change_task(registers_t regs)
 }
 
 
+/* sched_switch_done(uint32_t cycles)
+ * INPUT: 		cycles - time one switch took, from just before its cr3 load
+ *				to leaving the kernel code that follows it
+ * OUTPUTS: 	none
+ * DESCRIPTION: called by change_task and by halt's return to the parent, the
+ *				switch that happens while the scheduler is off
+ */
+void sched_switch_done(uint32_t cycles)
+{
+	uint32_t flags;
+
+	cli_and_save(flags);
+	switch_cycles += cycles;
+	switch_count++;
+	restore_flags(flags);
+}
+
+
+/* sched_switch_cycles()
+ * INPUT: 		none
+ * OUTPUTS: 	average cycles per switch passed to sched_switch_done, 0 if
+ *				there was none
+ * DESCRIPTION: Resets the counters so the next call covers a fresh interval.
+ *				The time after the cr3 load includes refilling the kernel TLB
+ *				entries a switch flushed.
+ */
+int32_t sched_switch_cycles(void)
+{
+	uint32_t flags, avg;
+
+	cli_and_save(flags);
+	avg = (switch_count != 0) ? switch_cycles / switch_count : 0;
+	switch_cycles = 0;
+	switch_count = 0;
+	restore_flags(flags);
+
+	return avg;
+}
+
+
 /* save_pcb_regs(process_control_block_t* curr, registers_t regs)
  * INPUT: 		regs - register values to save into curr's registers
  *				curr - process_control_block pointer of the current process
@@ -5,7 +5,7 @@
 #include "idt.h"
 #include "i8259.h"
 
-#define MAX_PROCESSES	6
+#define MAX_PROCESSES	16
 
 
 
@@ -122,6 +122,23 @@ void change_task(registers_t regs);
 void save_pcb_regs(process_control_block_t* curr, registers_t regs);
 
 
+/* 
+ * sched_switch_done(uint32_t cycles)
+ * Adds one timed address space switch to the average below.
+ *
+ */
+void sched_switch_done(uint32_t cycles);
+
+
+/* 
+ * sched_switch_cycles()
+ * Average cycles per timed switch since the last call, then starts
+ * counting afresh.
+ *
+ */
+int32_t sched_switch_cycles(void);
+
+
 #endif /* SCHED_H */
 
 
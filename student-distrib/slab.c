@@ -0,0 +1,256 @@
+/*	*********************************************************
+	# FILE NAME: slab.c
+	# PURPOSE: slab allocator: object caches and kmalloc/kfree on top of the
+	#		   buddy allocator
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#include "slab.h"
+#include "buddy.h"
+#include "lib.h"
+
+#define SLAB_HDR_SIZE	((sizeof(slab_t) + CACHE_LINE - 1) & ~(CACHE_LINE - 1))
+
+static kmem_cache_t caches[KMEM_MAX_CACHES];
+static uint32_t num_caches;
+static kmem_cache_t* kmalloc_caches[KMALLOC_CLASSES];
+
+static const int8_t* kmalloc_names[KMALLOC_CLASSES] = {
+	"kmalloc-64", "kmalloc-128", "kmalloc-256", "kmalloc-512", "kmalloc-1024"
+};
+
+/* void slab_push(slab_t** list, slab_t* slab)
+ * INPUT: list - head of one of a cache's slab lists
+ *		  slab - slab to put at its front
+ * OUTPUT: none
+ */
+static void slab_push(slab_t** list, slab_t* slab)
+{
+	slab->prev = NULL;
+	slab->next = *list;
+	if(*list != NULL)
+		(*list)->prev = slab;
+	*list = slab;
+}
+
+/* void slab_unlink(slab_t** list, slab_t* slab)
+ * INPUT: list - head of the list holding slab
+ *		  slab - slab to take off the list
+ * OUTPUT: none
+ */
+static void slab_unlink(slab_t** list, slab_t* slab)
+{
+	if(slab->prev != NULL)
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+	if(slab->next != NULL)
+		slab->next->prev = slab->prev;
+}
+
+/* slab_t* slab_new(kmem_cache_t* cache)
+ * INPUT: cache - cache that needs room
+ * OUTPUT: a fresh slab with every object on its free list, NULL if out of memory
+ */
+static slab_t* slab_new(kmem_cache_t* cache)
+{
+	slab_t* slab = (slab_t*)buddy_alloc(0);
+	uint8_t* obj;
+	uint32_t i;
+
+	if(slab == NULL)
+		return NULL;
+
+	slab->cache = cache;
+	slab->in_use = 0;
+	slab->free_list = NULL;
+
+	/* thread the free list from the last object down so allocation goes upward */
+	obj = (uint8_t*)slab + SLAB_HDR_SIZE + (cache->objs_per_slab - 1) * cache->obj_size;
+	for(i = 0; i < cache->objs_per_slab; i++) {
+		*(void**)obj = slab->free_list;
+		slab->free_list = obj;
+		obj -= cache->obj_size;
+	}
+
+	cache->slabs++;
+	return slab;
+}
+
+/* kmem_cache_t* kmem_cache_create(const int8_t* name, uint32_t size)
+ * INPUT: name - shown in the statistics
+ *		  size - object size in bytes; at least one object must fit in a slab
+ * OUTPUT: the new cache, NULL if the size is too big or no cache slot is left
+ * DESCRIPTION: objects are padded to a multiple of the cache line size and
+ *				start on a cache line, so no two objects share a line
+ */
+kmem_cache_t* kmem_cache_create(const int8_t* name, uint32_t size)
+{
+	kmem_cache_t* cache;
+
+	if(size == 0 || size > SLAB_SIZE - SLAB_HDR_SIZE || num_caches == KMEM_MAX_CACHES)
+		return NULL;
+
+	cache = &caches[num_caches++];
+	memset(cache, 0, sizeof(kmem_cache_t));
+	strncpy(cache->name, name, KMEM_NAME_LEN - 1);
+	cache->obj_size = (size + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+	cache->objs_per_slab = (SLAB_SIZE - SLAB_HDR_SIZE) / cache->obj_size;
+
+	return cache;
+}
+
+/* void* kmem_cache_alloc(kmem_cache_t* cache)
+ * INPUT: cache - cache to allocate from
+ * OUTPUT: a cache line aligned object (not cleared), NULL if out of memory
+ * DESCRIPTION: fills partially used slabs first, then the spare empty slab,
+ *				and only then asks the buddy allocator for a page
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache)
+{
+	uint32_t flags;
+	slab_t* slab;
+	void* obj;
+
+	cli_and_save(flags);
+
+	slab = cache->partial;
+	if(slab == NULL) {
+		slab = cache->empty;
+		if(slab != NULL)
+			slab_unlink(&cache->empty, slab);
+		else
+			slab = slab_new(cache);
+
+		if(slab == NULL) {
+			cache->failures++;
+			restore_flags(flags);
+			return NULL;
+		}
+		slab_push(&cache->partial, slab);
+	}
+
+	obj = slab->free_list;
+	slab->free_list = *(void**)obj;
+	slab->in_use++;
+	if(slab->in_use == cache->objs_per_slab) {
+		slab_unlink(&cache->partial, slab);
+		slab_push(&cache->full, slab);
+	}
+
+	cache->allocs++;
+	cache->active++;
+	restore_flags(flags);
+	return obj;
+}
+
+/* void kmem_cache_free(kmem_cache_t* cache, void* obj)
+ * INPUT: cache - cache obj came from
+ *		  obj - object returned by kmem_cache_alloc
+ * OUTPUT: none
+ * DESCRIPTION: one empty slab is kept per cache; any further empty slab goes
+ *				back to the buddy allocator
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* obj)
+{
+	slab_t* slab = (slab_t*)((uint32_t)obj & ~(SLAB_SIZE - 1));
+	uint32_t flags;
+
+	if(obj == NULL)
+		return;
+
+	cli_and_save(flags);
+
+	if(slab->in_use == cache->objs_per_slab)
+		slab_unlink(&cache->full, slab);
+	else
+		slab_unlink(&cache->partial, slab);
+
+	*(void**)obj = slab->free_list;
+	slab->free_list = obj;
+	slab->in_use--;
+
+	if(slab->in_use != 0) {
+		slab_push(&cache->partial, slab);
+	} else if(cache->empty == NULL) {
+		slab_push(&cache->empty, slab);
+	} else {
+		buddy_free((uint32_t)slab);
+		cache->slabs--;
+	}
+
+	cache->frees++;
+	cache->active--;
+	restore_flags(flags);
+}
+
+/* void kmem_init(void)
+ * INPUT: none
+ * OUTPUT: none
+ * DESCRIPTION: creates the kmalloc size class caches; call once the buddy
+ *				allocator has memory
+ */
+void kmem_init(void)
+{
+	uint32_t i;
+
+	for(i = 0; i < KMALLOC_CLASSES; i++)
+		kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], KMALLOC_MIN << i);
+}
+
+/* void* kmalloc(uint32_t size)
+ * INPUT: size - bytes wanted
+ * OUTPUT: cache line aligned memory (not cleared), NULL if out of memory
+ * DESCRIPTION: small requests come from the smallest fitting size class,
+ *				larger ones are whole page aligned blocks from the buddy allocator
+ */
+void* kmalloc(uint32_t size)
+{
+	uint32_t i, order;
+
+	if(size == 0)
+		return NULL;
+
+	if(size <= KMALLOC_MAX_SLAB) {
+		for(i = 0; (KMALLOC_MIN << i) < size; i++)
+			;
+		return kmem_cache_alloc(kmalloc_caches[i]);
+	}
+
+	for(order = 0; (SLAB_SIZE << order) < size; order++)
+		;
+	return (void*)buddy_alloc(order);
+}
+
+/* void kfree(void* ptr)
+ * INPUT: ptr - memory returned by kmalloc or kmem_cache_alloc
+ * OUTPUT: none
+ * DESCRIPTION: page aligned pointers are whole buddy blocks; anything else lives
+ *				in a slab whose header names its cache
+ */
+void kfree(void* ptr)
+{
+	if(ptr == NULL)
+		return;
+
+	if(((uint32_t)ptr & (SLAB_SIZE - 1)) == 0)
+		buddy_free((uint32_t)ptr);
+	else
+		kmem_cache_free(((slab_t*)((uint32_t)ptr & ~(SLAB_SIZE - 1)))->cache, ptr);
+}
+
+/* void kmem_print_stats(void)
+ * INPUT: none
+ * OUTPUT: none
+ * DESCRIPTION: one line per cache: object size, objects in use, pages owned,
+ *				and the alloc/free/failure counters
+ */
+void kmem_print_stats(void)
+{
+	uint32_t i;
+
+	for(i = 0; i < num_caches; i++) {
+		printf("%s: size %d active %d slabs %d allocs %d frees %d failed %d\n",
+			   caches[i].name, caches[i].obj_size, caches[i].active, caches[i].slabs,
+			   caches[i].allocs, caches[i].frees, caches[i].failures);
+	}
+}
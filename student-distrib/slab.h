@@ -0,0 +1,60 @@
+/*	*********************************************************
+	# FILE NAME: slab.h
+	# PURPOSE: header for slab.c, the kernel heap and object caches
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include "types.h"
+
+#define CACHE_LINE			64			/* objects and slab headers are aligned to this */
+#define SLAB_SIZE			4096		/* every slab is one page from the buddy allocator */
+#define KMALLOC_MIN			64			/* smallest kmalloc size class */
+#define KMALLOC_MAX_SLAB	1024		/* largest kmalloc size class; bigger requests get whole pages */
+#define KMALLOC_CLASSES		5			/* 64, 128, 256, 512, 1024 */
+#define KMEM_MAX_CACHES		32
+#define KMEM_NAME_LEN		16
+
+/* header at the start of every slab page */
+typedef struct slab {
+	struct slab* next;				/* neighbours on the cache's partial, full or empty list */
+	struct slab* prev;
+	struct kmem_cache* cache;		/* owner, so kfree can find it */
+	void* free_list;				/* first free object; each free object holds the next */
+	uint32_t in_use;				/* objects handed out from this slab */
+} slab_t;
+
+/* a cache of equally sized objects */
+typedef struct kmem_cache {
+	int8_t name[KMEM_NAME_LEN];
+	uint32_t obj_size;				/* requested size rounded up to a cache line */
+	uint32_t objs_per_slab;
+	slab_t* partial;				/* slabs with free and used objects */
+	slab_t* full;					/* slabs with no free object */
+	slab_t* empty;					/* at most one slab with every object free, kept for reuse */
+
+	/* statistics */
+	uint32_t allocs;				/* successful kmem_cache_alloc calls */
+	uint32_t frees;					/* kmem_cache_free calls */
+	uint32_t active;				/* objects currently handed out */
+	uint32_t slabs;					/* pages currently owned */
+	uint32_t failures;				/* allocations refused for lack of memory */
+} kmem_cache_t;
+
+/* sets up the kmalloc size classes */
+void kmem_init(void);
+
+/* object caches */
+kmem_cache_t* kmem_cache_create(const int8_t* name, uint32_t size);
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+/* general purpose kernel heap */
+void* kmalloc(uint32_t size);
+void kfree(void* ptr);
+
+/* prints the statistics of every cache */
+void kmem_print_stats(void);
+
+#endif /* _SLAB_H */
@@ -0,0 +1,128 @@
+/*	*********************************************************
+	# FILE NAME: snapshot.c
+	# PURPOSE: snapshots of loaded programs so repeated execute() skips the
+	#		   file system lookup, the ELF parse and the page faults
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#include "snapshot.h"
+#include "elf.h"
+#include "lib.h"
+
+uint32_t snapshot_enabled = 1;
+
+static snapshot_t snapshots[SNAPSHOT_SLOTS];
+static uint32_t snapshot_clock;		/* bumped on every lookup */
+
+/* snapshot_t* snapshot_find(const uint8_t* name)
+ * INPUT: name - program name parsed from the command
+ * OUTPUT: the snapshot of that program, or NULL if there is none
+ */
+snapshot_t* snapshot_find(const uint8_t* name)
+{
+	uint32_t i;
+
+	snapshot_clock++;
+	for(i = 0; i < SNAPSHOT_SLOTS; i++) {
+		if(snapshots[i].in_use && strncmp((int8_t*)snapshots[i].name, (int8_t*)name, FNAME_LENGTH + 1) == 0) {
+			snapshots[i].last_use = snapshot_clock;
+			return &snapshots[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* void snapshot_save(const uint8_t* name, process_control_block_t* pcb)
+ * INPUT: name - program name parsed from the command
+ *		  pcb - pcb elf_load just filled in
+ * OUTPUT: none
+ * DESCRIPTION: remembers the program in a free slot, or in place of the one
+ *				that was used least recently
+ */
+void snapshot_save(const uint8_t* name, process_control_block_t* pcb)
+{
+	snapshot_t* snap = &snapshots[0];
+	uint32_t i;
+
+	for(i = 0; i < SNAPSHOT_SLOTS; i++) {
+		if(!snapshots[i].in_use) {
+			snap = &snapshots[i];
+			break;
+		}
+		if(snapshots[i].last_use < snap->last_use)
+			snap = &snapshots[i];
+	}
+
+	strncpy((int8_t*)snap->name, (int8_t*)name, FNAME_LENGTH);
+	snap->name[FNAME_LENGTH] = '\0';
+	snap->inode = pcb->exe_inode;
+	snap->eip = pcb->eip;
+	snap->num_segments = pcb->num_segments;
+	memcpy(snap->segments, pcb->segments, sizeof(snap->segments));
+	snap->last_use = snapshot_clock;
+	snap->in_use = 1;
+}
+
+/* int32_t snapshot_restore(snapshot_t* snap, process_control_block_t* pcb, uint32_t pid)
+ * INPUT: snap - snapshot returned by snapshot_find
+ *		  pcb - pcb of the new process
+ *		  pid - the new process's (empty) address space
+ * OUTPUT: SUCCESS, or FAIL if the image cache has no room
+ * DESCRIPTION: the equivalent of elf_load for a known program. The pages earlier
+ *				runs brought into the image cache are mapped up front, copy-on-write
+ *				where the segment is writable.
+ */
+int32_t snapshot_restore(snapshot_t* snap, process_control_block_t* pcb, uint32_t pid)
+{
+	int32_t slot;
+
+	slot = image_cache_get(snap->inode);
+	if(slot == FAIL)
+		return FAIL;
+
+	pcb->image = slot;
+	pcb->exe_inode = snap->inode;
+	pcb->eip = snap->eip;
+	pcb->num_segments = snap->num_segments;
+	memcpy(pcb->segments, snap->segments, sizeof(pcb->segments));
+
+	image_cache_map(pcb, pid);
+	return SUCCESS;
+}
+
+/* void snapshot_drop(uint32_t inode)
+ * INPUT: inode - a file that is changing
+ * OUTPUT: none
+ * DESCRIPTION: forgets every snapshot of a program loaded from it
+ */
+void snapshot_drop(uint32_t inode)
+{
+	uint32_t i;
+
+	for(i = 0; i < SNAPSHOT_SLOTS; i++) {
+		if(snapshots[i].in_use && snapshots[i].inode == inode)
+			snapshots[i].in_use = 0;
+	}
+}
+
+/* int32_t snapshot_set_enabled(int32_t value)
+ * INPUT: value - 1 to enable, 0 to disable (dropping every snapshot), -1 to query
+ * OUTPUT: the setting before the call, FAIL for any other value
+ */
+int32_t snapshot_set_enabled(int32_t value)
+{
+	int32_t old = snapshot_enabled;
+	uint32_t i;
+
+	if(value == -1)
+		return old;
+	if(value != 0 && value != 1)
+		return FAIL;
+
+	if(value == 0) {
+		for(i = 0; i < SNAPSHOT_SLOTS; i++)
+			snapshots[i].in_use = 0;
+	}
+	snapshot_enabled = value;
+	return old;
+}
@@ -0,0 +1,40 @@
+/*	*********************************************************
+	# FILE NAME: snapshot.h
+	# PURPOSE: header for snapshot.c, post-load snapshots of executables
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include "types.h"
+#include "syscalls.h"
+
+#define SNAPSHOT_SLOTS	4			/* programs remembered at once */
+
+/* everything execute() learns while loading a program, minus the pages
+ * themselves, which stay in the image cache */
+typedef struct snapshot {
+	uint8_t name[FNAME_LENGTH + 1];			/* command name the snapshot answers to */
+	uint32_t in_use;						/* slot holds a snapshot */
+	uint32_t last_use;						/* snapshot_clock value of the last hit, for replacement */
+	uint32_t inode;							/* executable */
+	uint32_t eip;							/* entry point */
+	uint32_t num_segments;					/* valid entries in segments[] */
+	user_segment_t segments[MAX_SEGMENTS];	/* loadable segments */
+} snapshot_t;
+
+/* nonzero while execute() consults the snapshot cache */
+extern uint32_t snapshot_enabled;
+
+/* looks up, records and restores snapshots */
+snapshot_t* snapshot_find(const uint8_t* name);
+void snapshot_save(const uint8_t* name, process_control_block_t* pcb);
+int32_t snapshot_restore(snapshot_t* snap, process_control_block_t* pcb, uint32_t pid);
+
+/* forgets programs whose file changed */
+void snapshot_drop(uint32_t inode);
+
+/* turns the cache on (1) or off (0), or queries it (-1) */
+int32_t snapshot_set_enabled(int32_t value);
+
+#endif /* _SNAPSHOT_H */
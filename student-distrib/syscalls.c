@@ -8,6 +8,14 @@
 
 #include "syscalls.h"
 #include "sched.h"
+#include "elf.h"
+#include "snapshot.h"
+#include "buddy.h"
+#include "slab.h"
+#include "zram.h"
+#include "ksm.h"
+#include "fscache.h"
+#include "ata.h"
 
 fops_functions_t fops_directory_functions;
 fops_functions_t fops_file_functions;
@@ -17,21 +25,65 @@ fops_functions_t fops_terminal_functions;
 process_queue_t process_q;
 int primary_shell_count;
 
+/* pcb of each process, indexed by pid */
+static process_control_block_t* pcb_table[MAX_PROCESSES + 1];
+
+/* object caches for pcbs and fd tables */
+static kmem_cache_t* pcb_cache;
+static kmem_cache_t* fd_table_cache;
+
+/* page directory of each process, indexed by pid. They share the (global) kernel
+ * entries; the user window [TOP_PAGE, USER_END) is private and its page tables
+ * are allocated the first time their 4 MB is used. Pid 0 is the boot directory. */
+static uint32_t* page_dir[MAX_PROCESSES + 1];
+
+/* pid whose page directory is in cr3 */
+static uint32_t loaded_pid;
+
+/* position of a clock over the user pages of all processes */
+typedef struct user_hand {
+	uint32_t pid;
+	uint32_t addr;
+} user_hand_t;
+
 
 /*  halt(uint8_t)
- * 	INPUTS: 		status - not used
+ * 	INPUTS: 		status - value the parent's execute call returns
+ *	OUTPUTS: 		None - we never return
+ *	DESCRIPTION: 	The halt system call; ends the current process with status.
+ */
+int32_t halt(uint8_t status)
+{
+	return process_exit(status);
+}
+
+/*  process_exit(uint32_t)
+ * 	INPUTS: 		status - value the parent's execute call returns; halt passes
+ *					0-255, a process killed by an exception EXCEPTION_STATUS
  *	OUTPUTS: 		None - although we have a return 0, we should never reach that point
- *	DESCRIPTION: 	Halt checks if there is at least one process running, if there is
+ *	DESCRIPTION: 	Open files are closed first.
+ *					Halt checks if there is at least one process running, if there is
  * 					then we can continue on halting, if not then we execute another shell.
- *  				If we are continuing with halt we dequeue our process queue, restore the parent process's
- *					esp and ebp, restore the parent's page directory entry, set the cr3 (flush tlb),
- *					decrement processes count, set tss's stack pointer to parent process, update ebp and esp
- * 					to prepare for leave, then leave. 
+ *  				If we are continuing with halt we dequeue our process queue, free the process's
+ *					memory, load the parent's page directory,
+ *					decrement processes count, set tss's stack pointer to parent process, then load the
+ * 					esp and ebp the parent's execute saved in our pcb and return status from there.
  */
-int32_t halt(uint8_t status)
+int32_t process_exit(uint32_t status)
 {
+	int32_t fd;
+	uint32_t start_cycles, end_cycles;
+
+	/* files still open are closed so unlinked ones can be freed */
+	for(fd = INDEX + 1; fd < OPS_SIZE; fd++) {
+		if(check_use(fd) & USE)
+			close(fd, NULL, 0);
+	}
+
 	if(process_count <= 1){
 		printf("Command refused.  Cannot exit last remaining process.\n");
+		if(process_count == 1)
+			image_cache_put(get_pcb(1)->image);
 		process_count = 0;
 
 		/* reinitialize process queue */
@@ -52,38 +104,44 @@ int32_t halt(uint8_t status)
 		}
 
 
-	/* restore the parent's esp and ebp */
-		process_control_block_t* curr_pcb = (process_control_block_t*)(ADDR_8MB - (process_count)*ADDR_8KB);
-		process_control_block_t* parent_pcb = (process_control_block_t*)(curr_pcb->parent_ptr);
-		uint32_t esp_parent = parent_pcb->esp;
-		uint32_t ebp_parent = parent_pcb->ebp;
+	/* find the esp and ebp saved by the parent's execute() call */
+		process_control_block_t* curr_pcb = get_pcb(process_count);
+		uint32_t esp_parent = curr_pcb->esp;
+		uint32_t ebp_parent = curr_pcb->ebp;
 
 
-	/* restore parent's page directory entry */
-		pd_entry_t pde;
+	/* give the program, stack and heap frames back to the pool */
+		user_release(process_count);
+		image_cache_put(curr_pcb->image);
 
-		init_4mb_user_pde(&pde, ADDR_4MB + (process_count - 1)*ADDR_4MB);		/* populate pd entry; first user prog is at 8MB, next at 12MB, etc */
-		pd[PD_IDX_USER] = pde.val;	/* enter page directory entry into page directory */
-
-		/* set cr3 */
-		set_cr3(pd);	/* (flushes TLB) */
+	/* load the parent's page directory; the switch is timed up to the jump
+	 * below, so the kernel TLB misses it causes are counted */
+		rdtsc_low(start_cycles);
+		set_process_pages(process_count - 1);
 
 	/* maybe zero out PCB? and kernel stack? */
    
+	/* free our pcb, fd table and kernel stack. We keep running on that stack until
+	 * the jump below, so nothing may allocate in between (interrupts stay off) */
+	asm volatile("cli");
+	process_free(process_count);
+
 	process_count--;
 
-	tss.esp0 = ADDR_8MB - (process_count)*ADDR_8KB - 4;	/* set address of kernel stack pointer */
+	tss.esp0 = kernel_stack_top(process_count);	/* set address of kernel stack pointer */
 
-	/* update esp and ebp registers with parent's esp and ebp */
-	asm volatile ("pushl %0"
-				:
-				: "c"(esp_parent)); /* puts parent's esp into %esp */
-	asm volatile ("pushl %0"
-				:
-				: "c"(ebp_parent)); /* puts parent's ebp into %ebp */
+	rdtsc_low(end_cycles);
+	sched_switch_done(end_cycles - start_cycles);
 
-	asm volatile ("leave");
-	return 0;	/* we should never reach this line -- now we do b/c of leave instruction?*/
+	/* switch back to the parent's execute() frame and return status from it */
+	asm volatile ("movl %0, %%esp;"
+				  "movl %1, %%ebp;"
+				  "movl %2, %%eax;"
+				  "jmp halt_ret_label"
+				:
+				: "r"(esp_parent), "r"(ebp_parent), "r"(status)
+				: "eax");
+	return 0;	/* we should never reach this line */
 }
 
 
@@ -106,7 +164,7 @@ int32_t execute(const uint8_t* command_param)
 	uint8_t char_space_indices[100];	/* AW assuming we have no more than 100 arguments (separated by a space) */
 	uint8_t exe_buff[4];
 	uint8_t command[MAX_KB_BUF];		/* AW create local array in kernel */
-	process_control_block_t pcb;		/* AW moved this here */
+	process_control_block_t* pcb;
 
 /*	static uint32_t process_count = 0; */	/* static means this should only be zero the first time;
 										 * subsequent function calls will not reset this value.
@@ -160,24 +218,31 @@ int32_t execute(const uint8_t* command_param)
 		strncpy( (int8_t*)program_name, (int8_t*)command, prog_name_len);	/* AW populate program_name string */
 		program_name[prog_name_len] = '\0';									/* AW set null-termination */
 
+		/* a program that ran recently needs no lookup and no checks */
+		snapshot_t* snap = NULL;
+		if(snapshot_enabled)
+			snap = snapshot_find(program_name);
+
 		/* find program in file system */
 		dentry_t program_dentry;
-		ret_val = read_dentry_by_name(program_name, &program_dentry);
-		if( ret_val == -1)
-			return FAIL;		/* if this file name cannot be found, return -1 */
+		if(snap == NULL) {
+			ret_val = read_dentry_by_name(program_name, &program_dentry);
+			if( ret_val == -1)
+				return FAIL;		/* if this file name cannot be found, return -1 */
 
 
 
 	/******* step 2 - check whether file is executable *******/
 		
-		/* read first 4 bytes of inode to see if command is executable */
-		if( read_data(program_dentry.inode, 0, exe_buff, 4) == -1 ) {
-			return FAIL; /* return -1 if file cannot be read */
-		}
-		/* see if executable */
-		if(!(exe_buff[0] == 0x7f && exe_buff[1] == 'E' && exe_buff[2] == 'L' && exe_buff[3] == 'F')){
-			printf("ERROR.  %s is not an executable file.\n", program_name);
-			return FAIL;
+			/* read first 4 bytes of inode to see if command is executable */
+			if( read_data(program_dentry.inode, 0, exe_buff, 4) == -1 ) {
+				return FAIL; /* return -1 if file cannot be read */
+			}
+			/* see if executable */
+			if(!(exe_buff[0] == 0x7f && exe_buff[1] == 'E' && exe_buff[2] == 'L' && exe_buff[3] == 'F')){
+				printf("ERROR.  %s is not an executable file.\n", program_name);
+				return FAIL;
+			}
 		}
 
  do{
@@ -190,59 +255,70 @@ int32_t execute(const uint8_t* command_param)
 		/* making space and aligning our page dir */
 /*		pd_t page_dir __attribute__ ((aligned (BYTES_4KB))); */
 
-		pd_entry_t pde;
-		
 		/* intialize pde */
 		process_count++;		/* extern variable */
-		init_4mb_user_pde(&pde, ADDR_4MB + process_count*ADDR_4MB);		/* populate pd entry; first user prog is at 8MB, next at 12MB, etc */
-		pd[PD_IDX_USER] = pde.val;	/* enter page directory entry into page directory */
 
-		/* set cr3 */
-		set_cr3(pd);	/* (flushes TLB) */
+		/* pcb, fd table and kernel stack; a pid that never halted keeps its own */
+		if(process_alloc(process_count) == FAIL) {
+			printf("ERROR.  Out of memory for %s.\n", program_name);
+			process_count--;
+			return FAIL;
+		}
+		pcb = get_pcb(process_count);
+
+		user_release(process_count);		/* start with an empty address space */
+		set_process_pages(process_count);	/* (flushes user TLB entries) */
 
 
 	/******* step 4 - file loader ****************************/
-		uint8_t* prog_buf = (uint8_t*)(ADDR_128MB + PROG_IMG_OFFSET); 		/* virtual memory address of program image will be 128 MB + program image offset */
+		/* record the loadable segments (their pages, like the stack's, are faulted in
+		 * on first touch) and get the entry point (EIP), from the snapshot if we have one */
+		if((snap != NULL ? snapshot_restore(snap, pcb, process_count) : elf_load(program_dentry.inode, pcb)) == FAIL) {
+			printf("ERROR.  Could not load %s.\n", program_name);
+			user_release(process_count);
+			process_count--;
+			set_process_pages(process_count);
+			return FAIL;
+		}
 
-		inode_t* prog_inode = (inode_t*)((uint8_t*)(fs_info.filesys_ptr) + KB4*(program_dentry.inode + 1)); /* getting inode of the executable */
 
-		read_data(program_dentry.inode, 0, prog_buf, prog_inode->file_length); /* filling physical mem with program */
+		if(snap == NULL && snapshot_enabled)
+			snapshot_save(program_name, pcb);
 
 
 	/******* step 5 - initialize process control block *******/
 
-		args_initialize(command, char_space_indices, num_spaces, &pcb);
+		args_initialize(command, char_space_indices, num_spaces, pcb);
 
 		/* setting pcb parent */
 		if(primary_shell_count >= NUM_TERMINALS)
-			pcb.parent_ptr = (uint32_t)(pq_peak(&process_q)); 	/* if this is not a primary shell
+			pcb->parent_ptr = (uint32_t)(pq_peak(&process_q)); 	/* if this is not a primary shell
 																 * process we set parent pcb pointers */
 		else
-			pcb.parent_ptr = NULL; 		/* if primary shell process, set parent to NULL */
+			pcb->parent_ptr = NULL; 		/* if primary shell process, set parent to NULL */
 
 		/* Setting pcb terminal number */
 		/* If this process has a parent, then it inherits the parent's terminal number.
 		 * Otherwise, it has not parent so it's terminal is the currently displayed terminal. */
-		if(pcb.parent_ptr == NULL)
-			pcb.terminal_num = (NUM_TERMINALS - primary_shell_count - 1);
+		if(pcb->parent_ptr == NULL)
+			pcb->terminal_num = (NUM_TERMINALS - primary_shell_count - 1);
 		else
-			pcb.terminal_num = ((process_control_block_t*)(pcb.parent_ptr))->terminal_num;
+			pcb->terminal_num = ((process_control_block_t*)(pcb->parent_ptr))->terminal_num;
 
 
-		/* get EIP (bytes 24-27 from executable) from prog_buf */
-		pcb.eip = prog_buf[24] + (prog_buf[25] << 8) + (prog_buf[26] << 16) + (prog_buf[27] << 24);
-		
-		pcb.pid = process_count;			/* setting PID from process count */
-		pcb.user_esp = BOTTOM_PAGE - 4;		/* setting user esp */
+		pcb->pid = process_count;			/* setting PID from process count */
+		pcb->user_esp = BOTTOM_PAGE - 4;		/* setting user esp */
+		pcb->heap_brk = HEAP_START;			/* empty heap... */
+		pcb->mmap_base = USER_END;			/* ...and no mappings yet */
 
 		/* setting esp */
 		asm volatile("movl %%esp, %0"
-			:"=g"(pcb.esp)
+			:"=g"(pcb->esp)
 			);
 
 		/* setting ebp */
 		asm volatile("movl %%ebp, %0"
-			:"=g"(pcb.ebp)
+			:"=g"(pcb->ebp)
 			);
 	
 
@@ -250,30 +326,19 @@ int32_t execute(const uint8_t* command_param)
 		init_fd(pcb);
 
 		/* initialize stdin and stdout */
-		pcb.fde[0].fop_ptr = (fops_functions_t*) &fops_terminal_functions;
-		pcb.fde[0].inode = NULL;
-		pcb.fde[0].file_pos = 0;
-		pcb.fde[0].in_use = USE;
+		pcb->fde[0].fop_ptr = (fops_functions_t*) &fops_terminal_functions;
+		pcb->fde[0].inode = 0;
+		pcb->fde[0].file_pos = 0;
+		pcb->fde[0].in_use = USE;
 
-		pcb.fde[1].fop_ptr = (fops_functions_t*) &fops_terminal_functions;
-		pcb.fde[1].inode = NULL;
-		pcb.fde[1].file_pos = 0;
-		pcb.fde[1].in_use = USE;
-
-
-		/* after pcb has been initialized, copy to correct process-kernel-stack 
-		 * Formula to calculate starting address of pcb:
-		   address_of_pcb = 8MB - (8kB * process_id)
-		 */
-		 uint32_t address_of_pcb =  ADDR_8MB - process_count*ADDR_8KB;
-
-
-		 /* copy pcb to space above the kernel stack */
-		 memcpy((uint32_t*)address_of_pcb, &pcb, sizeof(pcb));
+		pcb->fde[1].fop_ptr = (fops_functions_t*) &fops_terminal_functions;
+		pcb->fde[1].inode = 0;
+		pcb->fde[1].file_pos = 0;
+		pcb->fde[1].in_use = USE;
 
 
 		/* Put new process on the front of the queue making it the currently running process */
-		pq_enqueue_front(&process_q, (process_control_block_t*)address_of_pcb);
+		pq_enqueue_front(&process_q, pcb);
 	
 		/* process_control_block_t * tmp_pcb = pq_peak(&process_q);*/	/*statement used for debugging purposes */
 
@@ -291,21 +356,22 @@ int32_t execute(const uint8_t* command_param)
 	} while(primary_shell_count < NUM_TERMINALS);
 
 	/******* step 6 - context switch *************************/
-		tss.esp0 = ADDR_8MB - (process_count)*ADDR_8KB - 4;	/* set address of kernel stack pointer */
+		tss.esp0 = kernel_stack_top(process_count);	/* set address of kernel stack pointer */
 			asm volatile("cli");								/* mask interrupts */
 			asm volatile("movw %0, %%ax" :: "g" (USER_DS));		/* %ax <- USER_DS */
 			asm volatile("movw %%ax, %%ds" :);					/* %ds <- USER_DS */
 			asm volatile("pushl %0" :: "g" (USER_DS));			/* push USER_DS */
-			asm volatile("pushl %0" :: "g" (pcb.user_esp));		/* push user stack pointer */
+			asm volatile("pushl %0" :: "g" (pcb->user_esp));		/* push user stack pointer */
 			asm volatile("pushf");								/* push flags */
 			asm volatile("popl %%eax" :);
 			asm volatile("orl $0x286, %%eax" :::"eax");
 			asm volatile("pushl %%eax" :);
 			asm volatile("pushl %0" :: "g" (USER_CS));
-			asm volatile("pushl %0" :: "g" (pcb.eip));			/* push destination eip */
+			asm volatile("pushl %0" :: "g" (pcb->eip));			/* push destination eip */
 			asm volatile("iret");
-			asm volatile("halt_ret_label:");					/* I don't think we're using this anymore... */
-			asm volatile("ret");								/* since we call return in halt */
+			asm volatile("halt_ret_label:");					/* halt jumps here on our saved esp/ebp with */
+			asm volatile("leave");								/* the status in eax, so this returns it */
+			asm volatile("ret");								/* from execute */
 
 	return FAIL;	/* we should never reach this */
 
@@ -346,6 +412,7 @@ void systemcalls_initialize (void)
 	fops_terminal_functions.function_open = (fops_open_t)term_open;
 	fops_terminal_functions.function_close = (fops_close_t)term_close;
 
+	process_cache_init();
 }
 
 /* args_initialize(const uint8_t * command, uint8_t * char_space_indices, process_control_block_t * current_pblock)
@@ -405,7 +472,7 @@ void args_initialize(const uint8_t * command, uint8_t * char_space_indices, int3
 int32_t read(int32_t fd, void* buf, int32_t nbytes)
 {
 	//Set the correct process control block
-	process_control_block_t* current_pblock = (process_control_block_t*)(ADDR_8MB - process_count*ADDR_8KB);
+	process_control_block_t* current_pblock = get_pcb(process_count);
 	
 	//Test the validity of fd entry
 	if(fd >= 0 && fd < OPS_SIZE)
@@ -436,7 +503,7 @@ int32_t read(int32_t fd, void* buf, int32_t nbytes)
 int32_t write(int32_t fd, const void* buf, int32_t nbytes)
 {
 	//Set the correct process control block
-	process_control_block_t* current_pblock = (process_control_block_t*)(ADDR_8MB - process_count*ADDR_8KB);
+	process_control_block_t* current_pblock = get_pcb(process_count);
 	
 	//Test the validity of fd entry
 	if(fd >= 0 && fd < OPS_SIZE)
@@ -468,7 +535,7 @@ int32_t write(int32_t fd, const void* buf, int32_t nbytes)
 int32_t open(const uint8_t* filename)
 {
 	//Set the correct process control block
-	process_control_block_t* current_pblock = (process_control_block_t*)(ADDR_8MB - process_count*ADDR_8KB);
+	process_control_block_t* current_pblock = get_pcb(process_count);
 	
 	int location;
 	dentry_t file_dentry;
@@ -501,10 +568,15 @@ int32_t open(const uint8_t* filename)
 	}
 	
 	//Initialize the array
-	current_pblock->fde[location].inode = NULL;
+	current_pblock->fde[location].inode = 0;
 	uint32_t fname_len = strlen((int8_t*)filename);							/* AW find length of filename */
-	memcpy(current_pblock->fde[location].file_name, filename, fname_len+1);	/* AW initialize fname */
+	if(fname_len >= FNAME_LENGTH)
+		fname_len = FNAME_LENGTH - 1;		/* a v2 path can be longer than a name */
+	memcpy(current_pblock->fde[location].file_name, filename, fname_len);	/* AW initialize fname */
+	current_pblock->fde[location].file_name[fname_len] = '\0';
 	current_pblock->fde[location].file_pos = 0;
+	current_pblock->fde[location].cursor.block = 0;
+	current_pblock->fde[location].cursor.offset = 0;
 	current_pblock->fde[location].in_use = USE;
 	
 	//Select the correct read/write functions based off of file type
@@ -519,12 +591,14 @@ int32_t open(const uint8_t* filename)
 		//Directory
 		case 1:
 		current_pblock->fde[location].fop_ptr = (fops_functions_t*) &fops_directory_functions;
+		current_pblock->fde[location].inode = file_dentry.inode;
 		break;
 		
 		//Regular File
 		case 2:
 		current_pblock->fde[location].fop_ptr = (fops_functions_t*) &fops_file_functions;
-		current_pblock->fde[location].inode = inode_address(file_dentry.inode);
+		current_pblock->fde[location].inode = file_dentry.inode;
+		fs_inode_open(file_dentry.inode);
 		break;
 		
 		default:
@@ -547,7 +621,7 @@ int32_t open(const uint8_t* filename)
 int32_t close(int32_t fd, const void* buf, int32_t nbytyes)
 {
 	//Set the correct process control block
-	process_control_block_t* current_pblock = (process_control_block_t*)(ADDR_8MB - process_count*ADDR_8KB);
+	process_control_block_t* current_pblock = get_pcb(process_count);
 	
 	//Ensure that it is actually being used
 	if((check_use(fd) & USE) == 0)
@@ -565,6 +639,8 @@ int32_t close(int32_t fd, const void* buf, int32_t nbytyes)
 	if(current_pblock->fde[fd].fop_ptr != NULL)
 	{
 		current_pblock->fde[fd].fop_ptr->function_close();
+		if(current_pblock->fde[fd].fop_ptr == &fops_file_functions)
+			fs_inode_close(current_pblock->fde[fd].inode);	/* may free an unlinked file */
 	}
 	
 	else
@@ -574,7 +650,7 @@ int32_t close(int32_t fd, const void* buf, int32_t nbytyes)
 	
 	//Reset the table entry
 	current_pblock->fde[fd].fop_ptr = NULL;
-	current_pblock->fde[fd].inode = NULL;
+	current_pblock->fde[fd].inode = 0;
 	current_pblock->fde[fd].file_pos = 0;
 	current_pblock->fde[fd].in_use = 0;
 	
@@ -590,7 +666,7 @@ int32_t close(int32_t fd, const void* buf, int32_t nbytyes)
 uint32_t check_use (int32_t fd)
 {
 	/* Set the correct process control block */
-	process_control_block_t* current_pblock = (process_control_block_t*)(ADDR_8MB - process_count*ADDR_8KB);
+	process_control_block_t* current_pblock = get_pcb(process_count);
 
 	/* Ensure there is a given pcb */
 	if(current_pblock != NULL)
@@ -617,7 +693,7 @@ uint32_t check_use (int32_t fd)
 int32_t getargs(uint8_t* buf, int32_t nbytes)
 {
 	/* Set the correct process control block */
-	process_control_block_t* current_pblock = (process_control_block_t*)(ADDR_8MB - process_count*ADDR_8KB);
+	process_control_block_t* current_pblock = get_pcb(process_count);
 	
 	/* Check for valid parameters */
 	if(buf == NULL)
@@ -698,20 +774,20 @@ int32_t sigreturn(void)
 	return FAIL;
 }
 
-/* void init_fd(process_control_block_t pcb)
- * INPUT: 	pcb - set pcb values to null and zero
+/* void init_fd(process_control_block_t* pcb)
+ * INPUT: 	pcb - pcb whose fd table is set to null and zero
  * OUTPUT: 	none
  * DESCRIPTION: initialize pcb
  */
-void init_fd(process_control_block_t pcb)
+void init_fd(process_control_block_t* pcb)
 {
 	int i;
-	for(i = 0; i < 8; i++)
+	for(i = 0; i < OPS_SIZE; i++)
 	{
-		pcb.fde[i].fop_ptr = NULL;
-		pcb.fde[i].inode = NULL;
-		pcb.fde[i].file_pos = 0;
-		pcb.fde[i].in_use = 0;
+		pcb->fde[i].fop_ptr = NULL;
+		pcb->fde[i].inode = 0;
+		pcb->fde[i].file_pos = 0;
+		pcb->fde[i].in_use = 0;
 	}
 
 }
@@ -726,3 +802,950 @@ void init_process_ct()
 {
 	process_count = 0;
 }
+
+
+/* void process_cache_init(void)
+ * INPUT: none
+ * OUTPUT: none
+ * DESCRIPTION: creates the slab caches pcbs and fd tables come from
+ */
+void process_cache_init(void)
+{
+	page_dir[0] = pd;		/* the kernel runs on the boot directory before the first process */
+
+	pcb_cache = kmem_cache_create("pcb", sizeof(process_control_block_t));
+	fd_table_cache = kmem_cache_create("fd_table", OPS_SIZE * sizeof(fd_entry_t));
+}
+
+/* int32_t process_alloc(uint32_t pid)
+ * INPUT: pid - process number
+ * OUTPUT: SUCCESS, or FAIL if out of memory
+ * DESCRIPTION: gives the pid a pcb and fd table from their caches, an 8 kB
+ *				kernel stack from the buddy allocator and a page directory. A pid
+ *				that still has them (it never halted) keeps its own.
+ */
+int32_t process_alloc(uint32_t pid)
+{
+	process_control_block_t* pcb;
+
+	if(pcb_table[pid] != NULL)
+		return SUCCESS;
+
+	pcb = (process_control_block_t*)kmem_cache_alloc(pcb_cache);
+	if(pcb == NULL)
+		return FAIL;
+	memset(pcb, 0, sizeof(process_control_block_t));
+
+	pcb->fde = (fd_entry_t*)kmem_cache_alloc(fd_table_cache);
+	pcb->kernel_stack = buddy_alloc(KERNEL_STACK_ORDER);
+	page_dir[pid] = page_dir_alloc();
+	if(pcb->fde == NULL || pcb->kernel_stack == NULL || page_dir[pid] == NULL) {
+		if(page_dir[pid] != NULL)
+			page_dir_free(page_dir[pid]);
+		page_dir[pid] = NULL;
+		if(pcb->kernel_stack != NULL)
+			buddy_free(pcb->kernel_stack);
+		kmem_cache_free(fd_table_cache, pcb->fde);
+		kmem_cache_free(pcb_cache, pcb);
+		return FAIL;
+	}
+
+	pcb_table[pid] = pcb;
+	return SUCCESS;
+}
+
+/* void process_free(uint32_t pid)
+ * INPUT: pid - process number
+ * OUTPUT: none
+ * DESCRIPTION: returns what process_alloc handed out. The page directory must
+ *				not be loaded any more. Call with interrupts off when freeing the
+ *				stack we are running on.
+ */
+void process_free(uint32_t pid)
+{
+	process_control_block_t* pcb = pcb_table[pid];
+
+	if(pcb == NULL)
+		return;
+
+	pcb_table[pid] = NULL;
+	page_dir_free(page_dir[pid]);
+	page_dir[pid] = NULL;
+	buddy_free(pcb->kernel_stack);
+	kmem_cache_free(fd_table_cache, pcb->fde);
+	kmem_cache_free(pcb_cache, pcb);
+}
+
+/* process_control_block_t* get_pcb(uint32_t pid)
+ * INPUT: pid - process number
+ * OUTPUT: the process's pcb
+ */
+process_control_block_t* get_pcb(uint32_t pid)
+{
+	return pcb_table[pid];
+}
+
+/* uint32_t kernel_stack_top(uint32_t pid)
+ * INPUT: pid - process number
+ * OUTPUT: initial kernel esp of the process, for tss.esp0
+ */
+uint32_t kernel_stack_top(uint32_t pid)
+{
+	return pcb_table[pid]->kernel_stack + KERNEL_STACK_SIZE - 4;
+}
+
+/* void set_process_pages(uint32_t pid)
+ * INPUT: pid - process whose memory should become visible at 128 MB
+ * OUTPUT: none
+ * DESCRIPTION: loads the page directory of the given process. This flushes
+ *				the user TLB entries; the global kernel entries stay.
+ */
+void set_process_pages(uint32_t pid)
+{
+	loaded_pid = pid;
+	set_cr3(page_dir[pid]);
+}
+
+/* void user_invlpg(uint32_t pid, uint32_t vaddr)
+ * INPUT: pid - process whose mapping of vaddr changed
+ *		  vaddr - user virtual address
+ * OUTPUT: none
+ * DESCRIPTION: drops the stale TLB entry, which only exists if pid's
+ *				directory is loaded
+ */
+static void user_invlpg(uint32_t pid, uint32_t vaddr)
+{
+	if(pid == loaded_pid)
+		invlpg(vaddr);
+}
+
+/* uint32_t* user_pte(uint32_t pid, uint32_t vaddr)
+ * INPUT: pid - process owning the address space
+ *		  vaddr - user virtual address in [TOP_PAGE, USER_END)
+ * OUTPUT: pointer to the page table entry that maps vaddr, NULL if there is no
+ *		   page table there (nothing mapped, or a large page)
+ */
+static uint32_t* user_pte(uint32_t pid, uint32_t vaddr)
+{
+	uint32_t pde = page_dir[pid][PD_IDX_USER + ((vaddr - TOP_PAGE) >> 22)];
+
+	if(!(pde & PTE_PRESENT) || (pde & PDE_4MB_PAGE))
+		return NULL;
+
+	return &((uint32_t*)__va(pde & PTE_ADDR_MASK))[(vaddr >> 12) & (PAGE_ENTRY - 1)];
+}
+
+/* uint32_t* user_pte_alloc(uint32_t pid, uint32_t vaddr)
+ * INPUT: pid - process owning the address space
+ *		  vaddr - user virtual address in [TOP_PAGE, USER_END)
+ * OUTPUT: pointer to the page table entry that maps vaddr, NULL if a large page
+ *		   covers vaddr or no memory is left for a page table
+ * DESCRIPTION: like user_pte, but creates the page table on first use
+ */
+static uint32_t* user_pte_alloc(uint32_t pid, uint32_t vaddr)
+{
+	uint32_t idx = (vaddr - TOP_PAGE) >> 22;
+	uint32_t table;
+
+	if(!(page_dir[pid][PD_IDX_USER + idx] & PTE_PRESENT)) {
+		table = alloc_frame();
+		if(table == 0)
+			return NULL;
+		memset((void*)table, 0, BYTES_4KB);
+		page_dir[pid][PD_IDX_USER + idx] = __pa(table) | PTE_USER | PTE_READWRITE | PTE_PRESENT;
+	}
+
+	return user_pte(pid, vaddr);
+}
+
+/* uint32_t user_page_present(uint32_t pid, uint32_t vaddr)
+ * INPUT: pid - process owning the address space
+ *		  vaddr - user virtual address in [TOP_PAGE, USER_END)
+ * OUTPUT: nonzero if a 4 kB page or a large page maps vaddr
+ */
+static uint32_t user_page_present(uint32_t pid, uint32_t vaddr)
+{
+	uint32_t pde = page_dir[pid][PD_IDX_USER + ((vaddr - TOP_PAGE) >> 22)];
+	uint32_t* pte;
+
+	if(pde & PDE_4MB_PAGE)
+		return pde & PTE_PRESENT;
+
+	pte = user_pte(pid, vaddr);
+	return (pte != NULL) && (*pte & (PTE_PRESENT | PTE_SWAP));
+}
+
+/* user_unmap_range(uint32_t pid, uint32_t start, uint32_t end)
+ * INPUT: pid - process owning the address space
+ *		  start, end - page aligned virtual range inside [TOP_PAGE, USER_END)
+ * OUTPUT: none
+ * DESCRIPTION: returns every frame mapped in the range to the allocator. Large
+ *				pages are only released when the range covers them completely.
+ */
+void user_unmap_range(uint32_t pid, uint32_t start, uint32_t end)
+{
+	uint32_t addr, base, idx;
+	uint32_t* pte;
+
+	for(addr = start; addr < end; ) {
+		idx = (addr - TOP_PAGE) >> 22;
+		base = TOP_PAGE + (idx << 22);
+
+		if(!(page_dir[pid][PD_IDX_USER + idx] & PTE_PRESENT) || (page_dir[pid][PD_IDX_USER + idx] & PDE_4MB_PAGE)) {
+			if((page_dir[pid][PD_IDX_USER + idx] & PDE_4MB_PAGE) && start <= base && end >= base + BYTES_4MB) {
+				buddy_free((uint32_t)__va(page_dir[pid][PD_IDX_USER + idx] & PTE_ADDR_MASK));
+				page_dir[pid][PD_IDX_USER + idx] = 0;
+				user_invlpg(pid, base);
+			}
+			addr = base + BYTES_4MB;	/* nothing (else) to do in this 4 MB */
+			continue;
+		}
+
+		pte = user_pte(pid, addr);
+		if(*pte & PTE_PRESENT) {
+			free_frame((uint32_t)__va(*pte & PTE_ADDR_MASK));
+			user_invlpg(pid, addr);
+		} else if(*pte & PTE_SWAP) {
+			zram_free(*pte >> PTE_SWAP_SHIFT);
+		}
+		*pte = 0;
+		addr += BYTES_4KB;
+	}
+}
+
+/* user_map_range(uint32_t pid, uint32_t start, uint32_t end, uint32_t flags)
+ * INPUT: pid - process owning the address space
+ *		  start, end - page aligned virtual range inside [TOP_PAGE, USER_END)
+ *		  flags - PTE_READWRITE for a writable range, 0 for read-only
+ * OUTPUT: SUCCESS, or FAIL if memory cannot cover the range (nothing is mapped then)
+ * DESCRIPTION: backs every page of the range with a zeroed frame. A page that is
+ *				already mapped (or sits in zram) keeps its contents and only gains
+ *				the new permissions.
+ */
+int32_t user_map_range(uint32_t pid, uint32_t start, uint32_t end, uint32_t flags)
+{
+	uint32_t addr, frame, needed, idx;
+	uint32_t* pte;
+
+	/* count the frames and page tables the range still needs */
+	needed = 0;
+	for(addr = start; addr < end; addr += BYTES_4KB) {
+		idx = (addr - TOP_PAGE) >> 22;
+		if(page_dir[pid][PD_IDX_USER + idx] & PDE_4MB_PAGE)
+			return FAIL;
+		if(!(page_dir[pid][PD_IDX_USER + idx] & PTE_PRESENT) && (addr == start || (addr & (BYTES_4MB - 1)) == 0))
+			needed++;
+		if(!user_page_present(pid, addr))
+			needed++;
+	}
+	if(needed > free_frame_count())
+		return FAIL;
+
+	for(addr = start; addr < end; addr += BYTES_4KB) {
+		pte = user_pte_alloc(pid, addr);
+		if(*pte & (PTE_PRESENT | PTE_SWAP)) {
+			if((flags & PTE_READWRITE) && !(*pte & PTE_READWRITE)) {
+				*pte |= PTE_READWRITE;
+				user_invlpg(pid, addr);
+			}
+			continue;
+		}
+		frame = alloc_frame();
+		memset((void*)frame, 0, BYTES_4KB);
+		*pte = __pa(frame) | PTE_USER | (flags & PTE_READWRITE) | PTE_PRESENT;
+	}
+
+	return SUCCESS;
+}
+
+/* int32_t user_map_frame(uint32_t pid, uint32_t vaddr, uint32_t frame, uint32_t flags)
+ * INPUT: pid - process owning the address space
+ *		  vaddr - page aligned user virtual address that is not mapped yet
+ *		  frame - kernel address of the page to map there; the caller hands over
+ *				  one reference
+ *		  flags - PTE_READWRITE for a writable page, PTE_COW for a shared page that
+ *				  becomes private on the first write, 0 for read-only
+ * OUTPUT: SUCCESS, or FAIL if no page table could be set up (the reference is
+ *		   then still the caller's)
+ * DESCRIPTION: installs a single user page. No TLB flush is needed since the
+ *				entry was not present before.
+ */
+int32_t user_map_frame(uint32_t pid, uint32_t vaddr, uint32_t frame, uint32_t flags)
+{
+	uint32_t* pte = user_pte_alloc(pid, vaddr);
+
+	if(pte == NULL)
+		return FAIL;
+
+	*pte = __pa(frame & PTE_ADDR_MASK) | PTE_USER | (flags & (PTE_READWRITE | PTE_COW)) | PTE_PRESENT;
+	return SUCCESS;
+}
+
+/* int32_t user_cow_fault(uint32_t pid, uint32_t addr)
+ * INPUT: pid - process owning the address space
+ *		  addr - address of a write that hit a read-only page
+ * OUTPUT: SUCCESS if the page was copy-on-write and is now privately writable,
+ *		   FAIL for a real protection violation or when memory runs out
+ * DESCRIPTION: gives the writer its own copy of a shared page. If nobody else holds
+ *				the frame any more it is simply made writable in place.
+ */
+int32_t user_cow_fault(uint32_t pid, uint32_t addr)
+{
+	uint32_t* pte;
+	uint32_t old_frame, new_frame;
+
+	if(addr < TOP_PAGE || addr >= USER_END)
+		return FAIL;
+
+	pte = user_pte(pid, addr);
+	if(pte == NULL || !(*pte & PTE_PRESENT) || !(*pte & PTE_COW))
+		return FAIL;
+
+	old_frame = (uint32_t)__va(*pte & PTE_ADDR_MASK);
+	if(frame_ref_count(old_frame) == 1) {
+		*pte = (*pte & ~PTE_COW) | PTE_READWRITE;
+	} else {
+		new_frame = alloc_frame();
+		if(new_frame == 0)
+			return FAIL;
+		memcpy((void*)new_frame, (void*)old_frame, BYTES_4KB);
+		*pte = __pa(new_frame) | PTE_USER | PTE_READWRITE | PTE_PRESENT;
+		free_frame(old_frame);
+	}
+	user_invlpg(pid, addr);
+
+	return SUCCESS;
+}
+
+/* int32_t user_swap_fault(uint32_t pid, uint32_t addr)
+ * INPUT: pid - process owning the address space
+ *		  addr - address of a not-present fault
+ * OUTPUT: SUCCESS if the page was in zram and is mapped again, FAIL if it was
+ *		   not evicted or no frame is left
+ * DESCRIPTION: decompresses the page into a new frame with its old permissions
+ */
+int32_t user_swap_fault(uint32_t pid, uint32_t addr)
+{
+	uint32_t* pte;
+	uint32_t frame, slot, start_cycles, end_cycles;
+
+	if(addr < TOP_PAGE || addr >= USER_END)
+		return FAIL;
+
+	pte = user_pte(pid, addr);
+	if(pte == NULL || (*pte & PTE_PRESENT) || !(*pte & PTE_SWAP))
+		return FAIL;
+
+	rdtsc_low(start_cycles);
+	frame = alloc_frame();
+	if(frame == 0)
+		return FAIL;
+	slot = *pte >> PTE_SWAP_SHIFT;
+	if(zram_load(slot, frame) == FAIL) {
+		free_frame(frame);
+		return FAIL;
+	}
+	zram_free(slot);
+	*pte = __pa(frame) | (*pte & (PTE_USER | PTE_READWRITE | PTE_COW)) | PTE_PRESENT;
+
+	rdtsc_low(end_cycles);
+	zram_fault_done(end_cycles - start_cycles);
+	return SUCCESS;
+}
+
+/* uint32_t* user_hand_next(user_hand_t* hand, uint32_t* vaddr)
+ * INPUT: hand - clock hand to move
+ *		  vaddr - set to the address of the returned entry
+ * OUTPUT: the entry under the hand if it maps a present 4 kB page of hand->pid,
+ *		   NULL if this step found nothing
+ * DESCRIPTION: one step of a clock over the user pages of every process that is
+ *				not running. The running process and one being set up are
+ *				passed over whole, so their entries never change under them and
+ *				whatever the caller writes needs no TLB flush. Empty or large
+ *				page directory entries are passed over 4 MB at a time.
+ */
+static uint32_t* user_hand_next(user_hand_t* hand, uint32_t* vaddr)
+{
+	uint32_t pde;
+	uint32_t* pte;
+
+	if(hand->addr < TOP_PAGE || hand->addr >= USER_END) {
+		hand->addr = TOP_PAGE;
+		hand->pid = hand->pid % MAX_PROCESSES + 1;
+	}
+
+	if(page_dir[hand->pid] == NULL || hand->pid == loaded_pid || hand->pid == process_count) {
+		hand->addr = USER_END;
+		return NULL;
+	}
+
+	pde = page_dir[hand->pid][PD_IDX_USER + ((hand->addr - TOP_PAGE) >> 22)];
+	if(!(pde & PTE_PRESENT) || (pde & PDE_4MB_PAGE)) {
+		hand->addr = (hand->addr & ~(BYTES_4MB - 1)) + BYTES_4MB;
+		return NULL;
+	}
+
+	*vaddr = hand->addr;
+	pte = user_pte(hand->pid, hand->addr);
+	hand->addr += BYTES_4KB;
+	return (*pte & PTE_PRESENT) ? pte : NULL;
+}
+
+/* uint32_t user_reclaim(uint32_t target)
+ * INPUT: target - pages to evict
+ * OUTPUT: pages actually evicted
+ * DESCRIPTION: a clock over the user pages of idle processes, resumed where the
+ *				last call stopped. A page whose accessed bit is set gets the bit
+ *				cleared and a second chance; one that was not touched since the
+ *				hand last passed is compressed into zram and its frame freed.
+ *				Only frames the process owns alone are taken; shared program
+ *				pages and fs blocks stay. At most ZRAM_SCAN_MAX entries are
+ *				looked at per call.
+ */
+uint32_t user_reclaim(uint32_t target)
+{
+	static user_hand_t hand = { 1, TOP_PAGE };
+	uint32_t scanned, evicted, vaddr, frame, slot;
+	uint32_t* pte;
+
+	evicted = 0;
+	for(scanned = 0; scanned < ZRAM_SCAN_MAX && evicted < target; scanned++) {
+		pte = user_hand_next(&hand, &vaddr);
+		if(pte == NULL)
+			continue;
+		if(*pte & PTE_ACCESSED) {
+			*pte &= ~PTE_ACCESSED;
+			continue;
+		}
+
+		frame = (uint32_t)__va(*pte & PTE_ADDR_MASK);
+		if(frame_ref_count(frame) != 1)
+			continue;
+		slot = zram_store(frame);
+		if(slot == ZRAM_NONE)
+			continue;
+
+		*pte = (slot << PTE_SWAP_SHIFT) | PTE_SWAP | (*pte & (PTE_USER | PTE_READWRITE | PTE_COW));
+		free_frame(frame);
+		evicted++;
+	}
+
+	return evicted;
+}
+
+/* uint32_t user_merge(uint32_t budget)
+ * INPUT: budget - pages to hash
+ * OUTPUT: pages merged away by this call
+ * DESCRIPTION: same-page merging over the user pages of idle processes. Every
+ *				private page the clock passes is hashed and looked up in the
+ *				ksm table. A page with the same contents there takes its place:
+ *				both mappings become read-only copy-on-write on the one frame
+ *				and the duplicate frame is freed. A page without a match is
+ *				recorded as a candidate for later pages. Runs with interrupts
+ *				off so a terminal switch cannot load a directory mid-update.
+ */
+uint32_t user_merge(uint32_t budget)
+{
+	static user_hand_t hand = { 1, TOP_PAGE };
+	uint32_t scanned, hashed, merged, vaddr, frame, hash, flags;
+	uint32_t* pte;
+	uint32_t* other;
+	ksm_entry_t* entry;
+
+	cli_and_save(flags);
+
+	merged = 0;
+	hashed = 0;
+	for(scanned = 0; scanned < KSM_SCAN_MAX && hashed < budget; scanned++) {
+		pte = user_hand_next(&hand, &vaddr);
+		if(pte == NULL)
+			continue;
+		frame = (uint32_t)__va(*pte & PTE_ADDR_MASK);
+		if(frame_ref_count(frame) != 1)
+			continue;
+
+		hashed++;
+		hash = ksm_hash(frame);
+		entry = ksm_lookup(hash, frame);
+		if(entry == NULL) {
+			ksm_insert(hash, frame, hand.pid, vaddr);
+			continue;
+		}
+		if(entry->frame == frame)
+			continue;
+
+		/* a candidate still has to be the private page it was when recorded;
+		 * it is write-protected and becomes the shared copy */
+		if(entry->pid != 0) {
+			other = NULL;
+			if(page_dir[entry->pid] != NULL && entry->pid != loaded_pid && entry->pid != process_count)
+				other = user_pte(entry->pid, entry->vaddr);
+			if(other == NULL || !(*other & PTE_PRESENT) || (*other & PTE_ADDR_MASK) != __pa(entry->frame) ||
+			   frame_ref_count(entry->frame) != 1) {
+				ksm_remove(entry);
+				ksm_insert(hash, frame, hand.pid, vaddr);
+				continue;
+			}
+			if(*other & PTE_READWRITE)
+				*other = (*other & ~PTE_READWRITE) | PTE_COW;
+			ksm_make_stable(entry);
+		}
+
+		get_frame(entry->frame);
+		*pte = __pa(entry->frame) | (*pte & PTE_USER) | PTE_PRESENT |
+			   ((*pte & (PTE_READWRITE | PTE_COW)) ? PTE_COW : 0);
+		free_frame(frame);
+		merged++;
+	}
+
+	restore_flags(flags);
+	return merged;
+}
+
+/* int32_t user_zero_fault(uint32_t pid, uint32_t addr)
+ * INPUT: pid - process owning the address space
+ *		  addr - address of a not-present fault
+ * OUTPUT: SUCCESS if addr lies in the stack or the heap and now has a page,
+ *		   FAIL otherwise, for a page of the program's segments, or when
+ *		   memory runs out
+ * DESCRIPTION: the stack and the heap start out empty and get a zeroed page on
+ *				first touch. The stack grows down to USER_STACK_MAX below
+ *				BOTTOM_PAGE, the heap up to the program break.
+ */
+int32_t user_zero_fault(uint32_t pid, uint32_t addr)
+{
+	process_control_block_t* pcb = get_pcb(pid);
+	user_segment_t* seg;
+	uint32_t page = addr & PAGE_MASK_4KB;
+	uint32_t in_stack, in_heap, i;
+
+	if(pcb == NULL)
+		return FAIL;
+
+	in_stack = (addr >= BOTTOM_PAGE - USER_STACK_MAX && addr < BOTTOM_PAGE);
+	in_heap = (addr >= HEAP_START && addr < pcb->heap_brk);
+	if(!in_stack && !in_heap)
+		return FAIL;
+
+	/* a program page elf_page_fault could not read is not heap */
+	for(i = 0; i < pcb->num_segments; i++) {
+		seg = &pcb->segments[i];
+		if(seg->vaddr < page + BYTES_4KB && seg->vaddr + seg->memsz > page)
+			return FAIL;
+	}
+
+	return user_map_range(pid, page, page + BYTES_4KB, PTE_READWRITE);
+}
+
+/* void user_release(uint32_t pid)
+ * INPUT: pid - process whose address space is torn down
+ * OUTPUT: none
+ * DESCRIPTION: frees every program, stack, heap and mmap frame of the process,
+ *				then its page tables
+ */
+void user_release(uint32_t pid)
+{
+	uint32_t i;
+
+	user_unmap_range(pid, TOP_PAGE, USER_END);
+
+	for(i = 0; i < NUM_USER_PDE; i++) {
+		if(page_dir[pid][PD_IDX_USER + i] & PTE_PRESENT) {
+			free_frame((uint32_t)__va(page_dir[pid][PD_IDX_USER + i] & PTE_ADDR_MASK));
+			user_invlpg(pid, TOP_PAGE + (i << 22));	/* drops the cached directory entry too */
+		}
+		page_dir[pid][PD_IDX_USER + i] = 0;
+	}
+}
+
+/* int32_t brk(uint32_t new_brk)
+ * INPUT: new_brk - requested end of the heap, or 0 to query the current break
+ * OUTPUT: the (new) program break, -1 on failure
+ * DESCRIPTION: grows or shrinks the heap. Growing only moves the break; the pages
+ *				get zeroed frames when first touched (user_zero_fault). Growth is
+ *				refused past the mmap area or beyond the free memory. Pages are
+ *				given back when the break retreats.
+ */
+int32_t brk(uint32_t new_brk)
+{
+	process_control_block_t* current_pblock = get_pcb(process_count);
+	uint32_t old_end, new_end;
+
+	if(new_brk == 0)
+		return current_pblock->heap_brk;
+
+	if(new_brk < HEAP_START || new_brk > current_pblock->mmap_base)
+		return FAIL;
+
+	/* first page boundary past the old and the new heap */
+	old_end = (current_pblock->heap_brk + BYTES_4KB - 1) & PAGE_MASK_4KB;
+	new_end = (new_brk + BYTES_4KB - 1) & PAGE_MASK_4KB;
+
+	if(new_end > old_end) {
+		if((new_end - old_end) / BYTES_4KB > free_frame_count())
+			return FAIL;
+	} else if(new_end < old_end) {
+		user_unmap_range(process_count, new_end, old_end);
+	}
+
+	current_pblock->heap_brk = new_brk;
+	return new_brk;
+}
+
+/* int32_t mmap_large(uint32_t length)
+ * INPUT: length - number of bytes wanted (rounded up to whole 4 MB pages)
+ * OUTPUT: 4 MB aligned address of a zero-filled mapping, -1 on failure
+ * DESCRIPTION: maps whole 4 MB blocks from the buddy allocator with PSE page
+ *				directory entries, one TLB entry each, in the highest run of empty
+ *				page directory slots above the heap
+ */
+static int32_t mmap_large(uint32_t length)
+{
+	process_control_block_t* current_pblock = get_pcb(process_count);
+	uint32_t num_pages, run, idx, low_idx, i, frame;
+
+	num_pages = (length + BYTES_4MB - 1) / BYTES_4MB;
+	low_idx = (current_pblock->heap_brk + BYTES_4MB - 1 - TOP_PAGE) >> 22;
+
+	run = 0;
+	for(idx = NUM_USER_PDE; idx-- > low_idx; ) {
+		if(page_dir[process_count][PD_IDX_USER + idx] & PTE_PRESENT) {
+			run = 0;
+			continue;
+		}
+		if(++run == num_pages)
+			break;
+	}
+	if(run < num_pages)
+		return FAIL;
+
+	for(i = 0; i < num_pages; i++) {
+		frame = buddy_alloc(BUDDY_MAX_ORDER);
+		if(frame == 0) {
+			user_unmap_range(process_count, TOP_PAGE + (idx << 22), TOP_PAGE + ((idx + i) << 22));
+			return FAIL;
+		}
+		memset((void*)frame, 0, BYTES_4MB);
+		page_dir[process_count][PD_IDX_USER + (idx + i)] = __pa(frame) | PDE_4MB_PAGE | PTE_USER | PTE_READWRITE | PTE_PRESENT;
+	}
+
+	if(TOP_PAGE + (idx << 22) < current_pblock->mmap_base)
+		current_pblock->mmap_base = TOP_PAGE + (idx << 22);
+
+	return TOP_PAGE + (idx << 22);
+}
+
+/* int32_t mmap(uint32_t length, uint32_t flags)
+ * INPUT: length - number of bytes wanted (rounded up to whole pages)
+ *		  flags - MMAP_LARGE to back the mapping with 4 MB pages
+ * OUTPUT: address of a zero-filled anonymous mapping, -1 on failure
+ * DESCRIPTION: finds the highest free run of pages between the heap and USER_END
+ */
+int32_t mmap(uint32_t length, uint32_t flags)
+{
+	process_control_block_t* current_pblock = get_pcb(process_count);
+	uint32_t num_pages, run, addr, low;
+
+	if(length == 0 || length > USER_END - HEAP_START)
+		return FAIL;
+
+	if(flags & MMAP_LARGE)
+		return mmap_large(length);
+
+	num_pages = (length + BYTES_4KB - 1) / BYTES_4KB;
+	low = (current_pblock->heap_brk + BYTES_4KB - 1) & PAGE_MASK_4KB;
+
+	/* walk down from the top of the window looking for num_pages free entries in a row.
+	 * A 4 MB stretch without a page table is skipped in one step. */
+	run = 0;
+	for(addr = USER_END - BYTES_4KB; addr >= low; addr -= BYTES_4KB) {
+		if((addr & (BYTES_4MB - 1)) == BYTES_4MB - BYTES_4KB && addr - (BYTES_4MB - BYTES_4KB) >= low &&
+		   !(page_dir[process_count][PD_IDX_USER + ((addr - TOP_PAGE) >> 22)] & PTE_PRESENT)) {
+			if(run + PAGE_ENTRY >= num_pages) {
+				addr -= (num_pages - run - 1) * BYTES_4KB;
+				run = num_pages;
+				break;
+			}
+			run += PAGE_ENTRY;
+			addr -= BYTES_4MB - BYTES_4KB;
+			continue;
+		}
+		if(user_page_present(process_count, addr)) {
+			run = 0;
+			continue;
+		}
+		if(++run == num_pages)
+			break;
+	}
+	if(run < num_pages)
+		return FAIL;
+
+	if(user_map_range(process_count, addr, addr + num_pages*BYTES_4KB, PTE_READWRITE) == FAIL)
+		return FAIL;
+
+	if(addr < current_pblock->mmap_base)
+		current_pblock->mmap_base = addr;
+
+	return addr;
+}
+
+/* int32_t munmap(void* addr, uint32_t length)
+ * INPUT: addr - page aligned start of a range returned by mmap
+ *		  length - number of bytes to unmap (rounded up to whole pages)
+ * OUTPUT: SUCCESS, or FAIL for a range outside the mmap area or one that splits
+ *		   a large page
+ * DESCRIPTION: releases the pages of an anonymous mapping
+ */
+int32_t munmap(void* addr, uint32_t length)
+{
+	process_control_block_t* current_pblock = get_pcb(process_count);
+	uint32_t start = (uint32_t)addr;
+	uint32_t end = start + ((length + BYTES_4KB - 1) & PAGE_MASK_4KB);
+	uint32_t idx;
+
+	if((start & ~PAGE_MASK_4KB) != 0 || length == 0)
+		return FAIL;
+	if(start < current_pblock->mmap_base || end > USER_END || end <= start)
+		return FAIL;
+
+	/* large pages go away whole or not at all */
+	for(idx = (start - TOP_PAGE) >> 22; idx <= (end - 1 - TOP_PAGE) >> 22; idx++) {
+		if((page_dir[process_count][PD_IDX_USER + idx] & PDE_4MB_PAGE) &&
+		   (start > TOP_PAGE + (idx << 22) || end < TOP_PAGE + ((idx + 1) << 22)))
+			return FAIL;
+	}
+
+	user_unmap_range(process_count, start, end);
+
+	/* let the heap grow back into space freed at the bottom of the mmap area */
+	while(current_pblock->mmap_base < USER_END &&
+		  !user_page_present(process_count, current_pblock->mmap_base))
+		current_pblock->mmap_base += BYTES_4KB;
+
+	return SUCCESS;
+}
+
+/* int32_t sysctl(uint32_t key, int32_t value)
+ * INPUT: key - which kernel setting (SYSCTL_*)
+ *		  value - new value, or -1 to only query
+ * OUTPUT: the previous value, -1 for an unknown key or a bad value
+ * DESCRIPTION: runtime switches for kernel features, mainly so user programs can
+ *				benchmark with and without them
+ */
+int32_t sysctl(uint32_t key, int32_t value)
+{
+	switch(key) {
+		case SYSCTL_SNAPSHOT:
+			return snapshot_set_enabled(value);
+		case SYSCTL_MEM_TOTAL:
+			return (value == -1) ? buddy_total_pages() : FAIL;
+		case SYSCTL_MEM_FREE:
+			return (value == -1) ? buddy_free_pages() : FAIL;
+		case SYSCTL_GLOBAL_PAGES:
+			return set_global_pages(value);
+		case SYSCTL_SWITCH_CYCLES:
+			return (value == -1) ? sched_switch_cycles() : FAIL;
+		case SYSCTL_ZRAM_PAGES:
+			return (value == -1) ? zram_pages() : FAIL;
+		case SYSCTL_ZRAM_RATIO:
+			return (value == -1) ? zram_ratio() : FAIL;
+		case SYSCTL_ZRAM_FAULT_CYCLES:
+			return (value == -1) ? zram_fault_cycles() : FAIL;
+		case SYSCTL_ZRAM_RECLAIM:
+			return (value > 0) ? user_reclaim(value) : FAIL;
+		case SYSCTL_KSM:
+			return ksm_enable(value);
+		case SYSCTL_KSM_SAVED:
+			return (value == -1) ? ksm_pages_saved() : FAIL;
+		case SYSCTL_FS_CACHE_HITS:
+			return (value == -1) ? fscache_hits() : FAIL;
+		case SYSCTL_FS_CACHE_MISSES:
+			return (value == -1) ? fscache_misses() : FAIL;
+		case SYSCTL_DISK_BLOCKS:
+			return (value == -1) ? ata_blocks() : FAIL;
+		case SYSCTL_DISK_SEQ:
+			return (value > 0) ? ata_bench(value, 0) : FAIL;
+		case SYSCTL_DISK_RANDOM:
+			return (value > 0) ? ata_bench(value, 1) : FAIL;
+		default:
+			return FAIL;
+	}
+}
+
+/* int32_t create(const uint8_t* filename)
+ * INPUT: filename - name of the new file
+ * OUTPUT: SUCCESS, or FAIL if the name is taken or invalid or the directory is full
+ * DESCRIPTION: adds an empty regular file; open it to write
+ */
+int32_t create(const uint8_t* filename)
+{
+	return fs_create(filename);
+}
+
+/* int32_t unlink(const uint8_t* filename)
+ * INPUT: filename - regular file to remove
+ * OUTPUT: SUCCESS, or FAIL if there is no such file or a process is running it
+ * DESCRIPTION: descriptors already open on the file keep working until closed
+ */
+int32_t unlink(const uint8_t* filename)
+{
+	return fs_unlink(filename);
+}
+
+/* int32_t truncate(int32_t fd, uint32_t length)
+ * INPUT: fd - descriptor of an open regular file
+ *		  length - new length in bytes
+ * OUTPUT: SUCCESS, or FAIL for a bad descriptor or when memory runs out
+ * DESCRIPTION: cuts the file or grows it with zeroes; the file position stays
+ */
+int32_t truncate(int32_t fd, uint32_t length)
+{
+	process_control_block_t* current_pblock = get_pcb(process_count);
+
+	if(fd <= INDEX || fd >= OPS_SIZE || current_pblock == NULL)
+		return FAIL;
+	if(!(check_use(fd) & USE) || current_pblock->fde[fd].fop_ptr != &fops_file_functions)
+		return FAIL;
+
+	return fs_truncate(current_pblock->fde[fd].inode, length);
+}
+
+/* int32_t getdents(int32_t fd, dirent_t* buf, int32_t nbytes)
+ * INPUT: fd - descriptor of an open directory
+ *		  buf - room for records
+ *		  nbytes - size of buf
+ * OUTPUT: bytes filled, a multiple of sizeof(dirent_t); 0 after the last entry,
+ *		   FAIL for a bad descriptor, a buffer too small for one record or one
+ *		   that is not all user memory
+ * DESCRIPTION: reads as many directory entries as fit, continuing where the
+ *				last read of the descriptor stopped
+ */
+int32_t getdents(int32_t fd, dirent_t* buf, int32_t nbytes)
+{
+	process_control_block_t* current_pblock = get_pcb(process_count);
+
+	if(fd <= INDEX || fd >= OPS_SIZE || current_pblock == NULL || buf == NULL)
+		return FAIL;
+	if(!(check_use(fd) & USE) || current_pblock->fde[fd].fop_ptr != &fops_directory_functions)
+		return FAIL;
+	if(nbytes < (int32_t)sizeof(dirent_t) || bad_userspace_addr(buf, nbytes))
+		return FAIL;
+
+	return read_dirents(fd, buf, nbytes / sizeof(dirent_t)) * sizeof(dirent_t);
+}
+
+/* int32_t stat(const uint8_t* filename, fs_stat_t* buf)
+ * INPUT: filename - file to look up
+ *		  buf - filled in
+ * OUTPUT: SUCCESS, or FAIL if there is no such file or a pointer is not to
+ *		   user memory
+ * DESCRIPTION: size, type, inode and block count without opening the file.
+ *				The name is copied in first, so the lookup never reads past
+ *				the end of user memory.
+ */
+int32_t stat(const uint8_t* filename, fs_stat_t* buf)
+{
+	dentry_t file_dentry;
+	uint8_t name[FS_PATH_MAX + 1];		/* the most the lookup reads, and its null */
+
+	if(bad_userspace_addr(buf, sizeof(fs_stat_t)))
+		return FAIL;
+	if(safe_strncpy((int8_t*)name, (const int8_t*)filename, sizeof(name)) == -1)
+		return FAIL;
+	if(read_dentry_by_name(name, &file_dentry) == -1)
+		return FAIL;
+
+	return fs_stat(file_dentry.type, file_dentry.inode, buf);
+}
+
+/* int32_t fstat(int32_t fd, fs_stat_t* buf)
+ * INPUT: fd - descriptor of an open file, directory or rtc
+ *		  buf - filled in
+ * OUTPUT: SUCCESS, or FAIL for a bad descriptor, the terminal or a buffer
+ *		   that is not user memory
+ * DESCRIPTION: the size is the file's length now, writes since open included
+ */
+int32_t fstat(int32_t fd, fs_stat_t* buf)
+{
+	process_control_block_t* current_pblock = get_pcb(process_count);
+	fops_functions_t* fops;
+	uint32_t type;
+
+	if(fd <= INDEX || fd >= OPS_SIZE || current_pblock == NULL || bad_userspace_addr(buf, sizeof(fs_stat_t)))
+		return FAIL;
+	if(!(check_use(fd) & USE))
+		return FAIL;
+
+	fops = current_pblock->fde[fd].fop_ptr;
+	if(fops == &fops_file_functions)
+		type = FILE_TYPE_REGULAR;
+	else if(fops == &fops_directory_functions)
+		type = FILE_TYPE_DIRECTORY;
+	else if(fops == &fops_rtc_functions)
+		type = FILE_TYPE_RTC;
+	else
+		return FAIL;
+
+	return fs_stat(type, current_pblock->fde[fd].inode, buf);
+}
+
+/* int32_t sendfile(int32_t out_fd, int32_t in_fd, int32_t count)
+ * INPUT: out_fd - descriptor of the terminal other than stdin
+ *		  in_fd - descriptor of an open regular file
+ *		  count - most bytes to send
+ * OUTPUT: bytes sent, 0 at the end of the file, FAIL for bad descriptors or
+ *		   if nothing could be sent
+ * DESCRIPTION: hands file data to the terminal where it lies in the image or
+ *				the overlay, instead of copying it to the caller and back. The
+ *				blocks of a compressed image move around, so those go through
+ *				a small buffer on the kernel stack. The file position moves past
+ *				the bytes sent.
+ */
+int32_t sendfile(int32_t out_fd, int32_t in_fd, int32_t count)
+{
+	process_control_block_t* current_pblock = get_pcb(process_count);
+	uint8_t bounce[SENDFILE_BOUNCE];
+	fd_entry_t* in;
+	fops_functions_t* out;
+	uint8_t* data;
+	int32_t sent, len;
+
+	if(in_fd <= INDEX || in_fd >= OPS_SIZE || out_fd < 0 || out_fd >= OPS_SIZE || current_pblock == NULL)
+		return FAIL;
+	if(!(check_use(in_fd) & USE) || current_pblock->fde[in_fd].fop_ptr != &fops_file_functions)
+		return FAIL;
+	if(out_fd == 0)		/* stdin is the keyboard, as in write */
+		return FAIL;
+	if(!(check_use(out_fd) & USE) || current_pblock->fde[out_fd].fop_ptr != &fops_terminal_functions)
+		return FAIL;
+	if(count < 0)
+		return FAIL;
+
+	in = &current_pblock->fde[in_fd];
+	out = current_pblock->fde[out_fd].fop_ptr;
+	for(sent = 0; sent < count; sent += len) {
+		len = fs_map(in->inode, in->file_pos, count - sent, &data);
+		if(len == -1) {
+			data = bounce;
+			len = read_cursor(in->inode, in->file_pos, &in->cursor, bounce,
+							  (count - sent < SENDFILE_BOUNCE) ? count - sent : SENDFILE_BOUNCE);
+		}
+		if(len <= 0 || out->function_write(out_fd, data, len) == FAIL)
+			return (sent == 0 && len != 0) ? FAIL : sent;
+		in->file_pos += len;
+	}
+
+	return sent;
+}
+
+/* int32_t sync(void)
+ * INPUT: none
+ * OUTPUT: SUCCESS, or FAIL if the file system is not on a disk or cannot be
+ *		   written back now
+ * DESCRIPTION: makes the files written, created and unlinked since the disk
+ *				was mounted survive a reboot
+ */
+int32_t sync(void)
+{
+	return fs_sync();
+}
@@ -41,6 +41,35 @@
 #define BOTTOM_PAGE		0x08400000
 #define VID_MEM 		0x000B8000
 #define PD_IDX_VID		0x40
+#define USER_END		KERNEL_VBASE	/* user memory is [TOP_PAGE, USER_END); the kernel half starts there */
+#define NUM_USER_PDE	((USER_END - TOP_PAGE) >> 22)	/* page directory entries per process */
+#define HEAP_START		0x08400000	/* heap grows up from here, anonymous mmaps grow down from USER_END */
+#define PAGE_MASK_4KB	0xFFFFF000
+#define USER_STACK_MAX	0x00100000	/* the stack grows down from BOTTOM_PAGE by at most this much */
+#define MMAP_LARGE		0x1			/* mmap flag: back the mapping with 4 MB pages */
+#define KERNEL_STACK_ORDER	1		/* kernel stack: one 8 kB buddy block */
+#define KERNEL_STACK_SIZE	0x2000
+#define SENDFILE_BOUNCE		256		/* bytes sendfile copies at a time when it cannot map them */
+#define EXCEPTION_STATUS	256		/* what execute returns when the program died from an exception */
+#define MAX_SEGMENTS	4			/* loadable ELF segments remembered per process */
+
+/* sysctl keys */
+#define SYSCTL_SNAPSHOT	0			/* execute() snapshot cache on/off */
+#define SYSCTL_MEM_TOTAL	1		/* read only: 4 kB pages the buddy allocator manages */
+#define SYSCTL_MEM_FREE		2		/* read only: 4 kB pages currently free */
+#define SYSCTL_GLOBAL_PAGES	3		/* kernel TLB entries survive cr3 loads (CR4.PGE) on/off */
+#define SYSCTL_SWITCH_CYCLES	4	/* read only: average cycles per address space switch since the last read */
+#define SYSCTL_ZRAM_PAGES	5		/* read only: user pages held compressed */
+#define SYSCTL_ZRAM_RATIO	6		/* read only: their compression ratio times 100 */
+#define SYSCTL_ZRAM_FAULT_CYCLES	7	/* read only: average cycles per zram fault since the last read */
+#define SYSCTL_ZRAM_RECLAIM	8		/* evict up to value pages of idle processes now; returns how many */
+#define SYSCTL_KSM			9		/* background same-page merging: 1 on, 0 off */
+#define SYSCTL_KSM_SAVED	10		/* read only: frames saved by merged pages */
+#define SYSCTL_FS_CACHE_HITS	11	/* read only: compressed or on-disk fs image blocks found cached */
+#define SYSCTL_FS_CACHE_MISSES	12	/* read only: those decompressed or read from disk */
+#define SYSCTL_DISK_BLOCKS	13		/* read only: 4 kB blocks on the ATA disk, 0 without one */
+#define SYSCTL_DISK_SEQ		14		/* read value kB from the disk's start; returns average cycles per kB */
+#define SYSCTL_DISK_RANDOM	15		/* value random 4 kB disk reads; returns average cycles per kB */
 
 	
 typedef int32_t(*fops_open_t)(void);
@@ -57,12 +86,22 @@ typedef struct fops_functions {
 
 typedef struct fd_entry_t {
 	fops_functions_t * fop_ptr;
-	inode_t * inode;
+	uint32_t inode;						/* inode number of a regular file or v2 directory */
 	uint8_t file_name[FNAME_LENGTH];	/* AW added as a hack to try to get read_file to work */
 	uint32_t file_pos;
+	file_cursor_t cursor;				/* file_pos as a data block and offset */
 	uint32_t in_use;
 } fd_entry_t;
 
+/* one PT_LOAD segment of the running executable, kept so its pages can be faulted in */
+typedef struct user_segment {
+	uint32_t vaddr;							/* first virtual address of the segment */
+	uint32_t memsz;							/* bytes in memory */
+	uint32_t file_offset;					/* file offset of the byte at vaddr */
+	uint32_t filesz;						/* bytes backed by the file; the rest is zero */
+	uint32_t writable;						/* nonzero for PF_W segments */
+} user_segment_t;
+
 typedef struct process_control_block_t {
 
 	/* registers */ 
@@ -83,9 +122,16 @@ typedef struct process_control_block_t {
 	uint32_t pid;							/* This process's process number */
 	uint32_t parent_ptr;					/* Pointer to parent process's PCB */
 	uint32_t terminal_num;					/* The terminal this process is running in */
-	fd_entry_t fde[OPS_SIZE]; 				/* File descriptor array */
+	fd_entry_t* fde; 						/* File descriptor array (OPS_SIZE entries, from the fd_table cache) */
 	uint32_t argument_length;				/* Length (in bytes) of the argument passed to this process */
 	uint8_t argument_buffer[ARG_BUFF_SIZE];	/* Buffer containing the argument passed to this process */
+	uint32_t heap_brk;						/* Current program break (first byte past the heap) */
+	uint32_t mmap_base;						/* Lowest address handed out by mmap; the heap may not grow past it */
+	uint32_t exe_inode;						/* inode of the executable, the backing store of its pages */
+	uint32_t image;							/* slot of the executable in the image cache */
+	uint32_t num_segments;					/* valid entries in segments[] */
+	user_segment_t segments[MAX_SEGMENTS];	/* loadable segments of the executable */
+	uint32_t kernel_stack;					/* bottom of this process's 8 kB kernel stack */
 
 } process_control_block_t;
 
@@ -99,6 +145,7 @@ extern int primary_shell_count;
 
 
 int32_t halt(uint8_t status);
+int32_t process_exit(uint32_t status);
 int32_t execute(const uint8_t* command_arg);
 int32_t read(int32_t fd, void* buf, int32_t nbytes);
 int32_t write(int32_t fd, const void* buf, int32_t nbytyes);
@@ -108,7 +155,34 @@ int32_t getargs(uint8_t* buf, int32_t nbytyes);
 int32_t vidmap(uint8_t** screen_start);
 int32_t set_handler(int32_t signum, void* handler_address);
 int32_t sigreturn(void);
-void init_fd(process_control_block_t pcb);
+int32_t brk(uint32_t new_brk);
+int32_t mmap(uint32_t length, uint32_t flags);
+int32_t munmap(void* addr, uint32_t length);
+int32_t sysctl(uint32_t key, int32_t value);
+int32_t create(const uint8_t* filename);
+int32_t unlink(const uint8_t* filename);
+int32_t truncate(int32_t fd, uint32_t length);
+int32_t getdents(int32_t fd, dirent_t* buf, int32_t nbytes);
+int32_t stat(const uint8_t* filename, fs_stat_t* buf);
+int32_t fstat(int32_t fd, fs_stat_t* buf);
+int32_t sendfile(int32_t out_fd, int32_t in_fd, int32_t count);
+int32_t sync(void);
+void process_cache_init(void);
+int32_t process_alloc(uint32_t pid);
+void process_free(uint32_t pid);
+process_control_block_t* get_pcb(uint32_t pid);
+uint32_t kernel_stack_top(uint32_t pid);
+void set_process_pages(uint32_t pid);
+int32_t user_map_range(uint32_t pid, uint32_t start, uint32_t end, uint32_t flags);
+void user_unmap_range(uint32_t pid, uint32_t start, uint32_t end);
+void user_release(uint32_t pid);
+int32_t user_map_frame(uint32_t pid, uint32_t vaddr, uint32_t frame, uint32_t flags);
+int32_t user_cow_fault(uint32_t pid, uint32_t addr);
+int32_t user_zero_fault(uint32_t pid, uint32_t addr);
+int32_t user_swap_fault(uint32_t pid, uint32_t addr);
+uint32_t user_reclaim(uint32_t target);
+uint32_t user_merge(uint32_t budget);
+void init_fd(process_control_block_t* pcb);
 void args_initialize(const uint8_t * command, uint8_t * char_space_indices, int32_t num_spaces, process_control_block_t * current_pblock);
 
 #endif /* _SYSCALLS_H */
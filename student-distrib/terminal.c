@@ -10,8 +10,9 @@
 #include "lib.h"
 #include "page.h"
 #include "sched.h"
+#include "ksm.h"
 
-#define VIDEO 					0X000B8000	/* AW address of video memory (found in lib.c) */
+#define VIDEO 					(KERNEL_VBASE + 0X000B8000)	/* AW address of video memory (found in lib.c) */
 #define NUM_COLS 80
 #define NUM_ROWS 25
 #define ATTRIB 0x7
@@ -67,7 +68,9 @@ int term_read(uint8_t* fname, void* buf, int nbytes)
 		return -1;
 	}
 	/* wait until ready to read from buf */
-	while (!ready_to_read[display_terminal]) {}
+	while (!ready_to_read[display_terminal]) {
+		ksm_idle();
+	}
 	/* read only kb valid data if requested bytes is larger*/
 	if (nbytes > kb_buf_index[display_terminal]) {
 		memcpy(buf, kb_buf[display_terminal], kb_buf_index[display_terminal]);
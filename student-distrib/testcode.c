@@ -81,11 +81,16 @@ int testCP1_and_CP2()
 	clear();
 	printf("    Testing read_directory...\n");
 	uint8_t dir_buf[33];
-	uint32_t dir_nbytes;
 	int a;
 	for(a = 0; a < 20; a++)
 	{
-		int32_t dir_ret = read_directory(dummy, dir_buf, dir_nbytes);
+		/* read_directory needs an open descriptor; list by index instead */
+		dentry_t dir_dentry;
+		int32_t dir_ret = 0;
+		if(read_dentry_by_index(a, &dir_dentry) == 0) {
+			strcpy((int8_t*)dir_buf, dir_dentry.name);
+			dir_ret = strlen((int8_t*)dir_buf);
+		}
 
 		printf("    Number of bytes read: %d  ", dir_ret);
 		if(dir_ret > 0)
@@ -244,6 +249,406 @@ int testCP5()
 	return ret_val;
 }
 
+/* testSlab()
+ * INPUTS:			none
+ * RETURN VALUE:	1 if every check passed, 0 otherwise
+ * PURPOSE: 		checks kmalloc alignment, object reuse and that freed slabs
+ *					go back to the buddy allocator, then prints the cache stats
+ */
+int testSlab()
+{
+	int is_passing = 1;
+	uint32_t free_before = buddy_free_pages();
+	void* objs[SLAB_TEST_OBJS];
+	void* big;
+	int i;
+
+	printf("Testing slab allocator..........\n");
+
+	for(i = 0; i < SLAB_TEST_OBJS; i++) {
+		objs[i] = kmalloc(100);
+		if(objs[i] == NULL || ((uint32_t)objs[i] & (CACHE_LINE - 1)) != 0) {
+			is_passing = 0;
+			printf("    kmalloc: FAILED aligned allocation %d\n", i);
+		}
+	}
+	kfree(objs[0]);
+	if(kmalloc(100) != objs[0]) {
+		is_passing = 0;
+		printf("    kmalloc: FAILED reuse of a freed object\n");
+	}
+	for(i = 0; i < SLAB_TEST_OBJS; i++)
+		kfree(objs[i]);
+
+	big = kmalloc(3 * SLAB_SIZE);
+	if(big == NULL || ((uint32_t)big & (SLAB_SIZE - 1)) != 0) {
+		is_passing = 0;
+		printf("    kmalloc: FAILED large allocation\n");
+	}
+	kfree(big);
+
+	/* one empty slab per cache may stay behind */
+	if(buddy_free_pages() + 1 < free_before) {
+		is_passing = 0;
+		printf("    kfree: FAILED to return slabs (%d pages lost)\n", free_before - buddy_free_pages());
+	} else
+		printf("    kmalloc/kfree: passed\n");
+
+	kmem_print_stats();
+	return is_passing;
+}
+
+/* pages_differ(uint32_t a, uint32_t b)
+ * INPUTS:			a, b - page aligned addresses
+ * RETURN VALUE:	1 if the two pages hold different bytes, 0 otherwise
+ */
+static int pages_differ(uint32_t a, uint32_t b)
+{
+	int i;
+
+	for(i = 0; i < BYTES_4KB; i++)
+		if(((uint8_t*)a)[i] != ((uint8_t*)b)[i])
+			return 1;
+	return 0;
+}
+
+/* testZram()
+ * INPUTS:			none
+ * RETURN VALUE:	1 if every check passed, 0 otherwise
+ * PURPOSE: 		stores a patterned page and a zero page in zram and checks
+ *					that both come back byte for byte and that a random page
+ *					is refused
+ */
+int testZram()
+{
+	int is_passing = 1;
+	uint32_t src, dst, slot, seed;
+	int i;
+
+	printf("Testing zram..........\n");
+
+	src = alloc_frame();
+	dst = alloc_frame();
+	if(src == 0 || dst == 0) {
+		printf("    zram: FAILED to get frames\n");
+		return 0;
+	}
+
+	for(i = 0; i < BYTES_4KB; i++)
+		((uint8_t*)src)[i] = (i % 97 < 40) ? 0 : (uint8_t)(i / 13);
+	slot = zram_store(src);
+	if(slot == ZRAM_NONE || zram_load(slot, dst) == FAIL ||
+	   pages_differ(src, dst)) {
+		is_passing = 0;
+		printf("    zram: FAILED patterned page round trip\n");
+	}
+	if(slot != ZRAM_NONE)
+		zram_free(slot);
+
+	memset((void*)src, 0, BYTES_4KB);
+	slot = zram_store(src);
+	if(slot == ZRAM_NONE || zram_load(slot, dst) == FAIL ||
+	   pages_differ(src, dst)) {
+		is_passing = 0;
+		printf("    zram: FAILED zero page round trip\n");
+	}
+	if(slot != ZRAM_NONE)
+		zram_free(slot);
+
+	seed = 12345;
+	for(i = 0; i < BYTES_4KB; i++) {
+		seed = seed * 1103515245 + 12345;
+		((uint8_t*)src)[i] = (uint8_t)(seed >> 16);
+	}
+	slot = zram_store(src);
+	if(slot != ZRAM_NONE) {
+		is_passing = 0;
+		printf("    zram: FAILED to refuse an incompressible page\n");
+		zram_free(slot);
+	}
+
+	if(is_passing)
+		printf("    zram_store/zram_load: passed\n");
+
+	free_frame(src);
+	free_frame(dst);
+	return is_passing;
+}
+
+
+/* filesys_restore(const boot_block_t* saved)
+ * INPUTS:			saved - fs_info from before a test changed the file system
+ * RETURN VALUE:	none
+ * PURPOSE: 		mounts the boot image again, from the module or the disk it
+ *					came from, dropping everything written since
+ */
+static void filesys_restore(const boot_block_t* saved)
+{
+	if(saved->filesys_ptr == NULL)
+		filesys_init_disk();
+	else
+		filesys_init(saved->filesys_ptr);
+}
+
+/* dentry_scan(const uint8_t* fname, dentry_t* dentry)
+ * INPUTS:			fname - name to look up
+ *					dentry - filled in on a match
+ * RETURN VALUE:	0 on a match, -1 otherwise
+ * PURPOSE: 		the linear read_dentry_by_name the hash index replaced, kept
+ *					here as the benchmark baseline
+ */
+static int32_t dentry_scan(const uint8_t* fname, dentry_t* dentry)
+{
+	uint32_t check;
+	uint32_t fname_len = strlen((int8_t*)fname);
+	uint8_t* fs_dentry_ptr;
+
+	for(check = 0; check < fs_info.num_dir_entries; check++) {
+		fs_dentry_ptr = fs_info.dir_entries[check];
+		if(strlen((int8_t*)fs_dentry_ptr) == fname_len &&
+		   strncmp((int8_t*)fname, (int8_t*)fs_dentry_ptr, fname_len) == 0) {
+			strcpy((int8_t*)(dentry->name), (int8_t*)fname);
+			dentry->type = fs_dentry_ptr[FNAME_LENGTH];
+			dentry->inode = *((uint32_t*)(fs_dentry_ptr + FNAME_LENGTH + FS_FIELD_SIZE));
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* testDentry()
+ * INPUTS:			none
+ * RETURN VALUE:	1 if every check passed, 0 otherwise
+ * PURPOSE: 		builds a boot block with MAX_DENTRIES entries, checks that
+ *					read_dentry_by_name finds each of them and rejects a missing
+ *					name, and times it against the linear scan. The real file
+ *					system is restored afterwards.
+ */
+int testDentry()
+{
+	boot_block_t saved = fs_info;
+	uint32_t* image;
+	uint8_t* entry;
+	uint8_t names[MAX_DENTRIES][FNAME_LENGTH + 1];
+	dentry_t found;
+	uint32_t i, round, start, end, hash_cycles, scan_cycles;
+	int is_passing = 1;
+
+	printf("Testing directory index..........\n");
+
+	image = (uint32_t*)alloc_frame();
+	if(image == NULL) {
+		printf("    dentry: FAILED to get a frame\n");
+		return 0;
+	}
+	memset(image, 0, BYTES_4KB);
+	image[0] = MAX_DENTRIES;
+
+	/* names share a long prefix and differ at the end, the scan's worst case */
+	entry = (uint8_t*)image + DENTRY_SIZE;
+	for(i = 0; i < MAX_DENTRIES; i++, entry += DENTRY_SIZE) {
+		strcpy((int8_t*)names[i], "benchmark_directory_entry_");
+		itoa(i, (int8_t*)names[i] + strlen((int8_t*)names[i]), 10);
+		strncpy((int8_t*)entry, (int8_t*)names[i], FNAME_LENGTH);
+		entry[FNAME_LENGTH] = 2;
+		*(uint32_t*)(entry + FNAME_LENGTH + FS_FIELD_SIZE) = i;
+	}
+	filesys_init(image);
+
+	for(i = 0; i < MAX_DENTRIES; i++) {
+		if(read_dentry_by_name(names[i], &found) != 0 || found.inode != i) {
+			is_passing = 0;
+			printf("    read_dentry_by_name: FAILED on %s\n", names[i]);
+		}
+	}
+	if(read_dentry_by_name((uint8_t*)"benchmark_directory_entry_99", &found) != -1) {
+		is_passing = 0;
+		printf("    read_dentry_by_name: FAILED to reject a missing name\n");
+	}
+
+	rdtsc_low(start);
+	for(round = 0; round < DENTRY_BENCH_ROUNDS; round++)
+		for(i = 0; i < MAX_DENTRIES; i++)
+			read_dentry_by_name(names[i], &found);
+	rdtsc_low(end);
+	hash_cycles = (end - start) / (DENTRY_BENCH_ROUNDS * MAX_DENTRIES);
+
+	rdtsc_low(start);
+	for(round = 0; round < DENTRY_BENCH_ROUNDS; round++)
+		for(i = 0; i < MAX_DENTRIES; i++)
+			dentry_scan(names[i], &found);
+	rdtsc_low(end);
+	scan_cycles = (end - start) / (DENTRY_BENCH_ROUNDS * MAX_DENTRIES);
+
+	printf("    %d entries: hash %d cycles, linear scan %d cycles per lookup\n",
+		   MAX_DENTRIES, hash_cycles, scan_cycles);
+	if(is_passing)
+		printf("    read_dentry_by_name: passed\n");
+
+	filesys_restore(&saved);
+	free_frame((uint32_t)image);
+	return is_passing;
+}
+
+
+/* overlay_check(int ok, const int8_t* what, int* is_passing)
+ * INPUTS:			ok - result of one check
+ *					what - what was checked, printed if it failed
+ *					is_passing - cleared on a failure
+ * RETURN VALUE:	ok
+ */
+static int overlay_check(int ok, const int8_t* what, int* is_passing)
+{
+	if(!ok) {
+		*is_passing = 0;
+		printf("    overlay: FAILED %s\n", what);
+	}
+	return ok;
+}
+
+/* bytes_are(const uint8_t* buf, uint8_t value, uint32_t length)
+ * INPUTS:			buf, length - bytes to look at
+ *					value - what each of them should be
+ * RETURN VALUE:	1 if they all are, 0 otherwise
+ */
+static int bytes_are(const uint8_t* buf, uint8_t value, uint32_t length)
+{
+	uint32_t i;
+
+	for(i = 0; i < length; i++)
+		if(buf[i] != value)
+			return 0;
+	return 1;
+}
+
+/* bytes_match(const uint8_t* a, const uint8_t* b, uint32_t length)
+ * INPUTS:			a, b, length - bytes to compare
+ * RETURN VALUE:	1 if they are the same, 0 otherwise
+ */
+static int bytes_match(const uint8_t* a, const uint8_t* b, uint32_t length)
+{
+	uint32_t i;
+
+	for(i = 0; i < length; i++)
+		if(a[i] != b[i])
+			return 0;
+	return 1;
+}
+
+/* overlay_write(uint32_t inode, uint32_t pos, const uint8_t* buf, uint32_t length)
+ * INPUTS:			as write_cursor, with a fresh cursor
+ * RETURN VALUE:	what write_cursor returned
+ */
+static int32_t overlay_write(uint32_t inode, uint32_t pos, const uint8_t* buf, uint32_t length)
+{
+	file_cursor_t cursor;
+
+	cursor.block = pos / BYTES_4KB;
+	cursor.offset = pos % BYTES_4KB;
+	return write_cursor(inode, pos, &cursor, buf, length);
+}
+
+/* testOverlay()
+ * INPUTS:			none
+ * RETURN VALUE:	1 if every check passed, 0 otherwise
+ * PURPOSE: 		exercises the writable overlay on the mounted image: a write
+ *					to a file of the image copies its block and leaves the
+ *					image's alone, a write past the end zero-fills the gap,
+ *					truncate shrinks and grows with zeroes, an unlinked open
+ *					file lives until its last close and its inode is then
+ *					reused empty, and a file a program is running from cannot
+ *					be changed. The image is mounted again afterwards.
+ */
+int testOverlay()
+{
+	static uint8_t before[OVERLAY_TEST_BYTES], after[OVERLAY_TEST_BYTES];
+	boot_block_t saved = fs_info;
+	dentry_t d, d2;
+	uint32_t inode, length, block, frames;
+	int32_t slot;
+	int is_passing = 1;
+
+	printf("Testing writable overlay..........\n");
+
+	/* copy on write of a block still in the image */
+	if(overlay_check(read_dentry_by_name((uint8_t*)"frame0.txt", &d) == 0, "to find frame0.txt", &is_passing)) {
+		length = read_data(d.inode, 0, before, OVERLAY_TEST_BYTES);
+		block = inode_block(d.inode, 0);
+		overlay_check(length > 4 && overlay_write(d.inode, 0, (uint8_t*)"ABCD", 4) == 4,
+					  "to write frame0.txt", &is_passing);
+		overlay_check(read_data(d.inode, 0, after, OVERLAY_TEST_BYTES) == (int32_t)length &&
+					  strncmp((int8_t*)after, "ABCD", 4) == 0 &&
+					  bytes_match(after + 4, before + 4, length - 4),
+					  "to read back a copied block", &is_passing);
+		overlay_check(inode_block(d.inode, 0) != block && fs_block(block) != NULL &&
+					  bytes_match(fs_block(block), before, length),
+					  "to leave the image's block alone", &is_passing);
+	}
+
+	/* a write past the end fills the gap with zeroes */
+	if(!overlay_check(fs_create((uint8_t*)"overlay.tmp") == 0 &&
+					  read_dentry_by_name((uint8_t*)"overlay.tmp", &d) == 0,
+					  "to create overlay.tmp", &is_passing)) {
+		filesys_restore(&saved);
+		return 0;
+	}
+	inode = d.inode;
+	overlay_check(overlay_write(inode, OVERLAY_TEST_GAP, (uint8_t*)"xy", 2) == 2 &&
+				  inode_length(inode, &length) == 0 && length == OVERLAY_TEST_GAP + 2,
+				  "to write past the end", &is_passing);
+	overlay_check(read_data(inode, 0, after, OVERLAY_TEST_BYTES) == OVERLAY_TEST_GAP + 2 &&
+				  bytes_are(after, 0, OVERLAY_TEST_GAP) &&
+				  strncmp((int8_t*)after + OVERLAY_TEST_GAP, "xy", 2) == 0,
+				  "to zero-fill the gap", &is_passing);
+
+	/* shrinking and growing again must not bring old bytes back */
+	memset(before, 'a', OVERLAY_TEST_BYTES);
+	overlay_write(inode, 0, before, OVERLAY_TEST_BYTES);
+	overlay_check(fs_truncate(inode, 10) == 0 && inode_length(inode, &length) == 0 && length == 10,
+				  "to shrink", &is_passing);
+	overlay_check(fs_truncate(inode, OVERLAY_TEST_BYTES) == 0 &&
+				  read_data(inode, 0, after, OVERLAY_TEST_BYTES) == OVERLAY_TEST_BYTES &&
+				  bytes_are(after, 'a', 10) && bytes_are(after + 10, 0, OVERLAY_TEST_BYTES - 10),
+				  "to grow with zeroes", &is_passing);
+
+	/* a file a program runs from may not change */
+	slot = image_cache_get(inode);
+	if(slot != FAIL) {
+		overlay_check(overlay_write(inode, 0, (uint8_t*)"z", 1) == -1 && fs_truncate(inode, 0) == -1 &&
+					  fs_unlink((uint8_t*)"overlay.tmp") == -1,
+					  "to refuse changing a running program", &is_passing);
+		image_cache_put(slot);
+	}
+
+	/* unlinked while open: readable until the last close, then freed */
+	fs_inode_open(inode);
+	overlay_check(fs_unlink((uint8_t*)"overlay.tmp") == 0 &&
+				  read_dentry_by_name((uint8_t*)"overlay.tmp", &d) == -1,
+				  "to unlink an open file", &is_passing);
+	overlay_check(read_data(inode, 0, after, OVERLAY_TEST_BYTES) == OVERLAY_TEST_BYTES &&
+				  bytes_are(after, 'a', 10),
+				  "to read an unlinked open file", &is_passing);
+	overlay_check(fs_create((uint8_t*)"overlay2.tmp") == 0 &&
+				  read_dentry_by_name((uint8_t*)"overlay2.tmp", &d2) == 0 && d2.inode != inode,
+				  "to keep the inode of an open file", &is_passing);
+	frames = free_frame_count();
+	fs_inode_close(inode);
+	overlay_check(free_frame_count() > frames, "to free the file on its last close", &is_passing);
+
+	/* the freed number is handed out again, empty */
+	fs_unlink((uint8_t*)"overlay2.tmp");
+	overlay_check(fs_create((uint8_t*)"overlay3.tmp") == 0 &&
+				  read_dentry_by_name((uint8_t*)"overlay3.tmp", &d) == 0 && d.inode == inode &&
+				  inode_length(inode, &length) == 0 && length == 0,
+				  "to reuse a freed inode", &is_passing);
+
+	if(is_passing)
+		printf("    write_cursor/fs_truncate/fs_unlink: passed\n");
+
+	filesys_restore(&saved);
+	return is_passing;
+}
+
 
 /* run_tests(uint8_t* test_name)
  * INPUTS:			test_name - string indicating which test to run
@@ -271,6 +676,14 @@ int run_tests(int8_t* test_name)
 			  (strncmp((int8_t*)test_name, "final", n) == 0) ||
 			  (strncmp((int8_t*)test_name, "checkpoint5", n) == 0) )
 			ret_val = testCP5();
+	else if (strncmp((int8_t*)test_name, "slab", n) == 0)
+			ret_val = testSlab();
+	else if (strncmp((int8_t*)test_name, "zram", n) == 0)
+			ret_val = testZram();
+	else if (strncmp((int8_t*)test_name, "dentry", n) == 0)
+			ret_val = testDentry();
+	else if (strncmp((int8_t*)test_name, "overlay", n) == 0)
+			ret_val = testOverlay();
 	
 	return ret_val;
 }
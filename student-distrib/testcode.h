@@ -13,6 +13,16 @@
 #include "filesys_mod.h"
 #include "syscalls.h"
 #include "rtc.h"
+#include "slab.h"
+#include "buddy.h"
+#include "page.h"
+#include "zram.h"
+#include "elf.h"
+
+#define SLAB_TEST_OBJS	100		/* spans several kmalloc-128 slabs */
+#define DENTRY_BENCH_ROUNDS	1000	/* lookups of every name per timed run */
+#define OVERLAY_TEST_BYTES	8192	/* largest file the overlay test reads back */
+#define OVERLAY_TEST_GAP	5000	/* where it writes past the end of an empty file */
 
 int testCP1_and_CP2();
 int testCP1();
@@ -21,6 +31,10 @@ int testCP3_execute();
 int testCP3();
 int testCP4();
 int testCP5();
+int testSlab();
+int testZram();
+int testDentry();
+int testOverlay();
 int run_tests(int8_t* test_name);
 
 
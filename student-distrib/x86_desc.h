@@ -17,6 +17,11 @@
 #define KERNEL_LDT 0x0038
 #define PAGE_ENTRY 1024
 
+/* The kernel lives in the top 1 GB: physical memory [0, DIRECT_MAP_END) is
+ * mapped at KERNEL_VBASE and the kernel image is linked at KERNEL_VBASE + 4 MB */
+#define KERNEL_VBASE 0xC0000000
+#define PD_IDX_KERNEL 0x300		/* first page directory entry of the kernel half */
+
 /* Size of the task state segment (TSS) */
 #define TSS_SIZE 104
 
@@ -0,0 +1,179 @@
+/*	*********************************************************
+	# FILE NAME: zram.c
+	# PURPOSE: compressed in-memory store for user pages evicted by the page
+	#		   clock in syscalls.c (user_reclaim)
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#include "zram.h"
+#include "lz4.h"
+#include "slab.h"
+#include "page.h"
+#include "lib.h"
+#include "syscalls.h"
+
+/* pool object sizes: the largest multiple of a cache line that fits 15, 10, 7,
+ * 5, 4, 3 and 2 times in a slab, so the slabs stay nearly full */
+static const uint32_t class_size[ZRAM_CLASSES] = { 256, 384, 576, 768, 960, 1344, 1984 };
+static const int8_t* class_name[ZRAM_CLASSES] = {
+	"zram-256", "zram-384", "zram-576", "zram-768", "zram-960", "zram-1344", "zram-1984"
+};
+static kmem_cache_t* pool[ZRAM_CLASSES];
+
+static zram_slot_t slots[ZRAM_SLOTS];
+static uint32_t free_slot;			/* head of the free slot list */
+
+/* compression scratch; lz4 gives up on a page that does not fit */
+static uint8_t buffer[ZRAM_MAX_STORED];
+
+/* statistics */
+static uint32_t stored_pages;		/* pages currently in the store */
+static uint32_t compressed_bytes;	/* their total compressed size */
+static uint32_t fault_count;		/* pages faulted back in since the last zram_fault_cycles() */
+static uint32_t fault_cycles;
+
+/* void zram_init(void)
+ * INPUT: none
+ * OUTPUT: none
+ * DESCRIPTION: creates the pool caches and threads every slot on the free list
+ */
+void zram_init(void)
+{
+	uint32_t i;
+
+	for(i = 0; i < ZRAM_CLASSES; i++)
+		pool[i] = kmem_cache_create(class_name[i], class_size[i]);
+
+	for(i = 0; i < ZRAM_SLOTS; i++)
+		slots[i].next_free = (i + 1 < ZRAM_SLOTS) ? i + 1 : ZRAM_NONE;
+	free_slot = 0;
+}
+
+/* uint32_t zram_store(uint32_t frame)
+ * INPUT: frame - kernel address of a 4 kB page
+ * OUTPUT: slot now holding the compressed page, ZRAM_NONE if the page does not
+ *		   compress below ZRAM_MAX_STORED or the store is full
+ * DESCRIPTION: the frame itself is left alone; the caller unmaps and frees it
+ */
+uint32_t zram_store(uint32_t frame)
+{
+	uint32_t flags, slot, cls;
+	int32_t size;
+
+	cli_and_save(flags);
+
+	slot = free_slot;
+	if(slot == ZRAM_NONE) {
+		restore_flags(flags);
+		return ZRAM_NONE;
+	}
+
+	size = lz4_compress((uint8_t*)frame, BYTES_4KB, buffer, ZRAM_MAX_STORED);
+	if(size == FAIL) {
+		restore_flags(flags);
+		return ZRAM_NONE;
+	}
+
+	for(cls = 0; class_size[cls] < (uint32_t)size; cls++)
+		;
+	slots[slot].data = (uint8_t*)kmem_cache_alloc(pool[cls]);
+	if(slots[slot].data == NULL) {
+		restore_flags(flags);
+		return ZRAM_NONE;
+	}
+	memcpy(slots[slot].data, buffer, size);
+	slots[slot].size = size;
+	slots[slot].cls = cls;
+	free_slot = slots[slot].next_free;
+
+	stored_pages++;
+	compressed_bytes += size;
+	restore_flags(flags);
+	return slot;
+}
+
+/* int32_t zram_load(uint32_t slot, uint32_t frame)
+ * INPUT: slot - slot returned by zram_store
+ *		  frame - kernel address of the 4 kB page to fill
+ * OUTPUT: SUCCESS, FAIL for a bad slot
+ * DESCRIPTION: the slot stays in use; zram_free releases it
+ */
+int32_t zram_load(uint32_t slot, uint32_t frame)
+{
+	if(slot >= ZRAM_SLOTS || slots[slot].size == 0)
+		return FAIL;
+
+	if(lz4_decompress(slots[slot].data, slots[slot].size, (uint8_t*)frame, BYTES_4KB) != BYTES_4KB)
+		return FAIL;
+	return SUCCESS;
+}
+
+/* void zram_free(uint32_t slot)
+ * INPUT: slot - slot returned by zram_store
+ * OUTPUT: none
+ */
+void zram_free(uint32_t slot)
+{
+	uint32_t flags;
+
+	if(slot >= ZRAM_SLOTS || slots[slot].size == 0)
+		return;
+
+	cli_and_save(flags);
+	kmem_cache_free(pool[slots[slot].cls], slots[slot].data);
+	stored_pages--;
+	compressed_bytes -= slots[slot].size;
+	slots[slot].size = 0;
+	slots[slot].data = NULL;
+	slots[slot].next_free = free_slot;
+	free_slot = slot;
+	restore_flags(flags);
+}
+
+/* void zram_fault_done(uint32_t cycles)
+ * INPUT: cycles - time a fault spent bringing a page back
+ * OUTPUT: none
+ */
+void zram_fault_done(uint32_t cycles)
+{
+	fault_count++;
+	fault_cycles += cycles;
+}
+
+/* uint32_t zram_pages(void)
+ * INPUT: none
+ * OUTPUT: pages currently held in compressed form
+ */
+uint32_t zram_pages(void)
+{
+	return stored_pages;
+}
+
+/* uint32_t zram_ratio(void)
+ * INPUT: none
+ * OUTPUT: uncompressed size over compressed size of the stored pages, times
+ *		   100 (250 means 2.5:1); 0 while the store is empty
+ */
+uint32_t zram_ratio(void)
+{
+	if(compressed_bytes == 0)
+		return 0;
+	return stored_pages * BYTES_4KB * 100 / compressed_bytes;	/* < 2^32 for ZRAM_SLOTS pages */
+}
+
+/* uint32_t zram_fault_cycles(void)
+ * INPUT: none
+ * OUTPUT: average cycles per fault that decompressed a page since the last
+ *		   call, 0 if there was none; starts counting afresh
+ */
+uint32_t zram_fault_cycles(void)
+{
+	uint32_t flags, avg;
+
+	cli_and_save(flags);
+	avg = (fault_count != 0) ? fault_cycles / fault_count : 0;
+	fault_count = 0;
+	fault_cycles = 0;
+	restore_flags(flags);
+
+	return avg;
+}
@@ -0,0 +1,42 @@
+/*	*********************************************************
+	# FILE NAME: zram.h
+	# PURPOSE: header for zram.c, the compressed in-memory store for evicted
+	#		   user pages
+	# AUTHOR: Queeblo OS
+	********************************************************* */
+#ifndef _ZRAM_H
+#define _ZRAM_H
+
+#include "types.h"
+
+#define ZRAM_SLOTS			4096		/* pages the store can hold (16 MB before compression) */
+#define ZRAM_NONE			0xFFFFFFFF	/* zram_store: page not stored */
+#define ZRAM_CLASSES		7			/* pool size classes, see zram.c */
+#define ZRAM_MAX_STORED		1984		/* pages that compress worse than this stay in memory */
+#define ZRAM_LOW_WATER		256			/* free frames below which alloc_frame evicts */
+#define ZRAM_BATCH			32			/* pages evicted per low memory allocation */
+#define ZRAM_SCAN_MAX		4096		/* page table entries the clock looks at per call */
+
+/* one compressed page */
+typedef struct zram_slot {
+	uint8_t* data;				/* compressed bytes, from one of the pool caches */
+	uint16_t size;				/* compressed length; 0 while the slot is free */
+	uint16_t cls;				/* pool class data came from */
+	uint32_t next_free;			/* free list link */
+} zram_slot_t;
+
+/* creates the pool caches; after kmem_init */
+void zram_init(void);
+
+/* page contents in and out of the store; frames are kernel addresses */
+uint32_t zram_store(uint32_t frame);
+int32_t zram_load(uint32_t slot, uint32_t frame);
+void zram_free(uint32_t slot);
+
+/* statistics */
+void zram_fault_done(uint32_t cycles);
+uint32_t zram_pages(void);
+uint32_t zram_ratio(void);
+uint32_t zram_fault_cycles(void);
+
+#endif /* _ZRAM_H */
@@ -0,0 +1,83 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define SEQ_KB 4096         /* 4 MB, wrapping around a smaller disk */
+#define RANDOM_READS 256
+#define CHUNK 4096
+#define NUMBUF 12
+#define NAMEBUF 128         /* the kernel keeps 128 bytes of arguments */
+
+static uint8_t buf[CHUNK];
+
+/* Low 32 bits of the time stamp counter, as in fsbench. */
+static uint32_t rdtsc32 ()
+{
+    uint32_t lo, hi;
+
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return lo;
+}
+
+static void print_num (const char* label, uint32_t value, const char* unit)
+{
+    uint8_t num[NUMBUF];
+
+    ece391_fdputs (1, (uint8_t*)label);
+    ece391_fdputs (1, ece391_itoa (value, num, 10));
+    ece391_fdputs (1, (uint8_t*)unit);
+}
+
+/* Read a file through the file system, 4 kB at a time, and show what the
+   block cache had to fetch from the disk for it. */
+static int32_t file_bench (const uint8_t* file)
+{
+    uint32_t start, cycles, bytes = 0, hits, misses;
+    int32_t fd, cnt;
+
+    if (-1 == (fd = ece391_open (file))) {
+        ece391_fdputs (1, (uint8_t*)"file not found\n");
+        return 2;
+    }
+    hits = ece391_sysctl (SYSCTL_FS_CACHE_HITS, -1);
+    misses = ece391_sysctl (SYSCTL_FS_CACHE_MISSES, -1);
+    start = rdtsc32 ();
+    while (0 < (cnt = ece391_read (fd, buf, CHUNK)))
+        bytes += cnt;
+    cycles = rdtsc32 () - start;
+    ece391_close (fd);
+
+    print_num ("file read:  ", cycles / (bytes / 1024 ? bytes / 1024 : 1), " cycles per kB");
+    print_num (" (", ece391_sysctl (SYSCTL_FS_CACHE_HITS, -1) - hits, " cache hits, ");
+    print_num ("", ece391_sysctl (SYSCTL_FS_CACHE_MISSES, -1) - misses, " misses)\n");
+    return 0;
+}
+
+/* Time DMA reads from the ATA disk (qemu -hdb <image>): SEQ_KB from its
+   start in large commands, then RANDOM_READS single blocks anywhere on it.
+   "diskbench <file>" then also reads <file> through the file system. */
+int main ()
+{
+    static uint8_t file[NAMEBUF];
+    int32_t blocks, seq, rnd;
+
+    blocks = ece391_sysctl (SYSCTL_DISK_BLOCKS, -1);
+    if (blocks <= 0) {
+        ece391_fdputs (1, (uint8_t*)"no disk\n");
+        return 3;
+    }
+    print_num ("disk:       ", blocks * 4, " kB\n");
+
+    if (-1 == (seq = ece391_sysctl (SYSCTL_DISK_SEQ, SEQ_KB)) ||
+        -1 == (rnd = ece391_sysctl (SYSCTL_DISK_RANDOM, RANDOM_READS))) {
+        ece391_fdputs (1, (uint8_t*)"disk read failed\n");
+        return 2;
+    }
+    print_num ("sequential: ", seq, " cycles per kB\n");
+    print_num ("random 4k:  ", rnd, " cycles per kB\n");
+
+    if (0 == ece391_getargs (file, NAMEBUF) && '\0' != file[0])
+        return file_bench (file);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define RUNS 200
+#define NUMBUF 12
+
+/* Low 32 bits of the time stamp counter.  Single runs are far shorter
+   than 2^32 cycles, so differences of the low halves are exact. */
+static uint32_t rdtsc32 ()
+{
+    uint32_t lo, hi;
+
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return lo;
+}
+
+static void print_num (const char* label, uint32_t value)
+{
+    uint8_t buf[NUMBUF];
+
+    ece391_fdputs (1, (uint8_t*)label);
+    ece391_fdputs (1, ece391_itoa (value, buf, 10));
+}
+
+/* Time RUNS execute("nop") round trips with the snapshot cache on or off. */
+static int32_t run (const char* label, int32_t snapshot)
+{
+    uint32_t i, start, cycles, avg, min;
+
+    ece391_sysctl (SYSCTL_SNAPSHOT, snapshot);
+    if (0 != ece391_execute ((uint8_t*)"nop")) {    /* warm up caches */
+        ece391_fdputs (1, (uint8_t*)"could not execute nop\n");
+        return -1;
+    }
+
+    avg = 0;
+    min = 0xFFFFFFFF;
+    for (i = 0; i < RUNS; i++) {
+        start = rdtsc32 ();
+        ece391_execute ((uint8_t*)"nop");
+        cycles = rdtsc32 () - start;
+        avg += cycles / RUNS;   /* no 64-bit sums, so average as we go */
+        if (cycles < min)
+            min = cycles;
+    }
+
+    ece391_fdputs (1, (uint8_t*)label);
+    print_num (": avg ", avg);
+    print_num (" min ", min);
+    ece391_fdputs (1, (uint8_t*)" cycles per execute+halt\n");
+    return 0;
+}
+
+int main ()
+{
+    int32_t saved = ece391_sysctl (SYSCTL_SNAPSHOT, -1);
+    int32_t ret = 0;
+
+    if (-1 == saved) {
+        ece391_fdputs (1, (uint8_t*)"sysctl not supported\n");
+        return 3;
+    }
+    if (-1 == run ("snapshot off", 0) || -1 == run ("snapshot on ", 1))
+        ret = 2;
+    ece391_sysctl (SYSCTL_SNAPSHOT, saved);
+
+    return ret;
+}
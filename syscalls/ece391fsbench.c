@@ -0,0 +1,120 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define CHUNK 4096
+#define CHUNKS 64           /* 256 kB, well inside the overlay */
+#define NUMBUF 12
+#define NAMEBUF 128         /* the kernel keeps 128 bytes of arguments */
+
+static const uint8_t name[] = "fsbench.tmp";
+static uint8_t buf[CHUNK];
+
+/* Low 32 bits of the time stamp counter; a pass is far shorter than 2^32
+   cycles, so differences of the low halves are exact. */
+static uint32_t rdtsc32 ()
+{
+    uint32_t lo, hi;
+
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return lo;
+}
+
+static void print_rate (const char* label, uint32_t cycles, uint32_t bytes)
+{
+    uint8_t num[NUMBUF];
+
+    ece391_fdputs (1, (uint8_t*)label);
+    ece391_fdputs (1, ece391_itoa (cycles / (bytes / 1024 ? bytes / 1024 : 1), num, 10));
+    ece391_fdputs (1, (uint8_t*)" cycles per kB\n");
+}
+
+/* Copy a file to the terminal the way cat did (read into buf, write it
+   back) and with sendfile; the two rates print after both copies. */
+static int32_t cat_bench (const uint8_t* file)
+{
+    uint32_t start, by_read, by_send, bytes = 0;
+    int32_t fd, cnt;
+
+    if (-1 == (fd = ece391_open (file))) {
+        ece391_fdputs (1, (uint8_t*)"file not found\n");
+        return 2;
+    }
+    start = rdtsc32 ();
+    while (0 < (cnt = ece391_read (fd, buf, 1024))) {
+        ece391_write (1, buf, cnt);
+        bytes += cnt;
+    }
+    by_read = rdtsc32 () - start;
+    ece391_close (fd);
+
+    if (-1 == (fd = ece391_open (file)))
+        return 2;
+    start = rdtsc32 ();
+    while (0 < ece391_sendfile (1, fd, CHUNK))
+        ;
+    by_send = rdtsc32 () - start;
+    ece391_close (fd);
+
+    ece391_fdputs (1, (uint8_t*)"\n");
+    print_rate ("read+write: ", by_read, bytes);
+    print_rate ("sendfile:   ", by_send, bytes);
+    return 0;
+}
+
+/* Write CHUNKS blocks to a new file, read them back and check them.
+   "fsbench <file>" instead times printing <file> (e.g. fish, the largest
+   file in fsdir) with and without sendfile. */
+int main ()
+{
+    static uint8_t file[NAMEBUF];
+    uint32_t i, j, start, cycles;
+    int32_t fd, ret = 0;
+
+    if (0 == ece391_getargs (file, NAMEBUF) && '\0' != file[0])
+        return cat_bench (file);
+
+    if (-1 == ece391_create (name)) {
+        ece391_fdputs (1, (uint8_t*)"could not create fsbench.tmp\n");
+        return 3;
+    }
+
+    if (-1 == (fd = ece391_open (name))) {
+        ece391_fdputs (1, (uint8_t*)"could not open fsbench.tmp\n");
+        ece391_unlink (name);
+        return 3;
+    }
+    start = rdtsc32 ();
+    for (i = 0; i < CHUNKS; i++) {
+        for (j = 0; j < CHUNK; j += CHUNK / 4)
+            buf[j] = (uint8_t)(i + j);
+        if (CHUNK != ece391_write (fd, buf, CHUNK)) {
+            ece391_fdputs (1, (uint8_t*)"write failed\n");
+            ret = 2;
+            break;
+        }
+    }
+    cycles = rdtsc32 () - start;
+    ece391_close (fd);
+    if (0 == ret)
+        print_rate ("write: ", cycles, CHUNKS * CHUNK);
+
+    if (0 == ret && -1 != (fd = ece391_open (name))) {
+        start = rdtsc32 ();
+        for (i = 0; i < CHUNKS; i++) {
+            if (CHUNK != ece391_read (fd, buf, CHUNK) || buf[CHUNK / 4] != (uint8_t)(i + CHUNK / 4)) {
+                ece391_fdputs (1, (uint8_t*)"read back wrong data\n");
+                ret = 2;
+                break;
+            }
+        }
+        cycles = rdtsc32 () - start;
+        ece391_close (fd);
+        if (0 == ret)
+            print_rate ("read:  ", cycles, CHUNKS * CHUNK);
+    }
+
+    ece391_unlink (name);
+    return ret;
+}
@@ -3,26 +3,29 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
-#define SBUFSIZE 33
+#define NUM_DIRENTS 32      /* one call lists a whole v1 directory */
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    static struct ece391_dirent ents[NUM_DIRENTS];
+    int32_t fd, cnt, i, len;
 
     if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
         return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    while (0 != (cnt = ece391_getdents (fd, ents, sizeof (ents)))) {
         if (-1 == cnt) {
 	        ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	        return 3;
 	    }
-	    buf[cnt] = '\n';
-	    if (-1 == ece391_write (1, buf, cnt + 1))
-	        return 3;
+        for (i = 0; i < cnt / (int32_t)sizeof (ents[0]); i++) {
+            len = ece391_strlen (ents[i].name);
+            ents[i].name[len] = '\n';
+            if (-1 == ece391_write (1, ents[i].name, len + 1))
+                return 3;
+        }
     }
 
     return 0;
@@ -0,0 +1,35 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define NUMBUF 12
+
+static void print_stat (const char* label, int32_t key)
+{
+    uint8_t buf[NUMBUF];
+
+    ece391_fdputs (1, (uint8_t*)label);
+    ece391_fdputs (1, ece391_itoa (ece391_sysctl (key, -1), buf, 10));
+    ece391_fdputs (1, (uint8_t*)"\n");
+}
+
+/* Print the kernel's memory counters, in 4 kB pages unless noted. */
+int main ()
+{
+    if (-1 == ece391_sysctl (SYSCTL_MEM_TOTAL, -1)) {
+        ece391_fdputs (1, (uint8_t*)"sysctl not supported\n");
+        return 3;
+    }
+
+    print_stat ("total:             ", SYSCTL_MEM_TOTAL);
+    print_stat ("free:              ", SYSCTL_MEM_FREE);
+    print_stat ("zram pages:        ", SYSCTL_ZRAM_PAGES);
+    print_stat ("zram ratio (x100): ", SYSCTL_ZRAM_RATIO);
+    print_stat ("ksm on:            ", SYSCTL_KSM);
+    print_stat ("ksm pages saved:   ", SYSCTL_KSM_SAVED);
+    print_stat ("fs cache hits:     ", SYSCTL_FS_CACHE_HITS);
+    print_stat ("fs cache misses:   ", SYSCTL_FS_CACHE_MISSES);
+
+    return 0;
+}
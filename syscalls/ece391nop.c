@@ -0,0 +1,10 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+/* Does nothing; execbench times how long it takes to run. */
+int main ()
+{
+    return 0;
+}
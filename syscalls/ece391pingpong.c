@@ -11,6 +11,47 @@
 #define LOOPMAX BUFMAX-ENDING-1
 #define STARTCHAR 'A'
 #define ENDCHAR 'Z'
+#define BENCH_RUNS 64
+#define NUMBUF 12
+
+static void print_num (const char* label, uint32_t value)
+{
+    uint8_t buf[NUMBUF];
+
+    ece391_fdputs (1, (uint8_t*)label);
+    ece391_fdputs (1, ece391_itoa (value, buf, 10));
+}
+
+/* "pingpong bench": average cost of switching address spaces with global
+   kernel pages off and on.  Each of BENCH_RUNS runs of nop ends with halt
+   loading this process's page directory again, which the kernel times. */
+static int32_t bench ()
+{
+    int32_t saved = ece391_sysctl (SYSCTL_GLOBAL_PAGES, -1);
+    int32_t global, i;
+
+    if (-1 == saved) {
+        ece391_fdputs (1, (uint8_t*)"sysctl not supported\n");
+        return 3;
+    }
+    for (global = 0; global <= 1; global++) {
+        ece391_sysctl (SYSCTL_GLOBAL_PAGES, global);
+        ece391_sysctl (SYSCTL_SWITCH_CYCLES, -1);   /* start a fresh interval */
+        for (i = 0; i < BENCH_RUNS; i++) {
+            if (0 != ece391_execute ((uint8_t*)"nop")) {
+                ece391_fdputs (1, (uint8_t*)"could not execute nop\n");
+                ece391_sysctl (SYSCTL_GLOBAL_PAGES, saved);
+                return 2;
+            }
+        }
+        ece391_fdputs (1, (uint8_t*)(global ? "global pages on : " : "global pages off: "));
+        print_num ("avg ", ece391_sysctl (SYSCTL_SWITCH_CYCLES, -1));
+        ece391_fdputs (1, (uint8_t*)" cycles per switch\n");
+    }
+    ece391_sysctl (SYSCTL_GLOBAL_PAGES, saved);
+
+    return 0;
+}
 
 int main ()
 {
@@ -23,6 +64,15 @@ int main ()
     int rtc_fd;
     uint8_t buf[BUFMAX];
     
+    // Open and set RTC Frequency
+    rtc_fd = ece391_open((uint8_t*)"rtc");
+    ret_val = 32;
+    ret_val = ece391_write(rtc_fd, &ret_val, 4);
+
+    if (0 == ece391_getargs (buf, BUFMAX) &&
+        0 == ece391_strncmp (buf, (uint8_t*)"bench", 6))
+        return bench ();
+
     // Clear buffer
     for(i = 0; i < BUFMAX; i++)
 	    buf[i]=' ';
@@ -33,11 +83,6 @@ int main ()
     buf[BUFMAX-3]='|';
     buf[START]='|';
 
-    // Open and set RTC Frequency
-    rtc_fd = ece391_open((uint8_t*)"rtc");
-    ret_val = 32;
-    ret_val = ece391_write(rtc_fd, &ret_val, 4);
-
     while(1)
     {
 	// Move out
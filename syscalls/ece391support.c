@@ -102,3 +102,144 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+
+/*
+ * Heap allocator.  Small requests (16 bytes up to 2 kB, powers of two)
+ * come from per-size-class free lists.  Each class carves its objects out
+ * of SLAB_SIZE-aligned slabs taken from the heap with sbrk, and the slab
+ * header records the class, so free() finds it by masking the pointer.
+ * Larger requests get an anonymous mmap of their own.  All of the free
+ * list state lives in a malloc_cache_t; malloc_cache() is the one place
+ * that would hand out a per-thread cache once threads exist.
+ */
+#define SLAB_SIZE       0x4000
+#define MIN_CLASS_SHIFT 4
+#define NUM_CLASSES     8
+#define MAX_SMALL_SIZE  (1 << (MIN_CLASS_SHIFT + NUM_CLASSES - 1))
+#define BLOCK_HDR_SIZE  16
+#define LARGE_CLASS     0xFFFFFFFF
+
+typedef struct free_obj {
+    struct free_obj* next;
+} free_obj_t;
+
+/* Sits at the start of every slab and every large block */
+typedef struct block_hdr {
+    uint32_t size_class;    /* class index, or LARGE_CLASS */
+    uint32_t length;        /* bytes mapped for this slab or block */
+    uint32_t reserved[2];   /* keeps objects 16-byte aligned */
+} block_hdr_t;
+
+typedef struct malloc_cache {
+    free_obj_t* free_list[NUM_CLASSES];  /* objects handed back by free() */
+    uint8_t* carve_next[NUM_CLASSES];    /* untouched tail of the newest slab */
+    uint8_t* carve_end[NUM_CLASSES];
+} malloc_cache_t;
+
+static malloc_cache_t main_cache;
+static uint8_t* cur_brk;    /* cached program break; slabs all lie below it */
+
+static malloc_cache_t* malloc_cache (void)
+{
+    return &main_cache;
+}
+
+/* Move the program break by increment bytes and return the old break */
+void* ece391_sbrk (int32_t increment)
+{
+    uint8_t* old;
+
+    if (0 == cur_brk)
+        cur_brk = (uint8_t*)ece391_brk (0);
+    old = cur_brk;
+    if (0 != increment) {
+        if (-1 == ece391_brk (old + increment))
+            return (void*)-1;
+        cur_brk = old + increment;
+    }
+    return old;
+}
+
+/* Start a new slab for size class cls */
+static int32_t slab_refill (malloc_cache_t* cache, uint32_t cls)
+{
+    uint32_t obj_size = 1 << (MIN_CLASS_SHIFT + cls);
+    uint8_t* cur = ece391_sbrk (0);
+    uint32_t pad = (SLAB_SIZE - ((uint32_t)cur & (SLAB_SIZE - 1))) & (SLAB_SIZE - 1);
+    uint8_t* slab;
+    block_hdr_t* hdr;
+
+    if ((void*)-1 == ece391_sbrk (pad + SLAB_SIZE))
+        return -1;
+
+    slab = cur + pad;
+    hdr = (block_hdr_t*)slab;
+    hdr->size_class = cls;
+    hdr->length = SLAB_SIZE;
+    cache->carve_next[cls] = slab + BLOCK_HDR_SIZE;
+    cache->carve_end[cls] = slab + BLOCK_HDR_SIZE +
+                            ((SLAB_SIZE - BLOCK_HDR_SIZE) / obj_size) * obj_size;
+    return 0;
+}
+
+static void* large_alloc (uint32_t size)
+{
+    uint32_t length = size + BLOCK_HDR_SIZE;
+    int32_t addr;
+    block_hdr_t* hdr;
+
+    if (-1 == (addr = ece391_mmap (length, 0)))
+        return 0;
+
+    hdr = (block_hdr_t*)addr;
+    hdr->size_class = LARGE_CLASS;
+    hdr->length = length;
+    return (uint8_t*)addr + BLOCK_HDR_SIZE;
+}
+
+void* ece391_malloc (uint32_t size)
+{
+    malloc_cache_t* cache = malloc_cache ();
+    free_obj_t* obj;
+    uint32_t cls;
+
+    if (0 == size)
+        return 0;
+    if (size > MAX_SMALL_SIZE)
+        return large_alloc (size);
+
+    for (cls = 0; (1 << (MIN_CLASS_SHIFT + cls)) < size; cls++);
+
+    if (0 != (obj = cache->free_list[cls])) {
+        cache->free_list[cls] = obj->next;
+        return obj;
+    }
+
+    if (cache->carve_next[cls] == cache->carve_end[cls] &&
+        -1 == slab_refill (cache, cls))
+        return 0;
+
+    obj = (free_obj_t*)cache->carve_next[cls];
+    cache->carve_next[cls] += 1 << (MIN_CLASS_SHIFT + cls);
+    return obj;
+}
+
+void ece391_free (void* ptr)
+{
+    malloc_cache_t* cache = malloc_cache ();
+    free_obj_t* obj = ptr;
+    block_hdr_t* hdr;
+
+    if (0 == ptr)
+        return;
+
+    /* mmap hands out addresses above the break, slabs sit below it */
+    if ((uint8_t*)ptr < cur_brk) {
+        hdr = (block_hdr_t*)((uint32_t)ptr & ~(SLAB_SIZE - 1));
+        obj->next = cache->free_list[hdr->size_class];
+        cache->free_list[hdr->size_class] = obj;
+    } else {
+        hdr = (block_hdr_t*)((uint8_t*)ptr - BLOCK_HDR_SIZE);
+        (void)ece391_munmap (hdr, hdr->length);
+    }
+}
@@ -0,0 +1,14 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+/* Writes the file system back to the disk it was mounted from. */
+int main ()
+{
+    if (0 != ece391_sync ()) {
+        ece391_fdputs (1, (uint8_t*)"sync failed\n");
+        return 2;
+    }
+    return 0;
+}
@@ -22,6 +22,100 @@ extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
 
+/*
+ * Heap management.  brk moves the end of the heap (0 queries it) and
+ * returns the new break.  mmap returns the address of a zero-filled,
+ * page-aligned anonymous mapping of at least length bytes.  With
+ * MMAP_LARGE the mapping is made of 4 MB pages (and is 4 MB aligned);
+ * such a mapping can only be unmapped in whole 4 MB pieces.
+ */
+#define MMAP_LARGE 0x1
+
+extern int32_t ece391_brk (void* addr);
+extern int32_t ece391_mmap (uint32_t length, uint32_t flags);
+extern int32_t ece391_munmap (void* addr, uint32_t length);
+
+/*
+ * Kernel runtime switches.  sysctl sets key to value (-1 only queries it)
+ * and returns the previous value.
+ */
+#define SYSCTL_SNAPSHOT 0   /* execute() snapshot cache: 1 on, 0 off */
+#define SYSCTL_MEM_TOTAL 1  /* read only: physical 4 kB pages managed */
+#define SYSCTL_MEM_FREE 2   /* read only: physical 4 kB pages free */
+#define SYSCTL_GLOBAL_PAGES 3   /* kernel TLB entries kept across switches: 1 on, 0 off */
+#define SYSCTL_SWITCH_CYCLES 4  /* read only: avg cycles per address space switch since last read */
+#define SYSCTL_ZRAM_PAGES 5     /* read only: user pages held compressed */
+#define SYSCTL_ZRAM_RATIO 6     /* read only: their compression ratio times 100 */
+#define SYSCTL_ZRAM_FAULT_CYCLES 7  /* read only: avg cycles per zram fault since last read */
+#define SYSCTL_ZRAM_RECLAIM 8   /* evict up to value pages of idle processes; returns count */
+#define SYSCTL_KSM 9            /* background same-page merging: 1 on, 0 off */
+#define SYSCTL_KSM_SAVED 10     /* read only: frames saved by merged pages */
+#define SYSCTL_FS_CACHE_HITS 11     /* read only: compressed or on-disk fs blocks found in the cache */
+#define SYSCTL_FS_CACHE_MISSES 12   /* read only: those decompressed or read from disk */
+#define SYSCTL_DISK_BLOCKS 13       /* read only: 4 kB blocks on the ATA disk, 0 without one */
+#define SYSCTL_DISK_SEQ 14          /* read value kB from the disk's start; returns avg cycles per kB */
+#define SYSCTL_DISK_RANDOM 15       /* value random 4 kB disk reads; returns avg cycles per kB */
+
+extern int32_t ece391_sysctl (uint32_t key, int32_t value);
+
+/*
+ * Writable files.  Writes go to an in-memory layer over the boot image and
+ * are lost at reboot.  create makes an empty file, unlink removes one (open
+ * descriptors keep working until closed) and truncate cuts or zero-extends
+ * an open file.  A program that is running cannot be written or removed.
+ */
+extern int32_t ece391_create (const uint8_t* filename);
+extern int32_t ece391_unlink (const uint8_t* filename);
+extern int32_t ece391_truncate (int32_t fd, uint32_t length);
+
+/*
+ * Directory listing.  getdents fills buf with as many records as fit for
+ * the directory open on fd, continuing where the last call stopped, and
+ * returns the bytes filled (0 after the last entry).
+ */
+#define DIRENT_RTC 0
+#define DIRENT_DIRECTORY 1
+#define DIRENT_REGULAR 2
+
+struct ece391_dirent {
+    uint32_t inode;
+    uint32_t size;          /* bytes; 0 for the rtc and v1 directories */
+    uint32_t type;          /* DIRENT_* */
+    uint8_t name[33];       /* NUL terminated */
+    uint8_t reserved[3];
+};
+
+extern int32_t ece391_getdents (int32_t fd, struct ece391_dirent* buf, int32_t nbytes);
+
+/*
+ * File information.  stat looks a file up by name, fstat describes the
+ * file, directory or rtc open on fd (not the terminal).  The size is the
+ * length in bytes now, so a whole file can be read with one call.
+ */
+struct ece391_stat {
+    uint32_t inode;
+    uint32_t size;          /* bytes; 0 for the rtc and v1 directories */
+    uint32_t type;          /* DIRENT_* */
+    uint32_t blocks;        /* 4 kB data blocks */
+};
+
+extern int32_t ece391_stat (const uint8_t* filename, struct ece391_stat* buf);
+extern int32_t ece391_fstat (int32_t fd, struct ece391_stat* buf);
+
+/*
+ * sendfile writes up to count bytes of the file open on in_fd to the
+ * terminal open on out_fd without passing them through user memory, and
+ * returns the bytes sent (0 at the end of the file).
+ */
+extern int32_t ece391_sendfile (int32_t out_fd, int32_t in_fd, int32_t count);
+
+/*
+ * sync writes every change to the file system since it was mounted to the
+ * disk it was mounted from.  It fails (-1) for an image loaded as a module,
+ * and while a file unlinked while open is still open.
+ */
+extern int32_t ece391_sync (void);
+
 enum signums {
 	DIV_ZERO = 0,
 	SEGFAULT,
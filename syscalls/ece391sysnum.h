@@ -11,5 +11,17 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_BRK     11
+#define SYS_MMAP    12
+#define SYS_MUNMAP  13
+#define SYS_SYSCTL  14
+#define SYS_CREATE  15
+#define SYS_UNLINK  16
+#define SYS_TRUNCATE    17
+#define SYS_GETDENTS    18
+#define SYS_STAT        19
+#define SYS_FSTAT       20
+#define SYS_SENDFILE    21
+#define SYS_SYNC        22
 
 #endif /* ECE391SYSNUM_H */